@@ -1,4 +1,5 @@
 #include <climits>
+#include <cstdlib>
 #include <iostream>
 #include <vector>
 #include <string>
@@ -21,6 +22,7 @@
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
 #include <CGAL/Triangulation_2.h>
 #include "Auxiliary.h"
+#include "LatticeCounting.h"
 
 typedef CGAL::Exact_predicates_inexact_constructions_kernel K;
 typedef CGAL::Delaunay_triangulation_2<K> Delaunay;
@@ -65,9 +67,7 @@ emptyLatticeTriangle( const Delaunay & t,
     b(toDGtal( v2->point())),
     c(toDGtal( v3->point()));
   
-  Z2i::Vector ab( b - a ), ac( c - a );
-  int d = ab[ 0 ] * ac[ 1 ] - ab[ 1 ] * ac[ 0 ];
-  return ( d == 1 ) || (d == -1 );
+  return LatticeCounting::isEmptyTriangle( a, b, c );
 }
 bool
 emptyLatticeTriangle( const Delaunay & t, const Face_handle & f )
@@ -77,9 +77,7 @@ emptyLatticeTriangle( const Delaunay & t, const Face_handle & f )
     b(toDGtal(f->vertex(1)->point())),
     c(toDGtal(f->vertex(2)->point()));
   
-  Z2i::Vector ab( b - a ), ac( c - a );
-  int d = ab[ 0 ] * ac[ 1 ] - ab[ 1 ] * ac[ 0 ];
-  return ( d == 1 ) || (d == -1 );
+  return LatticeCounting::isEmptyTriangle( a, b, c );
 }
 
 int
@@ -95,10 +93,8 @@ twiceNbLatticePointsInTriangle( const Delaunay & t,
     b(toDGtal( v2->point())),
     c(toDGtal( v3->point()));
   
-  Z2i::Vector ab( b - a ), ac( c - a );
-  int d = ab[ 0 ] * ac[ 1 ] - ab[ 1 ] * ac[ 0 ];
-  d = (d >= 0) ? (d - 1) : (-d - 1);
-  return d;
+  // By Pick's theorem, |2A| - 1 = 2I + B - 3.
+  return (int) std::abs( LatticeCounting::twiceSignedArea( a, b, c ) ) - 1;
 }
 
 int
@@ -421,10 +417,8 @@ namespace DGtal {
       Z2i::Point a( toDGtal( v1->point())),
         b(toDGtal( v2->point())),
         c(toDGtal( v3->point()));
-      Z2i::Vector ab( b - a ), ac( c - a );
-      int d = ab[ 0 ] * ac[ 1 ] - ab[ 1 ] * ac[ 0 ];
-      d = (d >= 0) ? (d - 1) : (-d - 1);
-      return d;
+      // By Pick's theorem, |2A| - 1 = 2I + B - 3.
+      return (int) std::abs( LatticeCounting::twiceSignedArea( a, b, c ) ) - 1;
     }
 
     bool isEdgeQuadrilateral( const Edge & e1 ) const
@@ -2,6 +2,9 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <thread>
+#include <algorithm>
+#include <memory>
 #include <boost/program_options/options_description.hpp>
 #include <boost/program_options/parsers.hpp>
 #include <boost/program_options/variables_map.hpp>
@@ -33,6 +36,8 @@
 #include "Triangulation2DHelper.h"
 #include "UmbrellaPart2D.h"
 #include "Auxiliary.h"
+#include "AVTStorage.h"
+#include "LatticeKernel.h"
 
 /**
    Primitive used for computing a (convoluted) radius of curvature
@@ -225,7 +230,10 @@ public:
    subtriangulation (T >= v) is a triangulation of the convex hull of
    (T >= v) relative to R^2 \setminus (T < v).
 
-   @tparam TTriangulation2 any kind of CGAL 2D triangulation.
+   @tparam TTriangulation2 any kind of CGAL 2D triangulation, whose
+   vertex and face infos are DGtal::AVTVertexInfo<TValue> and
+   DGtal::AVTFaceInfo<TValue> (see DGtal::AVTTriangulations). Values
+   are stored there instead of in side maps.
 
    @tparam TKernel2 any kind of CGAL 2D Kernel, for instance
    CGAL::Exact_predicates_inexact_constructions_kernel
@@ -253,10 +261,8 @@ public:
   typedef typename Kernel2::Vector_2                        Vector2;
   typedef typename Kernel2::FT                              Coordinate;
   typedef typename Kernel2::FT                              Component;
-  typedef typename std::map<VertexHandle,Value>             VertexHandle2ValueMap;
-  typedef typename std::map< std::pair<VertexHandle,VertexHandle>,
-                             Value>                         Edge2ValueMap;
-  typedef typename std::map<FaceHandle,Value>               FaceHandle2ValueMap;
+  typedef DGtal::AVTVertexInfo<Value>                       VertexInfo;
+  typedef DGtal::AVTFaceInfo<Value>                         FaceInfo;
   typedef DGtal::UmbrellaPart2D<Triangulation2,Kernel2>     Strip;
   typedef typename std::set<Edge>                           EdgeSet;
   typedef typename std::map<Point,VertexHandle>             Point2VertexHandleMap;
@@ -300,16 +306,11 @@ protected:
   /// The current triangulation.
   Triangulation2 _T;
   const Value _invalid;
-  /// A mapping VertexHandle -> Value that stores for each vertex its value.
-  VertexHandle2ValueMap _vFct;
-  /// A mapping Edge -> Value that stores for each edge its value (nb:
-  /// any edge has the same value as its mirror edge).
-  Edge2ValueMap _eFct;
-  /// A mapping FaceHandle -> Value that stores for each face its value.
-  FaceHandle2ValueMap _fFct;
   /// A mapping Point -> VertexHandle that stores for each point its corresponding vertex.
   Point2VertexHandleMap _p2vhMap
 ;
+  /// A scratch AVT, reused by errorTVWhenRemoved to triangulate one-rings.
+  std::unique_ptr<Self> _scratch;
   DGtal::Board2D _debugBoard;
 
 public:
@@ -330,9 +331,6 @@ public:
   void clear()
   {
     _T.clear();
-    _vFct.clear();
-    _eFct.clear();
-    _fFct.clear();
     _p2vhMap.clear();
     setInfiniteValue( invalid() );
   }
@@ -349,6 +347,15 @@ public:
   inline void add( const Point & pt, Value val )
   {
     VertexHandle vh = _T.insert( pt );
+    // Faces created or reshaped by the insertion are all incident to
+    // vh: forget their (stale) values. Edges of the link keep their
+    // value through the faces outside.
+    if ( _T.dimension() == 2 )
+      {
+        typename Triangulation2::Face_circulator fc = _T.incident_faces( vh );
+        typename Triangulation2::Face_circulator fcend = fc;
+        do { fc->info().reset(); } while ( ++fc != fcend );
+      }
     _p2vhMap[ pt ] = vh;
     setValue( vh, val );
   }
@@ -450,13 +457,68 @@ public:
     return it->second;
   }
 
+  /**
+     A candidate concavity of fullRelativeHull, i.e. the oriented edge
+     (v0,v1). The edge is remembered both as a face/index pair, which
+     is direct to use, and by its vertices, since flips may reshape
+     its face meanwhile.
+  */
+  struct PendingEdge {
+    Edge         edge;
+    VertexHandle v0;
+    VertexHandle v1;
+    PendingEdge( const Edge & e, VertexHandle s, VertexHandle t )
+      : edge( e ), v0( s ), v1( t ) {}
+  };
+  typedef std::vector<PendingEdge>                          PendingEdges;
+
+  /**
+     Appends the edge \a e to the worklist \a queue, unless it is
+     already pending (this is flagged in its face).
+  */
+  void pushPending( PendingEdges & queue, const Edge & e ) 
+  {
+    bool & queued = e.first->info().queued[ e.second ];
+    if ( queued ) return;
+    queued = true;
+    queue.push_back( PendingEdge( e, TH.source( e ), TH.target( e ) ) );
+  }
+
+  /**
+     Finds again the pending edge \a p in the triangulation. It is
+     immediate unless its face was reshaped by a flip, in which case
+     the edge is searched around v0 and \a p is updated.
+
+     @param[out] e the edge (v0,v1), when it exists.
+     @return 'false' iff (v0,v1) is not an edge anymore.
+  */
+  bool findPending( PendingEdge & p, Edge & e ) const
+  {
+    e = p.edge;
+    if ( ( TH.source( e ) == p.v0 ) && ( TH.target( e ) == p.v1 ) ) return true;
+    if ( ! T().is_edge( p.v0, p.v1, e.first, e.second ) ) return false;
+    if ( TH.source( e ) != p.v0 ) e = T().mirror_edge( e );
+    p.edge = e;
+    e.first->info().queued[ e.second ] = true;
+    return true;
+  }
+
+  /// Removes the pending edge \a p from the worklist.
+  void popPending( const PendingEdge & p ) const
+  {
+    const Edge & e = p.edge;
+    if ( ( TH.source( e ) == p.v0 ) && ( TH.target( e ) == p.v1 ) )
+      e.first->info().queued[ e.second ] = false;
+  }
+
   /**
      Used by fullRelativeHull to insert candidate concavities into the Queue.
      
+     @param queue the worklist.
+     @param strip a strip used for computations.
      @param e any finite edge of the triangulation.
   */
-  void insertQueue( std::set< std::pair< VertexHandle, VertexHandle > > & inQueue,
-		    const Edge & e ) 
+  void insertQueue( PendingEdges & queue, Strip & strip, const Edge & e ) 
   {
     ASSERT( ! T().is_infinite( e ) );
     VertexHandle v0 = TH.source( e );
@@ -480,19 +542,17 @@ public:
       }
     if ( ( val_v1 < val_v0 ) && ( val_e < val_v0 ) )
       {
-	Strip strip( T() );
         NoGreaterThanValuePredicate predNoGreaterThanV1( *this, val_e );
         strip.init( predNoGreaterThanV1, predNoGreaterThanV1, e );
         if ( strip.isConcave() ) 
-          inQueue.insert( std::make_pair( v0, v1 ) );
+          pushPending( queue, e );
       }
     else if ( ( val_v0 < val_v1 ) && ( val_e < val_v1 ) )
       {
-	Strip strip( T() );
         NoGreaterThanValuePredicate predNoGreaterThanV1( *this, val_e );
         strip.init( predNoGreaterThanV1, predNoGreaterThanV1, T().mirror_edge( e ) );
         if ( strip.isConcave() ) 
-          inQueue.insert( std::make_pair( v1, v0 ) );
+          pushPending( queue, T().mirror_edge( e ) );
       }
   }
 
@@ -508,49 +568,47 @@ public:
      complexifying a lot the way concavities (v0,v1) are pushed into
      the queue.
 
+     Candidate concavities are processed in FIFO order from a
+     worklist of edges, and the same strip is reused for all of them.
+
      @return 'true' if some concavity was flipped, 'false' when no concavity was found.
   */
   bool fullRelativeHull()
   {
     bool changes = false;
-    // static const Label rmark = 1;
-    std::set< std::pair< VertexHandle, VertexHandle > > inQueue;
+    PendingEdges queue;
     Strip strip( T() );
-    // DGtal::trace.beginBlock( "Searching concavities" );
     for ( FiniteEdgesIterator it = T().finite_edges_begin(), itend = T().finite_edges_end();
           it != itend; ++it )
       {
         Edge e = *it;
-	insertQueue( inQueue, e );
+	insertQueue( queue, strip, e );
       }
-    DGtal::trace.info() << "- Found " << inQueue.size() << " potential concavities." 
+    DGtal::trace.info() << "- Found " << queue.size() << " potential concavities." 
 			<< std::endl;
-    // DGtal::trace.endBlock();
-    // DGtal::trace.beginBlock( "Flipping concavities" );
     unsigned int nb_checked = 0;
     unsigned int nb_flipped = 0;
     unsigned int nb_concave = 0;
+    std::size_t  head       = 0;
     Edge e;
-    while ( ! inQueue.empty() )
+    while ( head < queue.size() )
       {
-	VertexHandle v0 = inQueue.begin()->first;
-	VertexHandle v1 = inQueue.begin()->second;
+        PendingEdge & p = queue[ head ];
         ++nb_checked;
         if ( nb_checked % 1000 == 0 ) 
-          DGtal::trace.info() << "- Queue=" << inQueue.size()
+          DGtal::trace.info() << "- Queue=" << ( queue.size() - head )
                               << ", flipped " << nb_flipped << "/" << nb_checked 
                               << " edges in a concavity." << std::endl;
-	if ( ! T().is_edge( v0, v1, e.first, e.second ) )
+	if ( ! findPending( p, e ) )
 	  {
-	    inQueue.erase( inQueue.begin() );
+	    ++head;
 	    continue; // (v0,v1) is not an edge anymore.
 	  }
-	if ( TH.source( e ) != v0 ) 
-	  e = T().mirror_edge( e );
+        VertexHandle v0 = p.v0;
         Value val_V1 = value( e ); // value( TH.target( e ) );
         if ( val_V1 >= value( v0 ) ) // edge has already the value of the source.
 	  {
-	    inQueue.erase( inQueue.begin() );
+            popPending( queue[ head++ ] );
 	    continue; 
 	  }
         NoGreaterThanValuePredicate predNoGreaterThanV1( *this, val_V1 );
@@ -577,13 +635,10 @@ public:
 		Edge edge_quad = T().mirror_edge( strip.e( i-1 ) );
                 FaceHandle f1 = fedge.first;
                 FaceHandle f2 = fmedge.first;
-                // remove value for f1, f2, fedge, fmedge
-                eraseValue( f1 ); 
-                eraseValue( f2 );
-                eraseValue( fedge );
-		Edge mirror_first = T().mirror_edge( strip.e( 0 ) );
-                // DGtal::trace.info() << "  - Flipping " << TH.source( fedge )->point() 
-                //                     << " -> " <<  TH.target( fedge )->point() << std::endl;
+                // remove values for f1, f2 and their edges since the
+                // flip reuses these faces. The border of the quad
+                // keeps its values in the faces outside.
+                eraseQuadValues( f1, f2 );
 		_T.flip( fedge.first, fedge.second );
                 fedge = T().mirror_edge( edge_quad );
                 Edge new_edge = TH.nextCCWAroundFace( fedge );
@@ -591,15 +646,10 @@ public:
                 eraseValue( new_edge ); 
                 eraseValue( new_edge.first );
                 eraseValue( T().mirror_edge( new_edge ).first );
-                Edge fedge2 = TH.nextCCWAroundFace( new_edge );
-                // setValue( fedge, std::max( value( fedge ), val_V1+1 ) );
-                // setValue( new_edge, std::max( value( new_edge ), val_V1+1 ) );
-                // setValue( fedge2, std::max( value( fedge2 ), val_V1+1 ) );
 		if ( strip.size() == 3 ) 
 		  { // last flip made a triangle
-                    // setValue( new_edge, std::max( value( new_edge ), val ) );
                     setValue( new_edge.first, std::max( value( new_edge.first ), val ) );
-		    inQueue.erase( inQueue.begin() );
+                    popPending( queue[ head++ ] );
 		  }
 		changes = true; ++nb_flipped;
 	      }
@@ -612,18 +662,15 @@ public:
                     setValue( strip.f( i ), std::max( value( strip.f( i ) ), val ) );
                   }
                 changes = true; ++nb_concave;
-		inQueue.erase( inQueue.begin() );
+                popPending( queue[ head++ ] );
 	      }
           }
 	else
-	  inQueue.erase( inQueue.begin() );
+          popPending( queue[ head++ ] );
       }
-    ASSERT( inQueue.empty() );
     DGtal::trace.info() << "- Flipped " << nb_flipped 
                         << ", concave " << nb_concave
                         << " / " << nb_checked << " edges in a concavity." << std::endl;
-    //if ( nb_flipped == 1 && nb_checked == 2 ) changes = false;
-    // DGtal::trace.endBlock();
     return changes;
   }
   
@@ -749,9 +796,8 @@ public:
   */
   Value value( VertexHandle v ) const
   {
-    typename VertexHandle2ValueMap::const_iterator it = _vFct.find( v );
-    if ( it == _vFct.end() ) return _invalid;
-    return it->second;
+    const VertexInfo & vi = v->info();
+    return vi.valid ? vi.value : _invalid;
   }
 
   /**
@@ -762,19 +808,17 @@ public:
   */
   Value value( Edge e )
   {
-    // Pick "smallest" edge to find value.
+    FaceInfo & fi = e.first->info();
+    if ( fi.edge_valid[ e.second ] ) return fi.edge[ e.second ];
+    // The value may be known only by the other side.
     Edge mirror_e = T().mirror_edge( e );
-    if ( TH.source( mirror_e ) < TH.source( e ) ) e = mirror_e;
-    std::pair<VertexHandle, VertexHandle> edge = std::make_pair( TH.source( e ), TH.target( e ) );
-    typename Edge2ValueMap::const_iterator it = _eFct.find( edge );
-    if ( it == _eFct.end() ) 
-      {
-        Value v = std::min( value( TH.source( e ) ), 
-                            value( TH.target( e ) ) );
-        _eFct[ edge ] = v;
-        return v;
-      }
-    return it->second;
+    FaceInfo & mi = mirror_e.first->info();
+    const Value v = mi.edge_valid[ mirror_e.second ]
+      ? mi.edge[ mirror_e.second ]
+      : std::min( value( TH.source( e ) ), value( TH.target( e ) ) );
+    fi.edge[ e.second ]        = mi.edge[ mirror_e.second ]       = v;
+    fi.edge_valid[ e.second ]  = mi.edge_valid[ mirror_e.second ] = true;
+    return v;
   }
 
   /**
@@ -785,15 +829,15 @@ public:
   */
   Value value( FaceHandle f )
   {
-    typename FaceHandle2ValueMap::const_iterator it = _fFct.find( f );
-    if ( it == _fFct.end() ) 
+    FaceInfo & fi = f->info();
+    if ( ! fi.valid ) 
       {
         Value v = std::min( std::min( value( Edge( f, 0 ) ), value( Edge( f, 1 ) ) ), 
                             value( Edge( f, 2 ) ) );
-        _fFct[ f ] = v;
-        return v;
+        fi.value = v;
+        fi.valid = true;
       }
-    return it->second;
+    return fi.value;
   }
 
   /**
@@ -803,20 +847,22 @@ public:
   */
   inline void setValue( VertexHandle vh, Value val )
   {
-    _vFct[ vh ] = val;
+    vh->info().value = val;
+    vh->info().valid = true;
   }
 
   /**
-     Sets the value for the given edge
+     Sets the value for the given edge (and its mirror edge).
      @param e any edge.
      @param val any value.
   */
   inline void setValue( Edge e, Value val )
   {
     Edge mirror_e = T().mirror_edge( e );
-    if ( TH.source( mirror_e ) < TH.source( e ) ) e = mirror_e;
-    std::pair<VertexHandle, VertexHandle> edge = std::make_pair( TH.source( e ), TH.target( e ) );
-    _eFct[ edge ] = val;
+    FaceInfo & fi = e.first->info();
+    FaceInfo & mi = mirror_e.first->info();
+    fi.edge[ e.second ]        = mi.edge[ mirror_e.second ]       = val;
+    fi.edge_valid[ e.second ]  = mi.edge_valid[ mirror_e.second ] = true;
   }
 
   /**
@@ -826,7 +872,8 @@ public:
   */
   inline void setValue( FaceHandle fh, Value val )
   {
-    _fFct[ fh ] = val;
+    fh->info().value = val;
+    fh->info().valid = true;
   }
 
   /**
@@ -834,7 +881,7 @@ public:
   */
   inline void setInfiniteValue( Value v )
   {
-    _vFct[ _T.infinite_vertex() ] = v;
+    setValue( _T.infinite_vertex(), v );
   }
 
   /**
@@ -842,19 +889,17 @@ public:
   */
   void eraseValue( VertexHandle vh )
   {
-    _vFct.erase( vh );
+    vh->info().valid = false;
   }
 
   /**
-     Erases the value associated with the edge e.
+     Erases the value associated with the edge e (and its mirror edge).
   */
   void eraseValue( Edge e )
   {
-    // Pick "smallest" edge to find value.
     Edge mirror_e = T().mirror_edge( e );
-    if ( TH.source( mirror_e ) < TH.source( e ) ) e = mirror_e;
-    std::pair<VertexHandle, VertexHandle> edge = std::make_pair( TH.source( e ), TH.target( e ) );
-    _eFct.erase( edge );
+    e.first->info().edge_valid[ e.second ]               = false;
+    mirror_e.first->info().edge_valid[ mirror_e.second ] = false;
   }
 
   /**
@@ -862,9 +907,34 @@ public:
   */
   void eraseValue( FaceHandle fh )
   {
-    _fFct.erase( fh );
+    fh->info().valid = false;
   }
 
+  /**
+     Erases the values of the faces \a f1 and \a f2 and of their
+     edges, before a flip reuses these faces. The values of the border
+     edges of the quad are first copied to the faces outside, which
+     may have lost their own copy when reset by an earlier flip.
+  */
+  void eraseQuadValues( FaceHandle f1, FaceHandle f2 )
+  {
+    const FaceHandle quad[ 2 ] = { f1, f2 };
+    for ( int k = 0; k < 2; ++k )
+      {
+        FaceInfo & fi = quad[ k ]->info();
+        for ( int i = 0; i < 3; ++i )
+          {
+            if ( ! fi.edge_valid[ i ] ) continue;
+            Edge mirror_e = T().mirror_edge( Edge( quad[ k ], i ) );
+            if ( mirror_e.first == f1 || mirror_e.first == f2 ) continue;
+            FaceInfo & mi = mirror_e.first->info();
+            mi.edge[ mirror_e.second ]       = fi.edge[ i ];
+            mi.edge_valid[ mirror_e.second ] = true;
+          }
+      }
+    f1->info().reset();
+    f2->info().reset();
+  }
 
   // ---------------------- gradient services --------------------------------
 public:
@@ -976,6 +1046,116 @@ public:
     return grad * ( pas * pas / s );
   }
 
+  /**
+     Computes gradientPixel for every pixel (x0 + i*s, y0 + j*s) of a
+     \a w x \a h image. Instead of locating each of the 8x8
+     subsamples of each pixel, the faces are rasterized once on the
+     grid of all subsamples, so the cost is linear in the number of
+     subsamples plus the number of faces.
+
+     Subsamples near the border of their face are located as in
+     gradientPixel, so that those lying on an edge or a vertex get the
+     mean gradient of the adjacent faces, as with gradient( x, y ).
+
+     @param[out] grads the gradients, grads[ j*w + i ] for pixel (i,j).
+  */
+  void gradientPixels( double x0, double y0, double s, int w, int h,
+                       std::vector<Vector2> & grads ) const
+  {
+    const int n = 8;
+    const double pas = 1.0 / (double) n;
+    const double spas = s * pas;
+    // Same subsamples as gradientPixel.
+    const double shift = - s * pas * ( (double) n + 1.0 ) / 2.0;
+    std::vector<double> gx( w * h, 0.0 );
+    std::vector<double> gy( w * h, 0.0 );
+    FaceHandle current;
+    Vector2    grad( 0.0, 0.0 );
+    rasterize( x0 + shift, y0 + shift, spas, n * w, n * h,
+               [&] ( int i, int j, FaceHandle fh, bool border ) {
+                 const int k = ( j / n ) * w + ( i / n );
+                 Vector2 g;
+                 if ( border )
+                   { // Coordinates computed exactly as in gradientPixel.
+                     double x = ( x0 + ( i / n ) * s ) + shift;
+                     double y = ( y0 + ( j / n ) * s ) + shift;
+                     for ( int l = 0; l < i % n; ++l ) x += spas;
+                     for ( int l = 0; l < j % n; ++l ) y += spas;
+                     g = gradient( x, y, fh );
+                   }
+                 else
+                   {
+                     if ( fh != current ) { current = fh; grad = gradient( fh ); }
+                     g = grad;
+                   }
+                 gx[ k ] += g.x();
+                 gy[ k ] += g.y();
+               } );
+    grads.resize( w * h );
+    for ( int k = 0; k < w * h; ++k )
+      grads[ k ] = Vector2( gx[ k ], gy[ k ] ) * ( pas * pas / s );
+  }
+
+  // ---------------------- raster services --------------------------------
+public:
+
+  /**
+     Visits the samples (x0 + i*step, y0 + j*step), for 0 <= i < w and
+     0 <= j < h, face by face: each finite face is rasterized once and
+     \a visitor( i, j, fh, border ) is called for each sample it
+     covers. A sample on an edge shared by two faces is visited only
+     once (spans are half-open, rightward and upward). Samples outside
+     the convex hull are not visited.
+
+     The flag \a border is 'true' for the first and last samples of
+     each span and for the samples of the first and last rows of the
+     face: every sample that may lie on an edge or a vertex of \a fh
+     is flagged, whatever the rounding of the span ends.
+
+     @tparam Visitor a functor (int, int, FaceHandle, bool) -> void.
+  */
+  template <typename Visitor>
+  void rasterize( double x0, double y0, double step, int w, int h,
+                  Visitor visitor ) const
+  {
+    for ( FiniteFacesIterator it = T().finite_faces_begin(), ite = T().finite_faces_end();
+          it != ite; ++it )
+      {
+        FaceHandle fh = it;
+        Point p[ 3 ] = { fh->vertex( 0 )->point(), fh->vertex( 1 )->point(),
+                         fh->vertex( 2 )->point() };
+        // Sort by (y,x) so that every edge is always interpolated from
+        // its lowest point: neighboring faces get exactly the same
+        // abscissa on their common edge.
+        std::sort( p, p + 3, [] ( const Point & a, const Point & b )
+                   { return ( a.y() < b.y() ) || ( ( a.y() == b.y() ) && ( a.x() < b.x() ) ); } );
+        const int jmin = std::max( 0,     (int) ceil( ( p[ 0 ].y() - y0 ) / step ) );
+        const int jmax = std::min( h - 1, (int) ceil( ( p[ 2 ].y() - y0 ) / step ) - 1 );
+        for ( int j = jmin; j <= jmax; ++j )
+          {
+            const double y = y0 + j * step;
+            double xl = DBL_MAX;
+            double xr = -DBL_MAX;
+            const int e[ 3 ][ 2 ] = { { 0, 1 }, { 1, 2 }, { 0, 2 } };
+            for ( int k = 0; k < 3; ++k )
+              {
+                const Point & a = p[ e[ k ][ 0 ] ];
+                const Point & b = p[ e[ k ][ 1 ] ];
+                if ( ( a.y() == b.y() ) || ( y < a.y() ) || ( y > b.y() ) ) continue;
+                const double x = a.x() + ( y - a.y() ) * ( b.x() - a.x() ) / ( b.y() - a.y() );
+                xl = std::min( xl, x );
+                xr = std::max( xr, x );
+              }
+            if ( xl > xr ) continue;
+            const int imin = std::max( 0,     (int) ceil( ( xl - x0 ) / step ) );
+            const int imax = std::min( w - 1, (int) ceil( ( xr - x0 ) / step ) - 1 );
+            const bool border_row = ( j == jmin ) || ( j == jmax );
+            for ( int i = imin; i <= imax; ++i )
+              visitor( i, j, fh, border_row || ( i == imin ) || ( i == imax ) );
+          }
+      }
+  }
+
   // ---------------------- various services --------------------------------
 public:
   
@@ -1032,10 +1212,23 @@ public:
      @return the value at position \a p. 
   */
   double preciseValue( Point p, bool gouraud, FaceHandle hint = FaceHandle() )
+  {
+    return preciseValue( p, gouraud, hint, hint );
+  }
+
+  /**
+     @param[in] p any point.
+     @param[in] gouraud when 'true', performs Gouraud interpolation.
+     @param[in] hint the face where the location of \a p starts.
+     @param[out] located the face where \a p was located.
+     @return the value at position \a p. 
+  */
+  double preciseValue( Point p, bool gouraud, FaceHandle hint, FaceHandle & located )
   {
     typename Triangulation2::Locate_type lt;
     int li;
     FaceHandle	fh = T().locate( p, lt, li, hint );
+    located = fh;
     double result = 0.0;
     switch ( lt ) {
     case Triangulation2::VERTEX:
@@ -1070,30 +1263,89 @@ public:
     return result;
   }
 
-  double errorTVOnTriangle( Point p1, Point p2, Point p3, 
-			    double v1, double v2, double v3,
-			    bool gouraud, int subdivision = 2 )
+  /**
+     Computes the values at all points of \a pts. Each point is
+     located by walking from the face of the previous one, so
+     spatially coherent batches are evaluated without a full
+     location per point.
+
+     @param[out] values the values, in the same order as \a pts.
+  */
+  void preciseValues( const std::vector<Point> & pts, bool gouraud,
+                      std::vector<double> & values )
+  {
+    values.resize( pts.size() );
+    FaceHandle hint;
+    for ( unsigned int i = 0; i < pts.size(); ++i )
+      values[ i ] = preciseValue( pts[ i ], gouraud, hint, hint );
+  }
+
+  /**
+     The samples of the error estimation on a triangle: the centroids
+     of its subtriangles, the value of the affine interpolation at
+     these points and the (twice) area of the subtriangles.
+  */
+  struct ErrorSamples {
+    std::vector<Point>  points;
+    std::vector<double> values;
+    std::vector<double> areas;
+  };
+
+  /**
+     Subdivides \a subdivision times the triangle (p1,p2,p3) with
+     values (v1,v2,v3) and appends its leaves to \a samples, in
+     recursion order, hence neighboring leaves are consecutive.
+  */
+  static void errorSamplesOnTriangle( ErrorSamples & samples,
+                                      Point p1, Point p2, Point p3, 
+                                      double v1, double v2, double v3,
+                                      int subdivision )
   {
     if ( subdivision <= 0 ) 
       {
-	double val_one = midValue( v1, v2, v3 );
-	double val_two = preciseValue( midPoint( p1, p2, p3 ), gouraud );
-	return ( val_one - val_two ) * ( val_one - val_two ) 
-	  * twiceAreaTriangle( p1, p2, p3 );
+        samples.points.push_back( midPoint( p1, p2, p3 ) );
+        samples.values.push_back( midValue( v1, v2, v3 ) );
+        samples.areas.push_back( twiceAreaTriangle( p1, p2, p3 ) );
+        return;
+      }
+    errorSamplesOnTriangle( samples, p1, midPoint( p1, p2 ), midPoint( p1, p3 ),
+                            v1, midValue( v1, v2 ), midValue( v1, v3 ),
+                            subdivision - 1 );
+    errorSamplesOnTriangle( samples, midPoint( p1, p2 ), p2, midPoint( p2, p3 ),
+                            midValue( v1, v2 ), v2, midValue( v2, v3 ),
+                            subdivision - 1 );
+    errorSamplesOnTriangle( samples, midPoint( p1, p2 ), midPoint( p1, p3 ), midPoint( p2, p3 ),
+                            midValue( v1, v2 ), midValue( v1, v3 ), midValue( v2, v3 ),
+                            subdivision - 1 );
+    errorSamplesOnTriangle( samples, midPoint( p1, p3 ), midPoint( p2, p3 ), p3,
+                            midValue( v1, v3 ), midValue( v2, v3 ), v3,
+                            subdivision - 1 );
+  }
+
+  /**
+     @return the error between the AVT and the given samples (sum of
+     squared differences weighted by the areas).
+  */
+  double errorTV( const ErrorSamples & samples, bool gouraud )
+  {
+    std::vector<double> values;
+    preciseValues( samples.points, gouraud, values );
+    double error = 0.0;
+    for ( unsigned int i = 0; i < values.size(); ++i )
+      {
+        const double diff = samples.values[ i ] - values[ i ];
+        error += diff * diff * samples.areas[ i ];
       }
-    else
-      return errorTVOnTriangle( p1, midPoint( p1, p2 ), midPoint( p1, p3 ),
-				  v1, midValue( v1, v2 ), midValue( v1, v3 ),
-				  gouraud, subdivision - 1 )
-	+ errorTVOnTriangle( midPoint( p1, p2 ), p2, midPoint( p2, p3 ),
-			     midValue( v1, v2 ), v2, midValue( v2, v3 ),
-			     gouraud, subdivision - 1 )
-	+ errorTVOnTriangle( midPoint( p1, p2 ), midPoint( p1, p3 ), midPoint( p2, p3 ),
-			     midValue( v1, v2 ), midValue( v1, v3 ), midValue( v2, v3 ),
-			     gouraud, subdivision - 1 )
-	+ errorTVOnTriangle( midPoint( p1, p3 ), midPoint( p2, p3 ), p3,
-			     midValue( v1, v3 ), midValue( v2, v3 ), v3,
-			     gouraud, subdivision - 1 );
+    return error;
+  }
+
+  double errorTVOnTriangle( Point p1, Point p2, Point p3, 
+			    double v1, double v2, double v3,
+			    bool gouraud, int subdivision = 2 )
+  {
+    ErrorSamples samples;
+    errorSamplesOnTriangle( samples, p1, p2, p3, v1, v2, v3, subdivision );
+    return errorTV( samples, gouraud );
   }
 
   /**
@@ -1108,7 +1360,9 @@ public:
     std::vector<Point> neighbors;
     std::vector<Value> values;
 
-    Self miniAVT( _invalid );
+    if ( ! _scratch ) _scratch.reset( new Self( _invalid ) );
+    Self & miniAVT = *_scratch;
+    miniAVT.clear();
     typename Triangulation2::Vertex_circulator ci_start = T().incident_vertices( vh );
     typename Triangulation2::Vertex_circulator ci = ci_start;
     do {
@@ -1118,14 +1372,15 @@ public:
       miniAVT.add( neighbors.back(), values.back() );
       ++ci;
     } while ( ci != ci_start );
-    double error = 0.0;
+    // All the samples of the star are evaluated in one batch.
+    ErrorSamples samples;
     for ( unsigned int i = 0; i < neighbors.size(); ++i )
       {
 	unsigned int j = ( i+1 ) % neighbors.size();
-	error += miniAVT.errorTVOnTriangle( p, neighbors[ i ], neighbors[ j ],
-					    val, values[ i ], values[ j ], gouraud, sub );
+	errorSamplesOnTriangle( samples, p, neighbors[ i ], neighbors[ j ],
+                                val, values[ i ], values[ j ], sub );
       }
-    return error;
+    return miniAVT.errorTV( samples, gouraud );
   }
 
   struct VertexError {
@@ -1145,6 +1400,85 @@ public:
     }
   };
 
+  /**
+     An indexed binary min-heap of vertices ordered by their removal
+     error, used by compress. The position of each vertex in the heap
+     is stored in its info, so that its error may be updated in
+     O(log n) when its one-ring changes.
+  */
+  class VertexErrorHeap {
+  public:
+    ~VertexErrorHeap() { clear(); }
+    bool empty() const { return _heap.empty(); }
+    unsigned int size() const { return _heap.size(); }
+    const VertexError & top() const { return _heap.front(); }
+    bool contains( VertexHandle vh ) const { return vh->info().heap >= 0; }
+
+    void push( VertexHandle vh, double error )
+    {
+      _heap.push_back( VertexError( vh, error ) );
+      up( _heap.size() - 1 );
+    }
+
+    void update( VertexHandle vh, double error )
+    {
+      int i = vh->info().heap;
+      ASSERT( i >= 0 );
+      VertexError ve( vh, error );
+      if ( _less( ve, _heap[ i ] ) ) { _heap[ i ] = ve; up( i ); }
+      else                           { _heap[ i ] = ve; down( i ); }
+    }
+
+    void pop()
+    {
+      _heap.front()._vh->info().heap = -1;
+      if ( _heap.size() > 1 ) place( 0, _heap.back() );
+      _heap.pop_back();
+      if ( ! _heap.empty() ) down( 0 );
+    }
+
+    void clear()
+    {
+      for ( unsigned int i = 0; i < _heap.size(); ++i )
+        _heap[ i ]._vh->info().heap = -1;
+      _heap.clear();
+    }
+
+  private:
+    std::vector<VertexError> _heap;
+    VertexErrorComparator    _less;
+
+    void place( int i, const VertexError & ve )
+    {
+      _heap[ i ] = ve;
+      ve._vh->info().heap = i;
+    }
+    void up( int i )
+    {
+      VertexError ve = _heap[ i ];
+      while ( i > 0 ) {
+        int p = ( i - 1 ) / 2;
+        if ( ! _less( ve, _heap[ p ] ) ) break;
+        place( i, _heap[ p ] );
+        i = p;
+      }
+      place( i, ve );
+    }
+    void down( int i )
+    {
+      VertexError ve = _heap[ i ];
+      const int n = _heap.size();
+      while ( 2 * i + 1 < n ) {
+        int c = 2 * i + 1;
+        if ( ( c + 1 < n ) && _less( _heap[ c + 1 ], _heap[ c ] ) ) ++c;
+        if ( ! _less( _heap[ c ], ve ) ) break;
+        place( i, _heap[ c ] );
+        i = c;
+      }
+      place( i, ve );
+    }
+  };
+
   bool isOnConvexHull( VertexHandle vh ) const
   {
     typename Triangulation2::Vertex_circulator ci_start 
@@ -1168,69 +1502,48 @@ public:
 	_T.insert_constraint( TH.source( *it ), TH.target( *it ) );
       }
 
-    DGtal::trace.info() << "[AVT::compress] Removing vertices." << std::endl;
-    std::set< VertexError, VertexErrorComparator > candidates;
-    std::set< VertexHandle > modified_vertices;
+    DGtal::trace.info() << "[AVT::compress] Computing removal errors." << std::endl;
+    VertexErrorHeap candidates;
+    for ( FiniteVerticesIterator it = T().finite_vertices_begin(), 
+            ite = T().finite_vertices_end(); it != ite; ++it )
+      {
+        if ( ! isOnConvexHull( it ) )
+          candidates.push( it, errorTVWhenRemoved( it, gouraud, sub ) );
+      }
     unsigned int nb = T().number_of_vertices();
     unsigned int to_remove = (unsigned int) ceil( ((double)nb) * ratio );
-    unsigned int nb_candidates = 0;
-    unsigned int nb_removed = 0;
-    unsigned int nb_rescan = 0;
-    double ratio_rescan = 0.25;
-    while ( to_remove != 0 )
+    DGtal::trace.info() << "[AVT::compress]"
+                        << " to_remove=" << to_remove
+                        << " candidates=" << candidates.size() << std::endl;
+    DGtal::trace.info() << "[AVT::compress] Removing vertices." << std::endl;
+    std::vector< VertexHandle > neighbors;
+    while ( ( to_remove != 0 ) && ! candidates.empty() )
       {
-	if ( candidates.empty() 
-	     || ( nb_removed >= nb_rescan ) )
-	  {
-	    modified_vertices.clear();
-	    candidates.clear();
-	    nb_removed = 0;
-	    nb_candidates = 0;
-	    for ( FiniteVerticesIterator it = T().finite_vertices_begin(), 
-		    ite = T().finite_vertices_end(); it != ite; ++it )
-	      {
-		if ( ! isOnConvexHull( it ) )
-		  {
-		    VertexError ve( it, errorTVWhenRemoved( it, gouraud, sub ) );
-		    candidates.insert( ve );
-		    ++nb_candidates;
-		  }
-	      }
-	    nb_rescan = (unsigned int) ceil( ratio_rescan * (double) nb_candidates );
-	    DGtal::trace.info() << "[AVT::compress]"
-				<< " to_remove=" << to_remove
-				<< " candidates=" << nb_candidates
-				<< " rescan=" << nb_rescan << std::endl;
-	  }
-	VertexError ve = *( candidates.begin() );
-	candidates.erase( candidates.begin() );
-	// DGtal::trace.info() << "[" << to_remove << "]"
-	// 		    << "Compressing pt=" << ve._vh->point() 
-	// 		    << " error=" << ve._error << std::endl;
-	typename std::set< VertexHandle >::iterator itm 
-	  = modified_vertices.find( ve._vh );
-	if ( itm != modified_vertices.end() )
-	  { // this vertex was closed to a removed vertex.
-	    continue;
-	  }
-	// Mark nearby vertices
-	Edge start = *( T().incident_edges( ve._vh ) );
-	if ( TH.source( start ) != ve._vh ) start = T().mirror_edge( start );
+	VertexHandle vh = candidates.top()._vh;
+	candidates.pop();
+	// Forget values around vh and collect its one-ring.
+        neighbors.clear();
+	Edge start = *( T().incident_edges( vh ) );
+	if ( TH.source( start ) != vh ) start = T().mirror_edge( start );
 	Edge e = start;
 	do {
-	  modified_vertices.insert( TH.target( e ) );
+	  neighbors.push_back( TH.target( e ) );
 	  eraseValue( e );
 	  eraseValue( e.first );
 	  e = TH.nextCCWAroundSourceVertex( e );
 	} while ( e != start );
 	// Remove vertex.
-	eraseValue( ve._vh );
-	modified_vertices.erase( ve._vh );
-	_T.remove_incident_constraints( ve._vh );
-	_T.remove( ve._vh );
+	eraseValue( vh );
+	_T.remove_incident_constraints( vh );
+	_T.remove( vh );
 	--to_remove;
-	++nb_removed;
+        // Only the one-rings of the neighbors have changed.
+        for ( unsigned int i = 0; i < neighbors.size(); ++i )
+          if ( candidates.contains( neighbors[ i ] ) )
+            candidates.update( neighbors[ i ],
+                               errorTVWhenRemoved( neighbors[ i ], gouraud, sub ) );
       }
+    candidates.clear();
     for ( FiniteVerticesIterator it = T().finite_vertices_begin(), 
 	    ite = T().finite_vertices_end(); it != ite; ++it )
       _T.remove_incident_constraints( it );
@@ -1513,21 +1826,38 @@ struct Reverse {
 namespace po = boost::program_options;
 ///////////////////////////////////////////////////////////////////////////////
 
+/**
+   Runs at most \a l passes of fullRelativeHull on \a avt, stopping
+   earlier when nothing changes. Does not open a trace block, so that
+   it may be called from several threads.
+*/
 template <typename AVT>
-void computeFullRelativeHull( AVT & avt, int l, std::string txt )
+void computeFullRelativeHullPasses( AVT & avt, int l, const std::string & txt )
 {
   using namespace DGtal;
-  txt = "Compute full relative hull -- " + txt;
-  trace.beginBlock( txt.c_str() );
   unsigned int pass = 0;
   bool changes = true;
   do {
-    trace.info() << "- Pass " << pass << std::endl;
+    trace.info() << "- " << txt << " pass " << pass << std::endl;
     changes = avt.fullRelativeHull();
     ++pass;
     if ( pass >= l ) break;
   } while ( changes );
-  trace.endBlock();
+}
+
+/**
+   Calls \a fct( c ) for each channel c in [0,n), each one in its own
+   thread, and returns when all channels are done. Channels must not
+   share any modifiable data.
+*/
+template <typename Function>
+void forEachChannelConcurrently( unsigned int n, Function fct )
+{
+  std::vector<std::thread> threads;
+  for ( unsigned int c = 0; c < n; ++c )
+    threads.push_back( std::thread( fct, c ) );
+  for ( unsigned int c = 0; c < n; ++c )
+    threads[ c ].join();
 }
 
 template <typename AVT>
@@ -1674,11 +2004,18 @@ void viewAVTGradient( OutImage & dImage, AVT & avt, const std::string & s, int n
   OutImage dImage2( dImage );
   double step = 1.0 / (double) n;
   typedef typename OutImage::Domain Domain;
+  typedef typename Domain::Point    DPoint;
+  const DPoint lo = dImage.domain().lowerBound();
+  const DPoint up = dImage.domain().upperBound();
+  const int    w  = up[ 0 ] - lo[ 0 ] + 1;
+  std::vector<typename AVT::Vector2> grads;
+  avt.gradientPixels( ((double) lo[ 0 ]) * step, ((double) lo[ 1 ]) * step, step,
+                      w, up[ 1 ] - lo[ 1 ] + 1, grads );
   for ( typename Domain::ConstIterator it = dImage.domain().begin(), ite = dImage.domain().end();
         it != ite; ++it )
     {
-      typename AVT::Vector2 grad = avt.gradientPixel( ((double) (*it)[ 0 ]) * step, 
-						      ((double) (*it)[ 1 ]) * step, step );
+      const DPoint p = *it - lo;
+      typename AVT::Vector2 grad = grads[ p[ 1 ] * w + p[ 0 ] ];
       double val = std::min( 127.0, std::max( -128.0, grad.x() ) ) + 128.0;
       dImage.setValue( *it, (int) round(val) );
       val = std::min( 127.0, std::max( -128.0, grad.y() ) ) + 128.0;
@@ -1691,9 +2028,9 @@ void viewAVTGradient( OutImage & dImage, AVT & avt, const std::string & s, int n
 template <typename Value>
 int affineValuedTriangulation( po::variables_map & vm )
 {
-  typedef CGAL::Exact_predicates_inexact_constructions_kernel Kernel2;
-  typedef CGAL::Constrained_Delaunay_triangulation_2<Kernel2> Triangulation2;
-  typedef Triangulation2::Point                               Point2;
+  typedef DGtal::LatticeKernel Kernel2;
+  typedef typename DGtal::AVTTriangulations<Kernel2,Value>::ConstrainedDelaunay Triangulation2;
+  typedef typename Triangulation2::Point                      Point2;
   typedef DGtal::Z2i::Space Space;
   typedef DGtal::Z2i::Domain Domain;
   typedef DGtal::Z2i::Point DPoint;
@@ -1710,9 +2047,15 @@ int affineValuedTriangulation( po::variables_map & vm )
   AVTriangulation2 avt_red( -1 );
   AVTriangulation2 avt_green( -1 );
   AVTriangulation2 avt_blue( -1 );
+  // Channels are processed concurrently. Blue comes first since it
+  // is the only one used for gray-level images.
+  AVTriangulation2* avts[ 3 ]  = { &avt_blue, &avt_red, &avt_green };
+  const char*       names[ 3 ] = { "BLUE", "RED", "GREEN" };
+  const int         shifts[ 3 ]= { 0, 16, 8 };
   bool gouraud = vm.count( "gouraud" );
   double b = vm[ "bitmap" ].as<double>();
   double ratio = vm[ "random" ].as<double>();
+  int limit = vm[ "limit" ].as<int>();
   bool color = false;
   if ( ! vm.count( "image" ) ) return 1;
 
@@ -1727,31 +2070,27 @@ int affineValuedTriangulation( po::variables_map & vm )
   Image image = GenericReader<Image>::import( imageFileName ); 
   std::string extension = imageFileName.substr(imageFileName.find_last_of(".") + 1);
   if ( extension == "ppm" ) color = true;
+  const unsigned int nb_channels = color ? 3 : 1;
   x0 = 0.0; y0 = 0.0;
   x1 = (double) image.domain().upperBound()[ 0 ];
   y1 = (double) image.domain().upperBound()[ 1 ];
-  if ( color )
-    for ( Domain::ConstIterator it = image.domain().begin(), ite = image.domain().end();
-          it != ite; ++it )
-      {
-        Point2 pt2( (*it)[ 0 ], (*it)[ 1 ] );
-        unsigned int val = image( *it );
-        if ( randomUniform() <= ratio )
-          {
-            avt_red.add  ( pt2, c2r( val ) );
-            avt_green.add( pt2, c2g( val ) );
-            avt_blue.add ( pt2, c2b( val ) );
-          }
-      }
-  else
-    for ( Domain::ConstIterator it = image.domain().begin(), ite = image.domain().end();
-          it != ite; ++it )
-      {
-        Point2 pt2( (*it)[ 0 ], (*it)[ 1 ] );
-        unsigned int val = image( *it );
-        if ( randomUniform() <= ratio )
-          avt_blue.add ( pt2, g2g( val ) );
-      }
+  // The same samples are used by all channels.
+  std::vector<Point2>       samples;
+  std::vector<unsigned int> sample_values;
+  for ( Domain::ConstIterator it = image.domain().begin(), ite = image.domain().end();
+        it != ite; ++it )
+    {
+      if ( randomUniform() <= ratio )
+        {
+          samples.push_back( Point2( (*it)[ 0 ], (*it)[ 1 ] ) );
+          sample_values.push_back( image( *it ) );
+        }
+    }
+  forEachChannelConcurrently
+    ( nb_channels, [&] ( unsigned int c ) {
+      for ( std::size_t i = 0; i < samples.size(); ++i )
+        avts[ c ]->add( samples[ i ], ( sample_values[ i ] >> shifts[ c ] ) & 0xff );
+    } );
   trace.endBlock();
 
   trace.beginBlock("Computes derivatives.");
@@ -1781,11 +2120,10 @@ int affineValuedTriangulation( po::variables_map & vm )
   if ( vm.count( "saddle" ) )
     {
       trace.beginBlock("Process saddle points");
-      if ( color ) {
-        avt_red.processSaddlePoints();
-        avt_green.processSaddlePoints();
-      }
-      avt_blue.processSaddlePoints();
+      forEachChannelConcurrently
+        ( nb_channels, [&] ( unsigned int c ) {
+          avts[ c ]->processSaddlePoints();
+        } );
       trace.endBlock();
     }
 
@@ -1794,12 +2132,12 @@ int affineValuedTriangulation( po::variables_map & vm )
 				b, x0, y0, x1, y1, "avt-before" );
   else         viewAVTAll( avt_blue, grayDer, 
 			   b, x0, y0, x1, y1, "avt-before" );
-  if ( color )
-    {
-      computeFullRelativeHull( avt_red, vm[ "limit" ].as<int>(), "RED" );
-      computeFullRelativeHull( avt_green, vm[ "limit" ].as<int>(), "GREEN" );
-    }
-  computeFullRelativeHull( avt_blue, vm[ "limit" ].as<int>(), "BLUE" );
+  trace.beginBlock( "Compute full relative hull" );
+  forEachChannelConcurrently
+    ( nb_channels, [&] ( unsigned int c ) {
+      computeFullRelativeHullPasses( *avts[ c ], limit, names[ c ] );
+    } );
+  trace.endBlock();
 
   if ( color ) viewAVTColorAll( avt_red, avt_green, avt_blue, 
 				redDer, greenDer, blueDer,
@@ -1818,28 +2156,23 @@ int affineValuedTriangulation( po::variables_map & vm )
     {
       double ratio = vm[ "compress" ].as<double>();
       int sub = 2;
-      if ( color ) {
-        trace.beginBlock("Compressing triangulation -- RED");
-	avt_red.compress( ratio, gouraud, sub );
-	trace.endBlock();
-	trace.beginBlock("Compressing triangulation -- GREEN");
-	avt_green.compress( ratio, gouraud, sub );
-	trace.endBlock();
-      }
-      trace.beginBlock("Compressing triangulation -- BLUE");
-      avt_blue.compress( ratio, gouraud, sub );
+      trace.beginBlock("Compressing triangulation");
+      forEachChannelConcurrently
+        ( nb_channels, [&] ( unsigned int c ) {
+          avts[ c ]->compress( ratio, gouraud, sub );
+        } );
       trace.endBlock();
       if ( color ) viewAVTColorAll( avt_red, avt_green, avt_blue, 
 				    redDer, greenDer, blueDer,
 				    b, x0, y0, x1, y1, "avt-compressed" );
       else         viewAVTAll( avt_blue, grayDer,
 			       b, x0, y0, x1, y1, "avt-compressed" );
-      if ( color )
-	{
-	  computeFullRelativeHull( avt_red, vm[ "limit" ].as<int>(), "RED" );
-	  computeFullRelativeHull( avt_green, vm[ "limit" ].as<int>(), "GREEN" );
-	}
-      computeFullRelativeHull( avt_blue, vm[ "limit" ].as<int>(), "BLUE" );
+      trace.beginBlock( "Compute full relative hull" );
+      forEachChannelConcurrently
+        ( nb_channels, [&] ( unsigned int c ) {
+          computeFullRelativeHullPasses( *avts[ c ], limit, names[ c ] );
+        } );
+      trace.endBlock();
       if ( color ) viewAVTColorAll( avt_red, avt_green, avt_blue, 
 				    redDer, greenDer, blueDer,
 				    b, x0, y0, x1, y1, "avt-compressed-rhull" );
@@ -31,6 +31,8 @@
 #include "Triangulation2DHelper.h"
 #include "UmbrellaPart2D.h"
 #include "Auxiliary.h"
+#include "AVTStorage.h"
+#include "LatticeKernel.h"
 
 static const double EPSILON = 0.0000001;
 template <typename CGALPoint>
@@ -52,7 +54,10 @@ CGALPoint toCGAL( const DGtal::Z2i::Point & p )
    subtriangulation (T >= v) is a triangulation of the convex hull of
    (T >= v) relative to R^2 \setminus (T < v).
 
-   @tparam TTriangulation2 any kind of CGAL 2D triangulation.
+   @tparam TTriangulation2 any kind of CGAL 2D triangulation, whose
+   vertex and face infos are DGtal::AVTVertexInfo<TValue> and
+   DGtal::AVTFaceInfo<TValue> (see DGtal::AVTTriangulations). Values
+   are stored there instead of in side maps.
 
    @tparam TKernel2 any kind of CGAL 2D Kernel, for instance
    CGAL::Exact_predicates_inexact_constructions_kernel
@@ -79,10 +84,8 @@ public:
   typedef typename Kernel2::Vector_2                        Vector;
   typedef typename Kernel2::FT                              Coordinate;
   typedef typename Kernel2::FT                              Component;
-  typedef typename std::map<VertexHandle,Value>             VertexHandle2ValueMap;
-  typedef typename std::map< std::pair<VertexHandle,VertexHandle>,
-                             Value>                         Edge2ValueMap;
-  typedef typename std::map<FaceHandle,Value>               FaceHandle2ValueMap;
+  typedef DGtal::AVTVertexInfo<Value>                       VertexInfo;
+  typedef DGtal::AVTFaceInfo<Value>                         FaceInfo;
   typedef DGtal::UmbrellaPart2D<Triangulation2,Kernel2>     Strip;
   typedef typename std::set<Edge>                           EdgeSet;
   typedef typename std::map<Point,VertexHandle>             Point2VertexHandleMap;
@@ -126,13 +129,6 @@ protected:
   /// The current triangulation.
   Triangulation2 _T;
   const Value _invalid;
-  /// A mapping VertexHandle -> Value that stores for each vertex its value.
-  VertexHandle2ValueMap _vFct;
-  /// A mapping Edge -> Value that stores for each edge its value (nb:
-  /// any edge has the same value as its mirror edge).
-  Edge2ValueMap _eFct;
-  /// A mapping FaceHandle -> Value that stores for each face its value.
-  FaceHandle2ValueMap _fFct;
   /// A mapping Point -> VertexHandle that stores for each point its corresponding vertex.
   Point2VertexHandleMap _p2vhMap
 ;
@@ -156,9 +152,6 @@ public:
   void clear()
   {
     _T.clear();
-    _vFct.clear();
-    _eFct.clear();
-    _fFct.clear();
     _p2vhMap.clear();
     setInfiniteValue( invalid() );
   }
@@ -175,6 +168,15 @@ public:
   inline void add( const Point & pt, Value val )
   {
     VertexHandle vh = _T.insert( pt );
+    // Faces created or reshaped by the insertion are all incident to
+    // vh: forget their (stale) values. Edges of the link keep their
+    // value through the faces outside.
+    if ( _T.dimension() == 2 )
+      {
+        typename Triangulation2::Face_circulator fc = _T.incident_faces( vh );
+        typename Triangulation2::Face_circulator fcend = fc;
+        do { fc->info().reset(); } while ( ++fc != fcend );
+      }
     _p2vhMap[ pt ] = vh;
     setValue( vh, val );
   }
@@ -216,13 +218,68 @@ public:
     return it->second;
   }
 
+  /**
+     A candidate concavity of fullRelativeHull, i.e. the oriented edge
+     (v0,v1). The edge is remembered both as a face/index pair, which
+     is direct to use, and by its vertices, since flips may reshape
+     its face meanwhile.
+  */
+  struct PendingEdge {
+    Edge         edge;
+    VertexHandle v0;
+    VertexHandle v1;
+    PendingEdge( const Edge & e, VertexHandle s, VertexHandle t )
+      : edge( e ), v0( s ), v1( t ) {}
+  };
+  typedef std::vector<PendingEdge>                          PendingEdges;
+
+  /**
+     Appends the edge \a e to the worklist \a queue, unless it is
+     already pending (this is flagged in its face).
+  */
+  void pushPending( PendingEdges & queue, const Edge & e ) 
+  {
+    bool & queued = e.first->info().queued[ e.second ];
+    if ( queued ) return;
+    queued = true;
+    queue.push_back( PendingEdge( e, TH.source( e ), TH.target( e ) ) );
+  }
+
+  /**
+     Finds again the pending edge \a p in the triangulation. It is
+     immediate unless its face was reshaped by a flip, in which case
+     the edge is searched around v0 and \a p is updated.
+
+     @param[out] e the edge (v0,v1), when it exists.
+     @return 'false' iff (v0,v1) is not an edge anymore.
+  */
+  bool findPending( PendingEdge & p, Edge & e ) const
+  {
+    e = p.edge;
+    if ( ( TH.source( e ) == p.v0 ) && ( TH.target( e ) == p.v1 ) ) return true;
+    if ( ! T().is_edge( p.v0, p.v1, e.first, e.second ) ) return false;
+    if ( TH.source( e ) != p.v0 ) e = T().mirror_edge( e );
+    p.edge = e;
+    e.first->info().queued[ e.second ] = true;
+    return true;
+  }
+
+  /// Removes the pending edge \a p from the worklist.
+  void popPending( const PendingEdge & p ) const
+  {
+    const Edge & e = p.edge;
+    if ( ( TH.source( e ) == p.v0 ) && ( TH.target( e ) == p.v1 ) )
+      e.first->info().queued[ e.second ] = false;
+  }
+
   /**
      Used by fullRelativeHull to insert candidate concavities into the Queue.
      
+     @param queue the worklist.
+     @param strip a strip used for computations.
      @param e any finite edge of the triangulation.
   */
-  void insertQueue( std::set< std::pair< VertexHandle, VertexHandle > > & inQueue,
-		    const Edge & e ) 
+  void insertQueue( PendingEdges & queue, Strip & strip, const Edge & e ) 
   {
     ASSERT( ! T().is_infinite( e ) );
     VertexHandle v0 = TH.source( e );
@@ -246,19 +303,17 @@ public:
       }
     if ( ( val_v1 < val_v0 ) && ( val_e < val_v0 ) )
       {
-	Strip strip( T() );
         NoGreaterThanValuePredicate predNoGreaterThanV1( *this, val_e );
         strip.init( predNoGreaterThanV1, predNoGreaterThanV1, e );
         if ( strip.isConcave() ) 
-          inQueue.insert( std::make_pair( v0, v1 ) );
+          pushPending( queue, e );
       }
     else if ( ( val_v0 < val_v1 ) && ( val_e < val_v1 ) )
       {
-	Strip strip( T() );
         NoGreaterThanValuePredicate predNoGreaterThanV1( *this, val_e );
         strip.init( predNoGreaterThanV1, predNoGreaterThanV1, T().mirror_edge( e ) );
         if ( strip.isConcave() ) 
-          inQueue.insert( std::make_pair( v1, v0 ) );
+          pushPending( queue, T().mirror_edge( e ) );
       }
   }
 
@@ -274,49 +329,47 @@ public:
      complexifying a lot the way concavities (v0,v1) are pushed into
      the queue.
 
+     Candidate concavities are processed in FIFO order from a
+     worklist of edges, and the same strip is reused for all of them.
+
      @return 'true' if some concavity was flipped, 'false' when no concavity was found.
   */
   bool fullRelativeHull()
   {
     bool changes = false;
-    // static const Label rmark = 1;
-    std::set< std::pair< VertexHandle, VertexHandle > > inQueue;
+    PendingEdges queue;
     Strip strip( T() );
-    // DGtal::trace.beginBlock( "Searching concavities" );
     for ( FiniteEdgesIterator it = T().finite_edges_begin(), itend = T().finite_edges_end();
           it != itend; ++it )
       {
         Edge e = *it;
-	insertQueue( inQueue, e );
+	insertQueue( queue, strip, e );
       }
-    DGtal::trace.info() << "- Found " << inQueue.size() << " potential concavities." 
+    DGtal::trace.info() << "- Found " << queue.size() << " potential concavities." 
 			<< std::endl;
-    // DGtal::trace.endBlock();
-    // DGtal::trace.beginBlock( "Flipping concavities" );
     unsigned int nb_checked = 0;
     unsigned int nb_flipped = 0;
     unsigned int nb_concave = 0;
+    std::size_t  head       = 0;
     Edge e;
-    while ( ! inQueue.empty() )
+    while ( head < queue.size() )
       {
-	VertexHandle v0 = inQueue.begin()->first;
-	VertexHandle v1 = inQueue.begin()->second;
+        PendingEdge & p = queue[ head ];
         ++nb_checked;
         if ( nb_checked % 1000 == 0 ) 
-          DGtal::trace.info() << "- Queue=" << inQueue.size()
+          DGtal::trace.info() << "- Queue=" << ( queue.size() - head )
                               << ", flipped " << nb_flipped << "/" << nb_checked 
                               << " edges in a concavity." << std::endl;
-	if ( ! T().is_edge( v0, v1, e.first, e.second ) )
+	if ( ! findPending( p, e ) )
 	  {
-	    inQueue.erase( inQueue.begin() );
+	    ++head;
 	    continue; // (v0,v1) is not an edge anymore.
 	  }
-	if ( TH.source( e ) != v0 ) 
-	  e = T().mirror_edge( e );
+        VertexHandle v0 = p.v0;
         Value val_V1 = value( e ); // value( TH.target( e ) );
         if ( val_V1 >= value( v0 ) ) // edge has already the value of the source.
 	  {
-	    inQueue.erase( inQueue.begin() );
+            popPending( queue[ head++ ] );
 	    continue; 
 	  }
         NoGreaterThanValuePredicate predNoGreaterThanV1( *this, val_V1 );
@@ -343,13 +396,10 @@ public:
 		Edge edge_quad = T().mirror_edge( strip.e( i-1 ) );
                 FaceHandle f1 = fedge.first;
                 FaceHandle f2 = fmedge.first;
-                // remove value for f1, f2, fedge, fmedge
-                eraseValue( f1 ); 
-                eraseValue( f2 );
-                eraseValue( fedge );
-		Edge mirror_first = T().mirror_edge( strip.e( 0 ) );
-                // DGtal::trace.info() << "  - Flipping " << TH.source( fedge )->point() 
-                //                     << " -> " <<  TH.target( fedge )->point() << std::endl;
+                // remove values for f1, f2 and their edges since the
+                // flip reuses these faces. The border of the quad
+                // keeps its values in the faces outside.
+                eraseQuadValues( f1, f2 );
 		_T.flip( fedge.first, fedge.second );
                 fedge = T().mirror_edge( edge_quad );
                 Edge new_edge = TH.nextCCWAroundFace( fedge );
@@ -357,15 +407,10 @@ public:
                 eraseValue( new_edge ); 
                 eraseValue( new_edge.first );
                 eraseValue( T().mirror_edge( new_edge ).first );
-                Edge fedge2 = TH.nextCCWAroundFace( new_edge );
-                // setValue( fedge, std::max( value( fedge ), val_V1+1 ) );
-                // setValue( new_edge, std::max( value( new_edge ), val_V1+1 ) );
-                // setValue( fedge2, std::max( value( fedge2 ), val_V1+1 ) );
 		if ( strip.size() == 3 ) 
 		  { // last flip made a triangle
-                    // setValue( new_edge, std::max( value( new_edge ), val ) );
                     setValue( new_edge.first, std::max( value( new_edge.first ), val ) );
-		    inQueue.erase( inQueue.begin() );
+                    popPending( queue[ head++ ] );
 		  }
 		changes = true; ++nb_flipped;
 	      }
@@ -378,18 +423,15 @@ public:
                     setValue( strip.f( i ), std::max( value( strip.f( i ) ), val ) );
                   }
                 changes = true; ++nb_concave;
-		inQueue.erase( inQueue.begin() );
+                popPending( queue[ head++ ] );
 	      }
           }
 	else
-	  inQueue.erase( inQueue.begin() );
+          popPending( queue[ head++ ] );
       }
-    ASSERT( inQueue.empty() );
     DGtal::trace.info() << "- Flipped " << nb_flipped 
                         << ", concave " << nb_concave
                         << " / " << nb_checked << " edges in a concavity." << std::endl;
-    //if ( nb_flipped == 1 && nb_checked == 2 ) changes = false;
-    // DGtal::trace.endBlock();
     return changes;
   }
   
@@ -515,9 +557,8 @@ public:
   */
   Value value( VertexHandle v ) const
   {
-    typename VertexHandle2ValueMap::const_iterator it = _vFct.find( v );
-    if ( it == _vFct.end() ) return _invalid;
-    return it->second;
+    const VertexInfo & vi = v->info();
+    return vi.valid ? vi.value : _invalid;
   }
 
   /**
@@ -528,19 +569,17 @@ public:
   */
   Value value( Edge e )
   {
-    // Pick "smallest" edge to find value.
+    FaceInfo & fi = e.first->info();
+    if ( fi.edge_valid[ e.second ] ) return fi.edge[ e.second ];
+    // The value may be known only by the other side.
     Edge mirror_e = T().mirror_edge( e );
-    if ( TH.source( mirror_e ) < TH.source( e ) ) e = mirror_e;
-    std::pair<VertexHandle, VertexHandle> edge = std::make_pair( TH.source( e ), TH.target( e ) );
-    typename Edge2ValueMap::const_iterator it = _eFct.find( edge );
-    if ( it == _eFct.end() ) 
-      {
-        Value v = std::min( value( TH.source( e ) ), 
-                            value( TH.target( e ) ) );
-        _eFct[ edge ] = v;
-        return v;
-      }
-    return it->second;
+    FaceInfo & mi = mirror_e.first->info();
+    const Value v = mi.edge_valid[ mirror_e.second ]
+      ? mi.edge[ mirror_e.second ]
+      : std::min( value( TH.source( e ) ), value( TH.target( e ) ) );
+    fi.edge[ e.second ]        = mi.edge[ mirror_e.second ]       = v;
+    fi.edge_valid[ e.second ]  = mi.edge_valid[ mirror_e.second ] = true;
+    return v;
   }
 
   /**
@@ -551,15 +590,15 @@ public:
   */
   Value value( FaceHandle f )
   {
-    typename FaceHandle2ValueMap::const_iterator it = _fFct.find( f );
-    if ( it == _fFct.end() ) 
+    FaceInfo & fi = f->info();
+    if ( ! fi.valid ) 
       {
         Value v = std::min( std::min( value( Edge( f, 0 ) ), value( Edge( f, 1 ) ) ), 
                             value( Edge( f, 2 ) ) );
-        _fFct[ f ] = v;
-        return v;
+        fi.value = v;
+        fi.valid = true;
       }
-    return it->second;
+    return fi.value;
   }
 
   /**
@@ -569,20 +608,22 @@ public:
   */
   inline void setValue( VertexHandle vh, Value val )
   {
-    _vFct[ vh ] = val;
+    vh->info().value = val;
+    vh->info().valid = true;
   }
 
   /**
-     Sets the value for the given edge
+     Sets the value for the given edge (and its mirror edge).
      @param e any edge.
      @param val any value.
   */
   inline void setValue( Edge e, Value val )
   {
     Edge mirror_e = T().mirror_edge( e );
-    if ( TH.source( mirror_e ) < TH.source( e ) ) e = mirror_e;
-    std::pair<VertexHandle, VertexHandle> edge = std::make_pair( TH.source( e ), TH.target( e ) );
-    _eFct[ edge ] = val;
+    FaceInfo & fi = e.first->info();
+    FaceInfo & mi = mirror_e.first->info();
+    fi.edge[ e.second ]        = mi.edge[ mirror_e.second ]       = val;
+    fi.edge_valid[ e.second ]  = mi.edge_valid[ mirror_e.second ] = true;
   }
 
   /**
@@ -592,7 +633,8 @@ public:
   */
   inline void setValue( FaceHandle fh, Value val )
   {
-    _fFct[ fh ] = val;
+    fh->info().value = val;
+    fh->info().valid = true;
   }
 
   /**
@@ -600,7 +642,7 @@ public:
   */
   inline void setInfiniteValue( Value v )
   {
-    _vFct[ _T.infinite_vertex() ] = v;
+    setValue( _T.infinite_vertex(), v );
   }
 
   /**
@@ -608,19 +650,17 @@ public:
   */
   void eraseValue( VertexHandle vh )
   {
-    _vFct.erase( vh );
+    vh->info().valid = false;
   }
 
   /**
-     Erases the value associated with the edge e.
+     Erases the value associated with the edge e (and its mirror edge).
   */
   void eraseValue( Edge e )
   {
-    // Pick "smallest" edge to find value.
     Edge mirror_e = T().mirror_edge( e );
-    if ( TH.source( mirror_e ) < TH.source( e ) ) e = mirror_e;
-    std::pair<VertexHandle, VertexHandle> edge = std::make_pair( TH.source( e ), TH.target( e ) );
-    _eFct.erase( edge );
+    e.first->info().edge_valid[ e.second ]               = false;
+    mirror_e.first->info().edge_valid[ mirror_e.second ] = false;
   }
 
   /**
@@ -628,7 +668,33 @@ public:
   */
   void eraseValue( FaceHandle fh )
   {
-    _fFct.erase( fh );
+    fh->info().valid = false;
+  }
+
+  /**
+     Erases the values of the faces \a f1 and \a f2 and of their
+     edges, before a flip reuses these faces. The values of the border
+     edges of the quad are first copied to the faces outside, which
+     may have lost their own copy when reset by an earlier flip.
+  */
+  void eraseQuadValues( FaceHandle f1, FaceHandle f2 )
+  {
+    const FaceHandle quad[ 2 ] = { f1, f2 };
+    for ( int k = 0; k < 2; ++k )
+      {
+        FaceInfo & fi = quad[ k ]->info();
+        for ( int i = 0; i < 3; ++i )
+          {
+            if ( ! fi.edge_valid[ i ] ) continue;
+            Edge mirror_e = T().mirror_edge( Edge( quad[ k ], i ) );
+            if ( mirror_e.first == f1 || mirror_e.first == f2 ) continue;
+            FaceInfo & mi = mirror_e.first->info();
+            mi.edge[ mirror_e.second ]       = fi.edge[ i ];
+            mi.edge_valid[ mirror_e.second ] = true;
+          }
+      }
+    f1->info().reset();
+    f2->info().reset();
   }
 
 };
@@ -1049,9 +1115,9 @@ namespace po = boost::program_options;
 template <typename Value>
 int affineValuedTriangulation( po::variables_map & vm )
 {
-  typedef CGAL::Exact_predicates_inexact_constructions_kernel Kernel2;
-  typedef CGAL::Delaunay_triangulation_2<Kernel2>             Triangulation2;
-  typedef Triangulation2::Point                               Point2;
+  typedef DGtal::LatticeKernel Kernel2;
+  typedef typename DGtal::AVTTriangulations<Kernel2,Value>::Delaunay Triangulation2;
+  typedef typename Triangulation2::Point                      Point2;
   typedef DGtal::Z2i::Space Space;
   typedef DGtal::Z2i::Domain Domain;
   typedef DGtal::Z2i::Point DPoint;
@@ -1,6 +1,8 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <thread>
+#include <algorithm>
 #include <boost/program_options/options_description.hpp>
 #include <boost/program_options/parsers.hpp>
 #include <boost/program_options/variables_map.hpp>
@@ -28,8 +30,12 @@
 #include <CGAL/Constrained_Delaunay_triangulation_2.h>
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
 #include <CGAL/Triangulation_2.h>
+#include <CGAL/Triangulation_vertex_base_with_info_2.h>
+#include <CGAL/Triangulation_face_base_with_info_2.h>
+#include <CGAL/spatial_sort.h>
 
 #include "Auxiliary.h"
+#include "LatticeKernel.h"
 
 static const double EPSILON = 0.0000001;
 template <typename CGALPoint>
@@ -242,8 +248,11 @@ public:
   typedef typename Kernel::FT                             Component;
 
 public:
-  /// The sequence of edges (v,v_i)
-  std::deque<Edge> umbrella;
+  /// The sequence of edges (v,v_i). Its storage is reused by
+  /// successive calls to init.
+  std::vector<Edge> umbrella;
+  /// Buffer used by init to gather the edges before the border.
+  std::vector<Edge> _front;
   /// True iff the umbrella contains all incident edges to the pivot.
   bool _loop;
   /// Used for computations.
@@ -273,14 +282,17 @@ public:
     if ( ! _loop )
       {
         umbrella.push_back( e ); // last
+        // Edges before border are collected backward, then put in front.
+        _front.clear();
         Edge e = TH.nextCWAroundSourceVertex( border );
         while ( predicate( TH.target( e ) ) )
           {
-            umbrella.push_front( e );
+            _front.push_back( e );
             e = TH.nextCWAroundSourceVertex( e );
             ASSERT( TH.source( e ) == pivot );
           }
-        umbrella.push_front( e );
+        _front.push_back( e );
+        umbrella.insert( umbrella.begin(), _front.rbegin(), _front.rend() );
       }
   }
 
@@ -417,7 +429,7 @@ public:
     // if ( ( size() == 2 ) && ( umbrella.front() == umbrella.back() ) )
     //   return 2.0*M_PI;
     Component totalAngle = 0.0;
-    for ( typename std::deque<Edge>::const_iterator it = umbrella.begin(), ite = umbrella.end() - 1;
+    for ( typename std::vector<Edge>::const_iterator it = umbrella.begin(), ite = umbrella.end() - 1;
           it != ite; ++it )
       {
         totalAngle += TH.innerAngle( *it );
@@ -509,6 +521,27 @@ public:
   } 
 };
 
+/**
+   The data stored in each vertex of the triangulation of a DAC.
+*/
+struct DACVertexInfo {
+  int label; ///< the set to which the vertex belongs, or -1.
+  int mark;  ///< the mark given by a relative hull computation, or -1.
+
+  DACVertexInfo() : label( -1 ), mark( -1 ) {}
+};
+
+/**
+   The data stored in each face of the triangulation of a DAC.
+*/
+struct DACFaceInfo {
+  bool queued[ 3 ]; ///< 'true' iff edge i is pending in a relative hull computation.
+
+  DACFaceInfo() { reset(); }
+  /// Forgets every flag stored in this face.
+  void reset() { queued[ 0 ] = queued[ 1 ] = queued[ 2 ] = false; }
+};
+
 enum GeometryTag 
   { Unknown = -2, Convex = 1, Flat = 0, Concave = -1, Multiple = 2, Infinite = 3  
   };
@@ -525,14 +558,16 @@ enum GeometryTag
    implies that [PQ] belongs to simplices whose vertices have label l.
 
    @tparam Kernel it is the chosen Kernel for the CGAL triangulation,
-   for instance CGAL::Exact_predicates_inexact_constructions_kernel
+   for instance CGAL::Exact_predicates_inexact_constructions_kernel or
+   DGtal::LatticeKernel
 */
 template <typename Kernel>
 class DAC
 {
 public:
-  typedef typename CGAL::Triangulation_vertex_base_2<Kernel>       Vb;
-  typedef CGAL::Constrained_triangulation_face_base_2<Kernel>      Fb;
+  typedef CGAL::Triangulation_vertex_base_with_info_2<DACVertexInfo,Kernel> Vb;
+  typedef CGAL::Triangulation_face_base_with_info_2<DACFaceInfo,Kernel> Fbi;
+  typedef CGAL::Constrained_triangulation_face_base_2<Kernel,Fbi>  Fb;
   typedef CGAL::Triangulation_data_structure_2<Vb,Fb>              TDS;
   typedef CGAL::No_intersection_tag                                Itag;
   // Exact_predicates_tag                               Itag;
@@ -550,11 +585,12 @@ public:
   typedef typename Triangulation::Point                   Point;
   typedef typename Kernel::Vector_2                  Vector;
   typedef int                                        Label;
-  typedef typename std::map<VertexHandle,Label>      VertexLabeling;
   typedef SimplicialStrip<Triangulation,Kernel>      Strip;
   typedef typename std::map<VertexHandle,GeometryTag> VertexGeometryTagging;
   typedef typename std::map<Edge,GeometryTag>         EdgeGeometryTagging;
   typedef typename std::set<Edge>                     EdgeSet;
+  typedef typename std::map<Point,VertexHandle>       VertexMapping;
+  typedef typename VertexMapping::const_iterator      VertexMappingConstIterator;
   // maps inside edges to outside edges. Each edge has either no or one outside edge.
   typedef typename std::map<Edge,Edge>                In2OutEdgeMapping;
   // maps outside edges to inside edges. Each edge has either no or two inside edges.
@@ -687,25 +723,24 @@ public:
   /// A predicate that returns 'true' whenever the labeling is not the
   /// one given at instanciation.
   struct CheckVertexLabelingInequality {
-    const VertexLabeling & _vl;
     Label _l;
     
     inline
-    CheckVertexLabelingInequality( const VertexLabeling & vl, Label l )
-      : _vl( vl ), _l( l ) 
+    CheckVertexLabelingInequality( Label l )
+      : _l( l ) 
     {}
 
     inline
     CheckVertexLabelingInequality( const CheckVertexLabelingInequality & other )
-      : _vl( other._vl ), _l( other._l ) 
+      : _l( other._l ) 
     {}
 
     inline
     bool operator()( const VertexHandle & v ) const
     {
-      typename VertexLabeling::const_iterator it = _vl.find( v );
-      return ( it == _vl.end() ) ? false
-        : ( it->second != _l );
+      Label l = v->info().label;
+      return ( l == INVALID ) ? false
+        : ( l != _l );
     }
   };
 
@@ -713,32 +748,27 @@ public:
   /// if not, returns 'true' whenever the labeling is not the one
   /// given at instanciation, .
   struct CheckVertexLabelingInequalityWhenUnmarked {
-    const VertexLabeling & _vl;
-    const VertexLabeling & _vmark;
     Label _l;
     Label _mark;
     
     inline
-    CheckVertexLabelingInequalityWhenUnmarked
-    ( const VertexLabeling & vl, const VertexLabeling & vmark,
-      Label l, Label mark )
-      : _vl( vl ), _vmark( vmark ), _l( l ), _mark( mark )
+    CheckVertexLabelingInequalityWhenUnmarked( Label l, Label mark )
+      : _l( l ), _mark( mark )
     {}
 
     inline
     CheckVertexLabelingInequalityWhenUnmarked
     ( const CheckVertexLabelingInequalityWhenUnmarked & other )
-      : _vl( other._vl ), _vmark( other._vmark ), _l( other._l ), _mark( other._mark )
+      : _l( other._l ), _mark( other._mark )
     {}
 
     inline
     bool operator()( const VertexHandle & v ) const
     {
-      typename VertexLabeling::const_iterator it = _vmark.find( v );
-      if ( it != _vmark.end() ) return it->second != _mark;
-      it = _vl.find( v );
-      return ( it == _vl.end() ) ? false
-        : ( it->second != _l );
+      if ( v->info().mark != INVALID ) return v->info().mark != _mark;
+      Label l = v->info().label;
+      return ( l == INVALID ) ? false
+        : ( l != _l );
     }
   };
 
@@ -810,12 +840,9 @@ public:
 
 
 private:
-  /// The current triangulation.
+  /// The current triangulation. Each vertex stores in its info the
+  /// set to which it belongs and whether it is marked.
   Triangulation _T;
-  /// A mapping VertexHandle -> Label that stores for each vertex to which set it belongs.
-  VertexLabeling _vLabeling;
-  /// A mapping VertexHandle -> Label that stores for each vertex if it is marked.
-  VertexLabeling _vMarked;
 
   typedef typename std::map<FaceHandle, Extension> FaceMapping;
   typedef typename FaceMapping::iterator FaceMappingIterator;
@@ -845,30 +872,21 @@ public:
   void clear()
   {
     _T.clear();
-    _vLabeling.clear();
-    _points().clear();
-    _vMarked.clear();
+    _points.clear();
     _vFaces.clear();
   }
 
   inline const Triangulation & T() const
   { return _T; }
 
-  inline const VertexLabeling & labeling() const
-  { return _vLabeling; }
-
   inline Label label( VertexHandle v ) const
   {
-    typename VertexLabeling::const_iterator it = labeling().find( v );
-    if ( it == labeling().end() ) return INVALID;
-    return it->second;
+    return v->info().label;
   }
 
   inline Label mark( VertexHandle v ) const
   {
-    typename VertexLabeling::const_iterator it = _vMarked.find( v );
-    if ( it == _vMarked.end() ) return -1;
-    return it->second;
+    return v->info().mark;
   }
 
   /**
@@ -905,11 +923,13 @@ public:
 
   inline void setInfiniteLabel( Label l )
   {
-    _vLabeling[ _T.infinite_vertex() ] = l;
+    _T.infinite_vertex()->info().label = l;
   }
 
   /** 
-      Adds (digital) points to the triangulation.
+      Adds (digital) points to the triangulation. Points are first
+      sorted along a Hilbert curve and inserted in this order, each
+      one located from the previous one.
       
       @param k the digital topology: 0 is 4-adjacency, 1 is 8.
       @param l the label for the set of points (0 stands for P, 1 for others).
@@ -917,7 +937,7 @@ public:
   template <typename PointIterator>
   void add( PointIterator itb, PointIterator ite, int k, Label l )
   {
-    std::set<Point> current;
+    std::vector<Point> sorted;
     for ( ; itb != ite; ++itb )
       {
         Point p = *itb;
@@ -925,12 +945,15 @@ public:
           DGtal::trace.error() << "[DAC::add] Points " << p << " has already been inserted. Ignored." << std::endl;
         else
           {
-            VertexHandle v = _T.insert( p );
             _points.insert( p );
-            current.insert( p );
-            _vLabeling[ v ] = l;
+            sorted.push_back( p );
           }
       }
+    VertexMapping current;
+    insertSorted( current, sorted );
+    for ( typename VertexMapping::const_iterator it = current.begin(), ite = current.end();
+          it != ite; ++it )
+      it->second->info().label = l;
     addConstraints0( current );
     if ( k == 1 ) addConstraints1( current );
   }
@@ -941,8 +964,32 @@ public:
     VertexHandle vq = _T.insert( q );
     _T.insert_constraint( vp, vq );
   }
-  // For speed-up
-  void addBand( const Point & p1, const Point & p2, const Point & midp, 
+
+  /**
+     Adds the constraints given as a range of pairs of points. The
+     extremities are inserted first, in Hilbert order, then the
+     constraints are inserted between the obtained vertices.
+  */
+  template <typename ConstraintIterator>
+  void addConstraints( ConstraintIterator itb, ConstraintIterator ite )
+  {
+    std::vector<Point> sorted;
+    for ( ConstraintIterator it = itb; it != ite; ++it )
+      {
+        sorted.push_back( it->first );
+        sorted.push_back( it->second );
+      }
+    std::sort( sorted.begin(), sorted.end() );
+    sorted.erase( std::unique( sorted.begin(), sorted.end() ), sorted.end() );
+    VertexMapping vertices;
+    insertSorted( vertices, sorted );
+    for ( ; itb != ite; ++itb )
+      _T.insert_constraint( vertices[ itb->first ], vertices[ itb->second ] );
+  }
+
+  // For speed-up. The constraints of the band are appended to \a constraints.
+  void addBand( std::vector< std::pair<Point,Point> > & constraints,
+                const Point & p1, const Point & p2, const Point & midp, 
                 const Point & q1, const Point & q2, const Point & midq,
                 bool p1cvx, bool p2cvx )
   {
@@ -952,55 +999,75 @@ public:
     case 0: // ccv1, ccv2
       DGtal::trace.info() << " C=" << q1 << " -> " << midp;
       DGtal::trace.info() << " C=" << midp << " -> " << q2 << std::endl;
-      _T.insert_constraint( q1, midp );
-      _T.insert_constraint( midp, q2 );
+      constraints.push_back( std::make_pair( q1, midp ) );
+      constraints.push_back( std::make_pair( midp, q2 ) );
       break;
     case 1: // ccv1, cvx2
       // These constraints may be false afterwards for the relative
       // hull. We remove them.
       // DGtal::trace.info() << " C=" << q1 << " -> " << p2 << std::endl;
-      // _T.insert_constraint( q1, p2 );
+      // constraints.push_back( std::make_pair( q1, p2 ) );
       break;
     case 2: // cvx1, ccv2
       // These constraints may be false afterwards for the relative
       // hull. We remove them.
       // DGtal::trace.info() << " C=" << p1 << " -> " << q2 << std::endl;
-      // _T.insert_constraint( p1, q2 );
+      // constraints.push_back( std::make_pair( p1, q2 ) );
       break;
     case 3: // cvx1, cvx2
       DGtal::trace.info() << " C=" << p1 << " -> " << midq;
       DGtal::trace.info() << " C=" << midq << " -> " << p2 << std::endl;
-      _T.insert_constraint( p1, midq );
-      _T.insert_constraint( midq, p2 );
+      constraints.push_back( std::make_pair( p1, midq ) );
+      constraints.push_back( std::make_pair( midq, p2 ) );
       break;
     }
   }
 
-  void addConstraints0( const std::set<Point> & pts )
+  void addConstraints0( const VertexMapping & pts )
   {
-    for ( typename std::set<Point>::const_iterator it = pts.begin(), ite = pts.end();
+    for ( typename VertexMapping::const_iterator it = pts.begin(), ite = pts.end();
           it != ite; ++it )
       {
-        Point p = *it;
-        if ( pts.find( p + Vector( 1, 0 ) ) != pts.end() ) _T.insert_constraint( p, p + Vector( 1, 0 ) );
-        if ( pts.find( p + Vector( 0, 1 ) ) != pts.end() ) _T.insert_constraint( p, p + Vector( 0, 1 ) );
+        Point p = it->first;
+        VertexMappingConstIterator itq;
+        if ( ( itq = pts.find( p + Vector( 1, 0 ) ) ) != pts.end() ) _T.insert_constraint( it->second, itq->second );
+        if ( ( itq = pts.find( p + Vector( 0, 1 ) ) ) != pts.end() ) _T.insert_constraint( it->second, itq->second );
       }
   }
   
-  void addConstraints1( const std::set<Point> & pts )
+  void addConstraints1( const VertexMapping & pts )
   {
-    for ( typename std::set<Point>::const_iterator it = pts.begin(), ite = pts.end();
+    for ( typename VertexMapping::const_iterator it = pts.begin(), ite = pts.end();
           it != ite; ++it )
       {
-        Point p = *it;
-        if ( ( pts.find( p + Vector( 1, 1 ) ) != pts.end() ) 
+        Point p = it->first;
+        VertexMappingConstIterator itq;
+        if ( ( ( itq = pts.find( p + Vector( 1, 1 ) ) ) != pts.end() ) 
              && ( ( pts.find( p + Vector( 1, 0 ) ) == pts.end() ) 
                   || ( pts.find( p + Vector( 0, 1 ) ) == pts.end() ) ) )
-          _T.insert_constraint( p, p + Vector( 1, 1 ) );
-        if ( ( pts.find( p + Vector( -1, 1 ) ) != pts.end() ) 
+          _T.insert_constraint( it->second, itq->second );
+        if ( ( ( itq = pts.find( p + Vector( -1, 1 ) ) ) != pts.end() ) 
              && ( ( pts.find( p + Vector( -1, 0 ) ) == pts.end() ) 
                   || ( pts.find( p + Vector( 0, 1 ) ) == pts.end() ) ) )
-          _T.insert_constraint( p, p + Vector( -1, 1 ) );
+          _T.insert_constraint( it->second, itq->second );
+      }
+  }
+
+  /**
+     Inserts the points of \a pts in the triangulation along a Hilbert
+     curve, each point being located from the previously inserted
+     vertex, and gives in \a vertices the vertex of each point.
+  */
+  void insertSorted( VertexMapping & vertices, std::vector<Point> & pts )
+  {
+    CGAL::spatial_sort( pts.begin(), pts.end(), Kernel() );
+    FaceHandle hint;
+    for ( typename std::vector<Point>::const_iterator it = pts.begin(), ite = pts.end();
+          it != ite; ++it )
+      {
+        VertexHandle v = _T.insert( *it, hint );
+        hint = v->face();
+        vertices[ *it ] = v;
       }
   }
 
@@ -1048,7 +1115,7 @@ public:
     std::priority_queue<Concavity> Q;
     std::set< std::pair< VertexHandle, VertexHandle > > inQueue;
 
-    CheckVertexLabelingInequality predNotL( labeling(), l );
+    CheckVertexLabelingInequality predNotL( l );
     // DGtal::trace.beginBlock( "Searching concavities" );
     for ( FiniteEdgesIterator it = T().finite_edges_begin(), itend = T().finite_edges_end();
           it != itend; ++it )
@@ -1143,10 +1210,104 @@ public:
     return changes;
   }
 
+  /**
+     A candidate concavity of the relative hull, i.e. the oriented
+     edge (v0,v1). The edge is remembered both as a face/index pair,
+     which is direct to use, and by its vertices, since flips may
+     reshape its face meanwhile.
+  */
+  struct PendingEdge {
+    Edge         edge;
+    VertexHandle v0;
+    VertexHandle v1;
+    PendingEdge( const Edge & e, VertexHandle s, VertexHandle t )
+      : edge( e ), v0( s ), v1( t ) {}
+  };
+  typedef std::vector<PendingEdge>                    PendingEdges;
+
+  /**
+     Appends the edge \a e to the worklist \a queue, unless it is
+     already pending (this is flagged in its face).
+  */
+  void pushPending( PendingEdges & queue, const Edge & e ) const
+  {
+    bool & queued = e.first->info().queued[ e.second ];
+    if ( queued ) return;
+    queued = true;
+    queue.push_back( PendingEdge( e, TH.source( e ), TH.target( e ) ) );
+  }
+
+  /**
+     Finds again the pending edge \a p in the triangulation. It is
+     immediate unless its face was reshaped by a flip, in which case
+     the edge is searched around v0 and \a p is updated.
+
+     @param[out] e the edge (v0,v1), when it exists.
+     @return 'false' iff (v0,v1) is not an edge anymore.
+  */
+  bool findPending( PendingEdge & p, Edge & e ) const
+  {
+    e = p.edge;
+    if ( ( TH.source( e ) == p.v0 ) && ( TH.target( e ) == p.v1 ) ) return true;
+    if ( ! T().is_edge( p.v0, p.v1, e.first, e.second ) ) return false;
+    if ( TH.source( e ) != p.v0 ) e = T().mirror_edge( e );
+    p.edge = e;
+    e.first->info().queued[ e.second ] = true;
+    return true;
+  }
+
+  /// Removes the pending edge \a p from the worklist.
+  void popPending( const PendingEdge & p ) const
+  {
+    const Edge & e = p.edge;
+    if ( ( TH.source( e ) == p.v0 ) && ( TH.target( e ) == p.v1 ) )
+      e.first->info().queued[ e.second ] = false;
+  }
+
+  /**
+     Sets the pending flag of the edge (v0,v1), if it exists.
+     @return the previous value of the flag ('false' if there is no such edge).
+  */
+  bool setPending( VertexHandle v0, VertexHandle v1, bool flag ) const
+  {
+    Edge e;
+    if ( ! TH.findEdge( e, v0, v1 ) ) return false;
+    bool & queued = e.first->info().queued[ e.second ];
+    const bool old = queued;
+    queued = flag;
+    return old;
+  }
+
+  /**
+     Flips the edge \a fedge. The pending flags of the edges of the
+     two faces reused by the flip are moved along with their edges
+     (the flipped edge itself disappears).
+  */
+  void flipKeepingPending( const Edge & fedge )
+  {
+    FaceHandle f[ 2 ] = { fedge.first, T().mirror_edge( fedge ).first };
+    VertexHandle pending[ 6 ][ 2 ];
+    int nb = 0;
+    for ( int k = 0; k < 2; ++k )
+      {
+        for ( int i = 0; i < 3; ++i )
+          if ( f[ k ]->info().queued[ i ] )
+            {
+              pending[ nb ][ 0 ] = TH.source( Edge( f[ k ], i ) );
+              pending[ nb ][ 1 ] = TH.target( Edge( f[ k ], i ) );
+              ++nb;
+            }
+        f[ k ]->info().reset();
+      }
+    _T.flip( fedge.first, fedge.second );
+    for ( int j = 0; j < nb; ++j )
+      setPending( pending[ j ][ 0 ], pending[ j ][ 1 ], true );
+  }
+
   /**
      Used by relativeHull2 to insert candidate concavities into the Queue.
   */
-  void insertQueue( std::set< std::pair< VertexHandle, VertexHandle > > & inQueue,
+  void insertQueue( PendingEdges & queue, Strip & strip,
 		    VertexHandle v0, VertexHandle v1,
 		    const CheckVertexLabelingInequality & predicate ) const
   {
@@ -1155,10 +1316,10 @@ public:
 	Edge e;
 	if ( T().is_edge( v0, v1, e.first, e.second ) )
 	  {
-	    Strip strip( T() );
+	    if ( TH.source( e ) != v0 ) e = T().mirror_edge( e );
 	    strip.init( *this, predicate, e );
 	    if ( strip.isConcave() ) 
-	      inQueue.insert( std::make_pair( v0, v1 ) );
+	      pushPending( queue, e );
           }
       }
   }
@@ -1166,7 +1327,7 @@ public:
   /**
      Used by relativeHull2 to insert candidate concavities into the Queue.
   */
-  void insertQueue( std::set< std::pair< VertexHandle, VertexHandle > > & inQueue,
+  void insertQueue( PendingEdges & queue, Strip & strip,
 		    const Edge & e,
 		    const CheckVertexLabelingInequality & predicate ) const
   {
@@ -1174,17 +1335,15 @@ public:
     VertexHandle v1 = TH.target( e );
     if ( ( ! predicate( v0 ) ) && predicate( v1 ) )
       {
-	Strip strip( T() );
 	strip.init( *this, predicate, e );
 	if ( strip.isConcave() ) 
-	  inQueue.insert( std::make_pair( v0, v1 ) );
+	  pushPending( queue, e );
       }
     else if ( ( ! predicate( v1 ) ) && predicate( v0 ) )
       {
-	Strip strip( T() );
 	strip.init( *this, predicate, T().mirror_edge( e ) );
 	if ( strip.isConcave() ) 
-	  inQueue.insert( std::make_pair( v1, v0 ) );
+	  pushPending( queue, T().mirror_edge( e ) );
       }
   }
 
@@ -1199,6 +1358,9 @@ public:
      complexifying a lot the way concavities (v0,v1) are pushed into
      the queue.
 
+     Candidate concavities are processed in FIFO order from a
+     worklist of edges, and the same strip is reused for all of them.
+
      @param[in] any label, as given with method \ref add.
      @return 'true' if some concavity was flipped, 'false' when no concavity was found.
   */
@@ -1206,43 +1368,38 @@ public:
   {
     bool changes = false;
     static const Label rmark = 1;
-    std::set< std::pair< VertexHandle, VertexHandle > > inQueue;
-    CheckVertexLabelingInequality predNotL( labeling(), l );
+    PendingEdges queue;
+    CheckVertexLabelingInequality predNotL( l );
     Strip strip( T() );
-    // DGtal::trace.beginBlock( "Searching concavities" );
     for ( FiniteEdgesIterator it = T().finite_edges_begin(), itend = T().finite_edges_end();
           it != itend; ++it )
       {
         Edge e = *it;
         if ( T().is_constrained( e ) ) continue;
-	insertQueue( inQueue, e, predNotL );
+	insertQueue( queue, strip, e, predNotL );
       }
-    DGtal::trace.info() << "- Found " << inQueue.size() << " potential concavities." 
+    DGtal::trace.info() << "- Found " << queue.size() << " potential concavities." 
 			<< std::endl;
-    // DGtal::trace.endBlock();
-    // DGtal::trace.beginBlock( "Flipping concavities" );
     unsigned int nb_checked = 0;
     unsigned int nb_flipped = 0;
+    std::size_t  head       = 0;
     Edge e;
-    while ( ! inQueue.empty() )
+    while ( head < queue.size() )
       {
-	VertexHandle v0 = inQueue.begin()->first;
-	VertexHandle v1 = inQueue.begin()->second;
+        PendingEdge & p = queue[ head ];
         ++nb_checked;
         if ( nb_checked % 1000 == 0 ) 
-          DGtal::trace.info() << "- Queue=" << inQueue.size()
+          DGtal::trace.info() << "- Queue=" << ( queue.size() - head )
                               << ", flipped " << nb_flipped << "/" << nb_checked 
                               << " edges in a concavity." << std::endl;
-	if ( ! T().is_edge( v0, v1, e.first, e.second ) )
+	if ( ! findPending( p, e ) )
 	  {
-	    inQueue.erase( inQueue.begin() );
+	    ++head;
 	    continue; // (v0,v1) is not an edge anymore.
 	  }
-	if ( TH.source( e ) != v0 ) 
-	  e = T().mirror_edge( e );
 	if ( T().is_constrained( e ) )
 	  {
-	    inQueue.erase( inQueue.begin() );
+	    popPending( queue[ head++ ] );
 	    continue; // (v0,v1) is constrained
 	  }
 	strip.init( *this, predNotL, e );
@@ -1256,18 +1413,13 @@ public:
 		ASSERT( ! T().is_constrained( fedge ) );
 		ASSERT( ! isFaceExtended( fedge.first ) );
 		Edge mirror_first = T().mirror_edge( strip.e( 0 ) );
-		_T.flip( fedge.first, fedge.second );
+		flipKeepingPending( fedge );
 		if ( strip.size() == 3 ) 
 		  { // last flip made a triangle
 		    Edge nedge = T().mirror_edge( mirror_first );
-		    // VertexHandle sv0 = TH.target( nedge );
-		    // VertexHandle sv1 = TH.target( Edge( nedge.first, 
-		    // 					T().ccw( nedge.second ) ) );
-		    // if ( predNotL( sv0 ) ) _vMarked[ sv0 ] = rmark;
-		    // if ( predNotL( sv1 ) ) _vMarked[ sv1 ] = rmark;
 		    _vFaces[ nedge.first ] = Extension( nedge.first, 
 							T().ccw( nedge.second ) );
-		    inQueue.erase( inQueue.begin() );
+		    popPending( queue[ head++ ] );
 		  }
 		changes = true; ++nb_flipped;
 	      }
@@ -1276,35 +1428,52 @@ public:
 		Edge fedge = strip.e( 0 );
 		if ( ! isFaceExtended( fedge.first ) )
 		  {
-		    if ( predNotL( strip.v0() ) ) _vMarked[ strip.v0() ] = rmark;
+		    if ( predNotL( strip.v0() ) ) strip.v0()->info().mark = rmark;
 		    _vFaces[ fedge.first ] = Extension( fedge.first, 
 							T().ccw( fedge.second ) );
 		    for ( unsigned int i = 1; i < strip.size() - 1; ++i ) 
 		      {
-			_vMarked[ strip.v( i ) ] = rmark;
+			strip.v( i )->info().mark = rmark;
 			fedge = strip.e( i );
 			ASSERT( ! isFaceExtended( fedge.first ) );
 			_vFaces[ fedge.first ] = Extension( fedge.first, 
 							    fedge.second,
 							    T().ccw( fedge.second ) );
 		      }
-		    if ( predNotL( strip.vn() ) ) _vMarked[ strip.vn() ] = rmark;
+		    if ( predNotL( strip.vn() ) ) strip.vn()->info().mark = rmark;
 		    changes = true;
 		  }
-		inQueue.erase( inQueue.begin() );
+		popPending( queue[ head++ ] );
 	      }
           }
 	else
-	  inQueue.erase( inQueue.begin() );
+	  popPending( queue[ head++ ] );
       }
-    ASSERT( inQueue.empty() );
     DGtal::trace.info() << "- Flipped " << nb_flipped << "/" << nb_checked << " edges in a concavity." << std::endl;
-    //if ( nb_flipped == 1 && nb_checked == 2 ) changes = false;
-    // DGtal::trace.endBlock();
     return changes;
   }
 
 
+  /// @return the number of ranges in which a read-only scan of \a n
+  /// elements is split, at most one per hardware thread.
+  static std::size_t nbConcurrentRanges( std::size_t n )
+  {
+    std::size_t nt = std::max( 1u, std::thread::hardware_concurrency() );
+    return std::max( std::size_t( 1 ), std::min( nt, n / 1024 ) ); // small scans: one range
+  }
+
+  /// Splits [0,n) into \a nb contiguous ranges and calls fct( b, e, r )
+  /// on the r-th range [b,e), each range in its own thread.
+  template <typename Fct>
+  static void forEachRangeConcurrently( std::size_t n, std::size_t nb, Fct fct )
+  {
+    std::vector<std::thread> threads;
+    for ( std::size_t r = 1; r < nb; ++r )
+      threads.push_back( std::thread( fct, r * n / nb, ( r + 1 ) * n / nb, r ) );
+    fct( std::size_t( 0 ), n / nb, std::size_t( 0 ) );
+    for ( std::size_t r = 0; r < threads.size(); ++r ) threads[ r ].join();
+  }
+
   /**
      This procedure computes the relative hull with the same principle
      as removeConcavities. around vertices with label \a l. Complexity
@@ -1324,38 +1493,47 @@ public:
     bool changes = false;
     typedef GenericConcavity< CheckVertexLabelingInequalityWhenUnmarked > Concavity;
     std::priority_queue<Concavity> Q;
-    std::set< std::pair< VertexHandle, VertexHandle > > inQueue;
     const Label mark = 1;
-    CheckVertexLabelingInequalityWhenUnmarked predNotLWU( labeling(), _vMarked, l, mark );
+    CheckVertexLabelingInequalityWhenUnmarked predNotLWU( l, mark );
     // DGtal::trace.beginBlock( "Searching concavities" );
+    // The search does not modify the triangulation: edges are split
+    // among threads, then the concavities found are queued in the
+    // order of a sequential scan.
+    std::vector<Edge> edges;
     for ( FiniteEdgesIterator it = T().finite_edges_begin(), itend = T().finite_edges_end();
           it != itend; ++it )
-      {
-        Edge e = *it;
-        if ( _T.is_constrained( e ) ) continue;
-        VertexHandle v0 = TH.source( e );
-        VertexHandle v1 = TH.target( e );
-        Label l0 = label( v0 );
-        Label l1 = label( v1 );
-        if ( ( l0 == l ) && predNotLWU( v1 ) && ( l1 != INVALID ) )
+      if ( ! _T.is_constrained( *it ) ) edges.push_back( *it );
+    std::vector< std::vector<Concavity> > found( nbConcurrentRanges( edges.size() ) );
+    forEachRangeConcurrently
+      ( edges.size(), found.size(),
+        [ & ] ( std::size_t b, std::size_t e, std::size_t r ) {
+        for ( std::size_t i = b; i < e; ++i )
           {
-            Concavity c( v0, v1, TH, predNotLWU );
-            if ( c.priority() < M_PI - EPSILON ) 
-              { 
-                Q.push( c ); // only concave vertices are flippable.
-                inQueue.insert( std::make_pair( v0, v1 ) );
+            VertexHandle v0 = TH.source( edges[ i ] );
+            VertexHandle v1 = TH.target( edges[ i ] );
+            Label l0 = label( v0 );
+            Label l1 = label( v1 );
+            if ( ( l0 == l ) && predNotLWU( v1 ) && ( l1 != INVALID ) )
+              {
+                Concavity c( v0, v1, TH, predNotLWU );
+                if ( c.priority() < M_PI - EPSILON ) // only concave vertices are flippable.
+                  found[ r ].push_back( c );
               }
-          }
-        else if ( ( l1 == l ) && predNotLWU( v0 ) && ( l0 != INVALID ) )
-          {
-            Concavity c( v1, v0, TH, predNotLWU );
-            if ( c.priority() <  M_PI - EPSILON ) 
+            else if ( ( l1 == l ) && predNotLWU( v0 ) && ( l0 != INVALID ) )
               {
-                Q.push( c ); // only concave vertices are flippable.
-                inQueue.insert( std::make_pair( v1, v0 ) );
+                Concavity c( v1, v0, TH, predNotLWU );
+                if ( c.priority() <  M_PI - EPSILON ) // only concave vertices are flippable.
+                  found[ r ].push_back( c );
               }
           }
-      }
+      } );
+    for ( std::size_t r = 0; r < found.size(); ++r )
+      for ( typename std::vector<Concavity>::const_iterator it = found[ r ].begin(),
+              ite = found[ r ].end(); it != ite; ++it )
+        {
+          Q.push( *it );
+          setPending( it->_v0, it->_v1, true );
+        }
     DGtal::trace.info() << "- Found " << Q.size() << " potential concavities." << std::endl;
     // DGtal::trace.endBlock();
     // DGtal::trace.beginBlock( "Flipping concavities" );
@@ -1369,7 +1547,7 @@ public:
           DGtal::trace.info() << "- Queue=" << Q.size()
                               << ", flipped " << nb_flipped << "/" << nb_checked 
                               << " edges in a concavity." << std::endl;
-        inQueue.erase( std::make_pair( concavity._v0, concavity._v1 ) );
+        setPending( concavity._v0, concavity._v1, false );
         Edge e;
         Strip strip( _T );
         double p = concavity.computePriority( e, strip );
@@ -1379,7 +1557,7 @@ public:
              && ( p > Q.top().priority() ) )// and the priority is not the best
           { 
             Q.push( Concavity( concavity._v0, concavity._v1, TH, predNotLWU, p ) );
-            inQueue.insert( std::make_pair( concavity._v0, concavity._v1 ) );
+            setPending( concavity._v0, concavity._v1, true );
             continue;
           }
         if ( strip.isConcave() ) 
@@ -1406,16 +1584,13 @@ public:
                 for ( typename std::vector<Concavity>::const_iterator it = smallQ.begin(),
                         ite = smallQ.end(); it != ite; ++it )
                   { 
-                    if ( inQueue.find( std::make_pair( it->_v0, it->_v1 ) ) == inQueue.end() )
-                      {
-                        Q.push( *it );
-                        inQueue.insert( std::make_pair( it->_v0, it->_v1 ) );
-                      }
+                    if ( ! setPending( it->_v0, it->_v1, true ) )
+                      Q.push( *it );
                   }
                 DGtal::Z2i::Point a = toDGtal( TH.source( fedge )->point() );
                 DGtal::Z2i::Point b = toDGtal( TH.target( fedge )->point() );
                 _debugBoard.drawLine(a[0],a[1],b[0],b[1]);
-                _T.flip( fedge.first, fedge.second );
+                flipKeepingPending( fedge );
                 changes = true; ++nb_flipped;
               }
             else
@@ -1424,7 +1599,7 @@ public:
                 if ( idx != strip.size() )
                   {
                     Edge fedge = strip.e( idx );
-                    _vMarked[ TH.target( fedge ) ] = mark;
+                    TH.target( fedge )->info().mark = mark;
                     // DGtal::trace.info() << "- mark " << TH.target( fedge )->point()
                     //                     << " source=" << TH.source( fedge )->point() << std::endl;
                     changes = true;
@@ -1432,7 +1607,6 @@ public:
               }
           }
       }
-    ASSERT( inQueue.empty() );
     ASSERT( Q.empty() );
     DGtal::trace.info() << "- Flipped " << nb_flipped << "/" << nb_checked << " edges in a concavity." << std::endl;
     // DGtal::trace.endBlock();
@@ -1511,7 +1685,7 @@ public:
         else 
           {
             VertexHandle v = TH.source( e );
-            CheckVertexLabelingInequality predNotL( labeling(), label( v ) );
+            CheckVertexLabelingInequality predNotL( label( v ) );
             strip.init( predNotL, e );
             double angle = strip.angle();
             if ( angle > M_PI + EPSILON )      tag[ v ] = Convex;
@@ -1540,7 +1714,7 @@ public:
       {
         Strip strip( _T );
         VertexHandle v = TH.source( e );
-        CheckVertexLabelingInequality predNotL( labeling(), label( v ) );
+        CheckVertexLabelingInequality predNotL( label( v ) );
         strip.init( predNotL, e );
         double angle = strip.angle();
         if ( angle > M_PI + EPSILON )      tag = Convex;
@@ -2223,8 +2397,8 @@ public:
         Edge edge = *it;
         DPoint a = toDGtal( _dac.TH.source( edge )->point() );
         DPoint b = toDGtal( _dac.TH.target( edge )->point() );
-        int l1 = _dac.labeling().find( _dac.TH.source( edge ) )->second;
-        int l2 = _dac.labeling().find( _dac.TH.target( edge ) )->second;
+        int l1 = _dac.label( _dac.TH.source( edge ) );
+        int l2 = _dac.label( _dac.TH.target( edge ) );
         Color c = ( l1 == l2 ) ? _label_colors[ l1 ] : _other_colors[ 0 ]; 
         // double w = 1.0; // _dac.T().is_constrained( edge ) ? 2.0 : 1.0;
         _board.setPenColor( c );
@@ -2243,8 +2417,8 @@ public:
         Edge edge = *it;
         DPoint a = toDGtal( _dac.TH.source( edge )->point() );
         DPoint b = toDGtal( _dac.TH.target( edge )->point() );
-        int l1 = _dac.labeling().find( _dac.TH.source( edge ) )->second;
-        int l2 = _dac.labeling().find( _dac.TH.target( edge ) )->second;
+        int l1 = _dac.label( _dac.TH.source( edge ) );
+        int l2 = _dac.label( _dac.TH.target( edge ) );
         if ( ( l == -1 ) || ( ( l == l1 ) && ( l == l2 ) ) )
           {
             Color c = ( l1 == l2 ) ? _label_colors[ l1 ] : _other_colors[ 0 ]; 
@@ -2266,8 +2440,8 @@ public:
         Edge edge = *it;
         DPoint a = toDGtal( _dac.TH.source( edge )->point() );
         DPoint b = toDGtal( _dac.TH.target( edge )->point() );
-        int l1 = _dac.labeling().find( _dac.TH.source( edge ) )->second;
-        int l2 = _dac.labeling().find( _dac.TH.target( edge ) )->second;
+        int l1 = _dac.label( _dac.TH.source( edge ) );
+        int l2 = _dac.label( _dac.TH.target( edge ) );
         if ( ( ( l == -1 ) || ( l == l1 ) )
              && _dac.T().is_constrained( edge ) )
           {
@@ -2483,6 +2657,8 @@ insertBands( DAC & dac, const Image & image, const Predicate & predicate,
   typedef typename Domain::ConstSubRange ConstSubRange;
   typedef typename Space::Point DPoint;
   typedef typename DAC::Point Point;
+  // Constraints of all bands, inserted at once at the end.
+  std::vector< std::pair<Point,Point> > constraints;
   // Find bands
   Domain imageDomain = image.domain();
   DPoint d1 = DPoint::diagonal( 1 );
@@ -2537,7 +2713,8 @@ insertBands( DAC & dac, const Image & image, const Predicate & predicate,
                         DPoint prev_p1 = p1 - DPoint( 1, 0 );
                         DPoint mid = ( band_p + prev_p ) / 2;
                         DPoint mid1 = ( band_p1 + prev_p1 ) / 2;
-                        dac.addBand( toCGAL<Point>( band_p ), toCGAL<Point>( prev_p ), toCGAL<Point>( mid ),
+                        dac.addBand( constraints,
+                                     toCGAL<Point>( band_p ), toCGAL<Point>( prev_p ), toCGAL<Point>( mid ),
                                      toCGAL<Point>( band_p1 ), toCGAL<Point>( prev_p1 ), toCGAL<Point>( mid1 ),
                                      ins1 != prev_p_inside, 
                                      ins2 != prev_p_inside );
@@ -2608,7 +2785,8 @@ insertBands( DAC & dac, const Image & image, const Predicate & predicate,
                         DPoint prev_p1 = p1 - DPoint( 0, 1 );
                         DPoint mid = ( band_p + prev_p ) / 2;
                         DPoint mid1 = ( band_p1 + prev_p1 ) / 2;
-                        dac.addBand( toCGAL<Point>( band_p ), toCGAL<Point>( prev_p ), toCGAL<Point>( mid ),
+                        dac.addBand( constraints,
+                                     toCGAL<Point>( band_p ), toCGAL<Point>( prev_p ), toCGAL<Point>( mid ),
                                      toCGAL<Point>( band_p1 ), toCGAL<Point>( prev_p1 ), toCGAL<Point>( mid1 ),
                                      ins1 != prev_p_inside, 
                                      ins2 != prev_p_inside );
@@ -2629,7 +2807,7 @@ insertBands( DAC & dac, const Image & image, const Predicate & predicate,
           } // end of loop on y-axis.
       } // end of loop on x-axis.
   }
-
+  dac.addConstraints( constraints.begin(), constraints.end() );
 }
 
 double randomUniform()
@@ -2641,7 +2819,7 @@ namespace po = boost::program_options;
 
 int main( int argc, char** argv )
 {
-  typedef CGAL::Exact_predicates_inexact_constructions_kernel K;
+  typedef DGtal::LatticeKernel K;
   typedef DAC<K> DigitalAffineComplex;
   typedef DigitalAffineComplex::Point Point;
   typedef DGtal::Z2i::Space Space;
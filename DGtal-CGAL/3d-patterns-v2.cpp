@@ -23,6 +23,7 @@
 #include <CGAL/CORE/Expr.h>
 
 #include "Auxiliary.h"
+#include "LatticeCounting.h"
 
 typedef CGAL::Exact_predicates_inexact_constructions_kernel K;
 //typedef CGAL::Cartesian<CORE::Expr> K;
@@ -377,37 +378,7 @@ markBasicFacets( FacetSet & bFacets, OFacetSet & qFacets,
 DGtal::int64_t
 countLatticePointsInTetrahedra( const Point & a, const Point & b, const Point & c, const Point & d )
 {
-  DGtal::int64_t nb = 0;
-  Point ab = b - a;
-  Point bc = c - b;
-  Point cd = d - c;  
-  Point da = a - d;
-  Point abc = ab^bc;
-  Point bcd = bc^cd;
-  Point cda = cd^da;
-  Point dab = da^ab;
-  Point::Component abc_shift = abc.dot( a );
-  Point::Component bcd_shift = bcd.dot( b );
-  Point::Component cda_shift = cda.dot( c );
-  Point::Component dab_shift = dab.dot( d );
-  if ( abc.dot( d ) < abc_shift )  { abc = -abc; abc_shift = -abc_shift; }
-  if ( bcd.dot( a ) < bcd_shift )  { bcd = -bcd; bcd_shift = -bcd_shift; }
-  if ( cda.dot( b ) < cda_shift )  { cda = -cda; cda_shift = -cda_shift; }
-  if ( dab.dot( c ) < dab_shift )  { dab = -dab; dab_shift = -dab_shift; }
-  Point inf = a.inf( b ).inf( c ).inf( d );
-  Point sup = a.sup( b ).sup( c ).sup( d );
-  Domain domain( inf, sup );
-  for ( DomainConstIterator it = domain.begin(), itE = domain.end();
-	it != itE; ++it )
-    {
-      Point p = *it;
-      if ( ( abc.dot( p ) >= abc_shift )
-	   && ( bcd.dot( p ) >= bcd_shift )
-	   && ( cda.dot( p ) >= cda_shift )
-	   && ( dab.dot( p ) >= dab_shift ) )
-	++nb;
-    }
-  return nb;
+  return LatticeCounting::tetrahedronPoints( a, b, c, d );
 }
 
 /**
@@ -416,40 +387,7 @@ countLatticePointsInTetrahedra( const Point & a, const Point & b, const Point &
 DGtal::int64_t
 countLatticePointsInTetrahedraIf4( const Point & a, const Point & b, const Point & c, const Point & d )
 {
-  DGtal::int64_t nb = 0;
-  Point ab = b - a;
-  Point bc = c - b;
-  Point cd = d - c;  
-  Point da = a - d;
-  Point abc = ab^bc;
-  Point bcd = bc^cd;
-  Point cda = cd^da;
-  Point dab = da^ab;
-  Point::Component abc_shift = abc.dot( a );
-  Point::Component bcd_shift = bcd.dot( b );
-  Point::Component cda_shift = cda.dot( c );
-  Point::Component dab_shift = dab.dot( d );
-  if ( abc.dot( d ) < abc_shift )  { abc = -abc; abc_shift = -abc_shift; }
-  if ( bcd.dot( a ) < bcd_shift )  { bcd = -bcd; bcd_shift = -bcd_shift; }
-  if ( cda.dot( b ) < cda_shift )  { cda = -cda; cda_shift = -cda_shift; }
-  if ( dab.dot( c ) < dab_shift )  { dab = -dab; dab_shift = -dab_shift; }
-  Point inf = a.inf( b ).inf( c ).inf( d );
-  Point sup = a.sup( b ).sup( c ).sup( d );
-  Domain domain( inf, sup );
-  for ( DomainConstIterator it = domain.begin(), itE = domain.end();
-	it != itE; ++it )
-    {
-      Point p = *it;
-      if ( ( abc.dot( p ) >= abc_shift )
-	   && ( bcd.dot( p ) >= bcd_shift )
-	   && ( cda.dot( p ) >= cda_shift )
-	   && ( dab.dot( p ) >= dab_shift ) )
-	{ 
-          ++nb;
-          if ( nb > 4 ) return 5;
-        }
-    }
-  return nb;
+  return LatticeCounting::tetrahedronPoints( a, b, c, d, 4 );
 }
 
 void 
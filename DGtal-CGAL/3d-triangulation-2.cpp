@@ -31,6 +31,7 @@
 #include <CGAL/IO/Polyhedron_iostream.h>
 
 #include "Auxiliary.h"
+#include "LatticeCounting.h"
 #include "Triangulation3DHelper.h"
 // #include "SimplicialStrip3D.h"
 // #include "RelativeConvexHull.h"
@@ -152,37 +153,7 @@ public:
 DGtal::int64_t
 countLatticePointsInTetrahedra( const PointZ3 & a, const PointZ3 & b, const PointZ3 & c, const PointZ3 & d )
 {
-  DGtal::int64_t nb = 0;
-  PointZ3 ab = b - a;
-  PointZ3 bc = c - b;
-  PointZ3 cd = d - c;  
-  PointZ3 da = a - d;
-  PointZ3 abc = ab^bc;
-  PointZ3 bcd = bc^cd;
-  PointZ3 cda = cd^da;
-  PointZ3 dab = da^ab;
-  PointZ3::Component abc_shift = abc.dot( a );
-  PointZ3::Component bcd_shift = bcd.dot( b );
-  PointZ3::Component cda_shift = cda.dot( c );
-  PointZ3::Component dab_shift = dab.dot( d );
-  if ( abc.dot( d ) < abc_shift )  { abc = -abc; abc_shift = -abc_shift; }
-  if ( bcd.dot( a ) < bcd_shift )  { bcd = -bcd; bcd_shift = -bcd_shift; }
-  if ( cda.dot( b ) < cda_shift )  { cda = -cda; cda_shift = -cda_shift; }
-  if ( dab.dot( c ) < dab_shift )  { dab = -dab; dab_shift = -dab_shift; }
-  PointZ3 inf = a.inf( b ).inf( c ).inf( d );
-  PointZ3 sup = a.sup( b ).sup( c ).sup( d );
-  Domain domain( inf, sup );
-  for ( DomainConstIterator it = domain.begin(), itE = domain.end();
-	it != itE; ++it )
-    {
-      PointZ3 p = *it;
-      if ( ( abc.dot( p ) >= abc_shift )
-	   && ( bcd.dot( p ) >= bcd_shift )
-	   && ( cda.dot( p ) >= cda_shift )
-	   && ( dab.dot( p ) >= dab_shift ) )
-	++nb;
-    }
-  return nb;
+  return LatticeCounting::tetrahedronPoints( a, b, c, d );
 }
 
 /**
@@ -191,40 +162,7 @@ countLatticePointsInTetrahedra( const PointZ3 & a, const PointZ3 & b, const Poin
 DGtal::int64_t
 countLatticePointsInTetrahedraIf4( const PointZ3 & a, const PointZ3 & b, const PointZ3 & c, const PointZ3 & d )
 {
-  DGtal::int64_t nb = 0;
-  PointZ3 ab = b - a;
-  PointZ3 bc = c - b;
-  PointZ3 cd = d - c;  
-  PointZ3 da = a - d;
-  PointZ3 abc = ab^bc;
-  PointZ3 bcd = bc^cd;
-  PointZ3 cda = cd^da;
-  PointZ3 dab = da^ab;
-  PointZ3::Component abc_shift = abc.dot( a );
-  PointZ3::Component bcd_shift = bcd.dot( b );
-  PointZ3::Component cda_shift = cda.dot( c );
-  PointZ3::Component dab_shift = dab.dot( d );
-  if ( abc.dot( d ) < abc_shift )  { abc = -abc; abc_shift = -abc_shift; }
-  if ( bcd.dot( a ) < bcd_shift )  { bcd = -bcd; bcd_shift = -bcd_shift; }
-  if ( cda.dot( b ) < cda_shift )  { cda = -cda; cda_shift = -cda_shift; }
-  if ( dab.dot( c ) < dab_shift )  { dab = -dab; dab_shift = -dab_shift; }
-  PointZ3 inf = a.inf( b ).inf( c ).inf( d );
-  PointZ3 sup = a.sup( b ).sup( c ).sup( d );
-  Domain domain( inf, sup );
-  for ( DomainConstIterator it = domain.begin(), itE = domain.end();
-	it != itE; ++it )
-    {
-      PointZ3 p = *it;
-      if ( ( abc.dot( p ) >= abc_shift )
-	   && ( bcd.dot( p ) >= bcd_shift )
-	   && ( cda.dot( p ) >= cda_shift )
-	   && ( dab.dot( p ) >= dab_shift ) )
-	{ 
-          ++nb;
-          if ( nb > 4 ) return 5;
-        }
-    }
-  return nb;
+  return LatticeCounting::tetrahedronPoints( a, b, c, d, 4 );
 }
 
 
@@ -240,44 +178,8 @@ countLatticePointsInTetrahedra( const PointZ3 & a, const PointZ3 & b,
 				bool abc_closed, bool bcd_closed,
 				bool cda_closed, bool dab_closed )
 {
-  DGtal::int64_t nb = 0;
-  PointZ3 ab = b - a;
-  PointZ3 bc = c - b;
-  PointZ3 cd = d - c;  
-  PointZ3 da = a - d;
-  PointZ3 abc = ab^bc;
-  PointZ3 bcd = bc^cd;
-  PointZ3 cda = cd^da;
-  PointZ3 dab = da^ab;
-  PointZ3::Component abc_shift = abc.dot( a );
-  PointZ3::Component bcd_shift = bcd.dot( b );
-  PointZ3::Component cda_shift = cda.dot( c );
-  PointZ3::Component dab_shift = dab.dot( d );
-  if ( abc.dot( d ) < abc_shift )  { abc = -abc; abc_shift = -abc_shift; }
-  if ( bcd.dot( a ) < bcd_shift )  { bcd = -bcd; bcd_shift = -bcd_shift; }
-  if ( cda.dot( b ) < cda_shift )  { cda = -cda; cda_shift = -cda_shift; }
-  if ( dab.dot( c ) < dab_shift )  { dab = -dab; dab_shift = -dab_shift; }
-  // if ( ! abc_closed ) ++abc_shift;
-  // if ( ! bcd_closed ) ++bcd_shift;
-  // if ( ! cda_closed ) ++cda_shift;
-  // if ( ! dab_closed ) ++dab_shift;
-  PointZ3 inf = a.inf( b ).inf( c ).inf( d );
-  PointZ3 sup = a.sup( b ).sup( c ).sup( d );
-  Domain domain( inf, sup );
-  for ( DomainConstIterator it = domain.begin(), itE = domain.end();
-	it != itE; ++it )
-    {
-      PointZ3 p = *it;
-      if ( ( abc.dot( p ) >= abc_shift )
-	   && ( bcd.dot( p ) >= bcd_shift )
-	   && ( cda.dot( p ) >= cda_shift )
-	   && ( dab.dot( p ) >= dab_shift ) )
-	{ 
-          ++nb;
-          if ( nb > 4 ) return 5;
-        }
-    }
-  return nb;
+  // Open facets are not handled: every facet is counted as closed.
+  return LatticeCounting::tetrahedronPoints( a, b, c, d, 4 );
 }
 
 
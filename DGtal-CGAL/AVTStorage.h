@@ -0,0 +1,140 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **/
+
+#pragma once
+
+/**
+ * @file AVTStorage.h
+ * @author Jacques-Olivier Lachaud (\c jacques-olivier.lachaud@univ-savoie.fr )
+ * Laboratory of Mathematics (CNRS, UMR 5807), University of Savoie, France
+ *
+ * @date 2018/02/20
+ *
+ * Header file for module AVTStorage.cpp
+ *
+ * This file is part of the DGtal library.
+ */
+
+#if defined(AVTStorage_RECURSES)
+#error Recursive header files inclusion detected in AVTStorage.h
+#else // defined(AVTStorage_RECURSES)
+/** Prevents recursive inclusion of headers. */
+#define AVTStorage_RECURSES
+
+#if !defined AVTStorage_h
+/** Prevents repeated inclusion of headers. */
+#define AVTStorage_h
+
+//////////////////////////////////////////////////////////////////////////////
+// Inclusions
+#include <CGAL/Triangulation_data_structure_2.h>
+#include <CGAL/Triangulation_vertex_base_with_info_2.h>
+#include <CGAL/Triangulation_face_base_with_info_2.h>
+#include <CGAL/Constrained_triangulation_face_base_2.h>
+#include <CGAL/Delaunay_triangulation_2.h>
+#include <CGAL/Constrained_Delaunay_triangulation_2.h>
+
+//////////////////////////////////////////////////////////////////////////////
+
+namespace DGtal
+{
+
+  /////////////////////////////////////////////////////////////////////////////
+  // struct AVTVertexInfo
+  /**
+     Description of struct 'AVTVertexInfo' <p> \brief Aim: The value
+     of an affine valued triangulation (AVT) stored directly in a
+     vertex of the triangulation.
+  */
+  template <typename TValue>
+  struct AVTVertexInfo {
+    TValue value;
+    bool   valid; ///< 'false' while no value was set.
+    int    heap;  ///< position in the decimation heap of AVT::compress, or -1.
+
+    AVTVertexInfo() : valid( false ), heap( -1 ) {}
+  };
+
+  /////////////////////////////////////////////////////////////////////////////
+  // struct AVTFaceInfo
+  /**
+     Description of struct 'AVTFaceInfo' <p> \brief Aim: The values
+     of an affine valued triangulation (AVT) stored directly in a face
+     of the triangulation: the value of the face and the values of its
+     three edges, edge i being the one opposite to vertex i.
+
+     An edge value is duplicated in the two faces sharing the edge, so
+     that it survives when one of them is destroyed or reshaped by a
+     flip, an insertion or a removal. Before a flip resets its two
+     faces, AVT::eraseQuadValues copies the values of the border edges
+     of the quad to the faces outside, so that the last copy of a value
+     is never lost.
+  */
+  template <typename TValue>
+  struct AVTFaceInfo {
+    TValue value;
+    TValue edge[ 3 ];
+    bool   valid;         ///< 'false' while no face value was set.
+    bool   edge_valid[ 3 ]; ///< 'false' while no value was set for edge i.
+    bool   queued[ 3 ];   ///< 'true' iff edge i is pending in AVT::fullRelativeHull.
+
+    AVTFaceInfo() { reset(); }
+
+    /// Forgets every value and flag stored in this face.
+    void reset()
+    {
+      valid = false;
+      for ( int i = 0; i < 3; ++i ) edge_valid[ i ] = queued[ i ] = false;
+    }
+  };
+
+  /////////////////////////////////////////////////////////////////////////////
+  // struct AVTTriangulations
+  /**
+     Description of struct 'AVTTriangulations' <p> \brief Aim: Gives
+     the CGAL triangulation types whose vertices and faces carry the
+     values of an AVT, for the given kernel and value type.
+  */
+  template <typename TKernel2, typename TValue>
+  struct AVTTriangulations {
+    typedef AVTVertexInfo<TValue>                                   VertexInfo;
+    typedef AVTFaceInfo<TValue>                                     FaceInfo;
+    typedef CGAL::Triangulation_vertex_base_with_info_2<VertexInfo,
+                                                        TKernel2>   Vb;
+    typedef CGAL::Triangulation_face_base_with_info_2<FaceInfo,
+                                                      TKernel2>     Fb;
+    typedef CGAL::Constrained_triangulation_face_base_2<TKernel2,Fb> CFb;
+    typedef CGAL::Triangulation_data_structure_2<Vb,Fb>             Tds;
+    typedef CGAL::Triangulation_data_structure_2<Vb,CFb>            CTds;
+    /// A Delaunay triangulation holding AVT values.
+    typedef CGAL::Delaunay_triangulation_2<TKernel2,Tds>            Delaunay;
+    /// A constrained Delaunay triangulation holding AVT values.
+    typedef CGAL::Constrained_Delaunay_triangulation_2<TKernel2,CTds> ConstrainedDelaunay;
+  };
+
+} // namespace DGtal
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Includes inline functions.
+
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // !defined AVTStorage_h
+
+#undef AVTStorage_RECURSES
+#endif // else defined(AVTStorage_RECURSES)
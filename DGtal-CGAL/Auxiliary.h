@@ -5,6 +5,15 @@
 #include <string>
 #include <sstream>
 #include <fstream>
+#include <vector>
+#include <set>
+#include <unordered_set>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <mutex>
 
 #include "DGtal/base/Common.h"
 #include "DGtal/kernel/domains/HyperRectDomain.h"
@@ -331,132 +340,340 @@ namespace DGtal
     return 0;
   }
 
+  namespace detail
+  {
+    /// Hash of a digital point, used by the sparse variants of the
+    /// digital set operations below.
+    template <typename Point>
+    struct DigitalPointHash {
+      std::size_t operator()( const Point & p ) const
+      {
+        std::size_t h = 0;
+        for ( Dimension i = 0; i < Point::dimension; ++i )
+          h = h * 0x9E3779B97F4A7C15ULL + std::hash<long long>()( (long long) p[ i ] );
+        return h;
+      }
+    };
+
+    /**
+       A set of digital points of a box, stored as a dense bitset. Rows
+       follow axis 0 and are padded to a whole number of 64-bit words,
+       so that neighbours along axis 0 are tested with word shifts and
+       neighbours along the other axes with a word-wise and/or between
+       rows. Every pass is split into slabs of consecutive rows that are
+       processed by concurrent threads.
+    */
+    template <typename Point>
+    struct DigitalBitset {
+      typedef std::uint64_t Word;
+      typedef typename Point::Coordinate Coordinate;
+      static const Dimension dim = Point::dimension;
+
+      Point             lo;          ///< lowest point of the box
+      std::int64_t      ext[ dim ];  ///< extent of the box along each axis
+      std::int64_t      stride[ dim ]; ///< row stride along axes 1..dim-1
+      std::size_t       wpr;         ///< words per row
+      std::size_t       nbRows;
+      Word              lastMask;    ///< valid bits of the last word of a row
+      std::vector<Word> bits;
+
+      DigitalBitset( const Point & low, const Point & up )
+        : lo( low ), nbRows( 1 )
+      {
+        for ( Dimension k = 0; k < dim; ++k )
+          {
+            ext[ k ] = (std::int64_t) up[ k ] - (std::int64_t) low[ k ] + 1;
+            stride[ k ] = k == 0 ? 0 : (std::int64_t) nbRows;
+            if ( k > 0 ) nbRows *= ext[ k ];
+          }
+        wpr      = ( ext[ 0 ] + 63 ) / 64;
+        lastMask = ( ext[ 0 ] % 64 ) == 0 ? ~Word( 0 ) : ( Word( 1 ) << ( ext[ 0 ] % 64 ) ) - 1;
+        bits.assign( wpr * nbRows, 0 );
+      }
+
+      /// @return the number of bits a bitset over [low,up] would take.
+      static double size( const Point & low, const Point & up )
+      {
+        double s = 64.0 * std::ceil( ( (double) up[ 0 ] - (double) low[ 0 ] + 1.0 ) / 64.0 );
+        for ( Dimension k = 1; k < dim; ++k )
+          s *= (double) up[ k ] - (double) low[ k ] + 1.0;
+        return s;
+      }
+
+      std::size_t row( const Point & p ) const
+      {
+        std::int64_t r = 0;
+        for ( Dimension k = 1; k < dim; ++k )
+          r += ( (std::int64_t) p[ k ] - (std::int64_t) lo[ k ] ) * stride[ k ];
+        return r;
+      }
+
+      void set( const Point & p )
+      {
+        std::int64_t x = (std::int64_t) p[ 0 ] - (std::int64_t) lo[ 0 ];
+        bits[ row( p ) * wpr + x / 64 ] |= Word( 1 ) << ( x % 64 );
+      }
+
+      /// @return the point at bit \a x of row \a r.
+      Point point( std::size_t r, std::int64_t x ) const
+      {
+        Point p;
+        p[ 0 ] = (Coordinate) ( lo[ 0 ] + x );
+        for ( Dimension k = 1; k < dim; ++k )
+          p[ k ] = (Coordinate) ( lo[ k ] + ( (std::int64_t) r / stride[ k ] ) % ext[ k ] );
+        return p;
+      }
+
+      /// Calls fct( begin, end ) on slabs of consecutive rows that
+      /// partition [0,nbRows), each slab in its own thread.
+      template <typename Fct>
+      void forEachSlab( Fct fct ) const
+      {
+        std::size_t nt = std::thread::hardware_concurrency();
+        nt = std::max( std::size_t( 1 ),
+                       std::min( nt, bits.size() / 65536 ) ); // small sets: one thread
+        nt = std::min( nt, nbRows );
+        std::vector<std::thread> threads;
+        for ( std::size_t i = 1; i < nt; ++i )
+          threads.push_back( std::thread( fct, i * nbRows / nt, ( i + 1 ) * nbRows / nt ) );
+        fct( std::size_t( 0 ), nbRows / nt );
+        for ( std::size_t i = 0; i < threads.size(); ++i ) threads[ i ].join();
+      }
+
+      /// Sets every bit of the box whose point satisfies \a pred.
+      template <typename Predicate>
+      void setIf( const Predicate & pred )
+      {
+        forEachSlab( [ this, &pred ] ( std::size_t b, std::size_t e ) {
+            for ( std::size_t r = b; r < e; ++r )
+              for ( std::int64_t x = 0; x < ext[ 0 ]; ++x )
+                if ( pred( point( r, x ) ) )
+                  bits[ r * wpr + x / 64 ] |= Word( 1 ) << ( x % 64 );
+          } );
+      }
+
+      /// Replaces this set by its dilation (\a erode == false) or its
+      /// erosion (\a erode == true) by the 3^d neighbourhood. The
+      /// neighbourhood is a cube, hence the operation is done one axis
+      /// after the other. Points outside the box are not in the set.
+      void morphology( bool erode )
+      {
+        std::vector<Word> tmp( bits.size() );
+        for ( Dimension k = 0; k < dim; ++k )
+          {
+            const Word* src = bits.data();
+            Word*       dst = tmp.data();
+            forEachSlab( [ this, k, erode, src, dst ] ( std::size_t b, std::size_t e ) {
+                for ( std::size_t r = b; r < e; ++r )
+                  {
+                    const Word* a = src + r * wpr;
+                    Word*       d = dst + r * wpr;
+                    if ( k == 0 )
+                      {
+                        for ( std::size_t w = 0; w < wpr; ++w )
+                          {
+                            Word l = ( a[ w ] << 1 ) | ( w > 0 ? a[ w - 1 ] >> 63 : 0 );
+                            Word h = ( a[ w ] >> 1 ) | ( w + 1 < wpr ? a[ w + 1 ] << 63 : 0 );
+                            d[ w ] = erode ? a[ w ] & l & h : a[ w ] | l | h;
+                          }
+                        d[ wpr - 1 ] &= lastMask;
+                      }
+                    else
+                      {
+                        std::int64_t c  = ( (std::int64_t) r / stride[ k ] ) % ext[ k ];
+                        std::size_t  s  = stride[ k ] * wpr;
+                        const Word*  am = c > 0 ? a - s : 0;
+                        const Word*  ap = c + 1 < ext[ k ] ? a + s : 0;
+                        if ( erode && ( am == 0 || ap == 0 ) )
+                          std::fill( d, d + wpr, Word( 0 ) );
+                        else if ( erode )
+                          for ( std::size_t w = 0; w < wpr; ++w )
+                            d[ w ] = a[ w ] & am[ w ] & ap[ w ];
+                        else
+                          for ( std::size_t w = 0; w < wpr; ++w )
+                            d[ w ] = a[ w ] | ( am ? am[ w ] : 0 ) | ( ap ? ap[ w ] : 0 );
+                      }
+                  }
+              } );
+            bits.swap( tmp );
+          }
+      }
+
+      /// Inserts in \a Q the points whose bit is set in the word-wise
+      /// combination fct( word of A, word of B ) and that satisfy \a pred.
+      template <typename Fct, typename Predicate>
+      void extract( std::set<Point> & Q, const DigitalBitset & A,
+                    const DigitalBitset & B, Fct fct, const Predicate & pred ) const
+      {
+        std::vector< std::vector<Point> > slabs;
+        std::mutex mutex;
+        forEachSlab( [ & ] ( std::size_t b, std::size_t e ) {
+            std::vector<Point> pts;
+            for ( std::size_t r = b; r < e; ++r )
+              for ( std::size_t w = 0; w < wpr; ++w )
+                for ( Word v = fct( A.bits[ r * wpr + w ], B.bits[ r * wpr + w ] );
+                      v != 0; v &= v - 1 )
+                  {
+                    Point p = point( r, 64 * w + lowestBit( v ) );
+                    if ( pred( p ) ) pts.push_back( p );
+                  }
+            std::lock_guard<std::mutex> lock( mutex );
+            slabs.push_back( std::vector<Point>() );
+            slabs.back().swap( pts );
+          } );
+        std::vector<Point> all;
+        for ( std::size_t i = 0; i < slabs.size(); ++i )
+          all.insert( all.end(), slabs[ i ].begin(), slabs[ i ].end() );
+        std::sort( all.begin(), all.end() );
+        for ( typename std::vector<Point>::const_iterator it = all.begin(), ite = all.end();
+              it != ite; ++it )
+          Q.insert( Q.end(), *it );
+      }
+
+      static int lowestBit( Word v )
+      {
+#if defined(__GNUC__)
+        return __builtin_ctzll( v );
+#else
+        int i = 0;
+        for ( ; ( v & 1 ) == 0; v >>= 1 ) ++i;
+        return i;
+#endif
+      }
+    };
+
+    /// @return 'true' iff the digital set operations on \a P should use
+    /// a bitset over the box [lo,up] rather than a hash set.
+    template <typename Point>
+    bool useDigitalBitset( const std::set<Point> & P, Point & lo, Point & up )
+    {
+      lo = up = *P.begin();
+      for ( typename std::set<Point>::const_iterator it = P.begin(), itend = P.end();
+            it != itend; ++it )
+        {
+          lo = lo.inf( *it );
+          up = up.sup( *it );
+        }
+      lo -= Point::diagonal( 1 );
+      up += Point::diagonal( 1 );
+      // A node of std::set<Point> takes several hundred bits.
+      return DigitalBitset<Point>::size( lo, up ) <= 256.0 * P.size() + 65536.0;
+    }
+
+    template <typename Point>
+    struct AlwaysInside {
+      bool operator()( const Point & ) const { return true; }
+    };
+
+    template <typename Word>
+    Word digitalSetAndNot( Word a, Word b ) { return a & ~b; }
+
+    /**
+       Border (\a border == true) or non-interior points (\a border ==
+       false) of \a P, restricted to the points p with inDomain( p ).
+    */
+    template <typename Space, typename InDomain>
+    void digitalSetBorder( std::set< typename Space::Point > & Q,
+                           const std::set< typename Space::Point > & P,
+                           const InDomain & inDomain, bool border )
+    {
+      typedef typename Space::Point Point;
+      typedef HyperRectDomain< Space > LocalDomain;
+      typedef typename LocalDomain::ConstIterator LocalDomainConstIterator;
+      typedef typename DigitalBitset<Point>::Word Word;
+      Q.clear();
+      if ( P.empty() ) return;
+      Point lo, up;
+      if ( useDigitalBitset( P, lo, up ) )
+        {
+          DigitalBitset<Point> B( lo, up );
+          for ( typename std::set<Point>::const_iterator it = P.begin(), itend = P.end();
+                it != itend; ++it )
+            B.set( *it );
+          DigitalBitset<Point> N( B );
+          if ( border ) // Q = ( P + cube ) \ P
+            {
+              N.morphology( false );
+              B.extract( Q, N, B, digitalSetAndNot<Word>, inDomain );
+            }
+          else // Q = P \ ( ( P U ~domain ) - cube )
+            {
+              N.setIf( [ &inDomain ] ( const Point & p ) { return ! inDomain( p ); } );
+              N.morphology( true );
+              B.extract( Q, B, N, digitalSetAndNot<Word>, AlwaysInside<Point>() );
+            }
+          return;
+        }
+      // Sparse input: same scan of the surroundings with hashed lookups.
+      std::unordered_set< Point, DigitalPointHash<Point> > H( P.begin(), P.end() );
+      Point d1 = Point::diagonal( 1 );
+      for ( typename std::set<Point>::const_iterator it = P.begin(), itend = P.end();
+            it != itend; ++it )
+        {
+          LocalDomain localDomain( *it - d1, *it + d1 );
+          bool inside = true;
+          for ( LocalDomainConstIterator itd = localDomain.begin(), itdend = localDomain.end();
+                itd != itdend; ++itd )
+            {
+              Point p = *itd;
+              if ( H.find( p ) != H.end() || ! inDomain( p ) ) continue;
+              if ( border ) Q.insert( p );
+              else inside = false;
+            }
+          if ( ! border && ! inside ) Q.insert( *it );
+        }
+    }
+  }
+
   /**
      Given a set of points \a P, computes the set of \f$ Z^d \setminus P \f$ that touches P.
+
+     When P is dense in its bounding box, the computation is done on a
+     bitset, otherwise on a hash set.
   */
   template <typename Space>
-  void computeBorder( std::set< typename Space::Point > & Q, 
+  void computeBorder( std::set< typename Space::Point > & Q,
                       const std::set< typename Space::Point > & P )
   {
     typedef typename Space::Point Point;
-    typedef typename std::set< Point > PointSet;
-    typedef typename std::set< Point >::const_iterator PointSetConstIterator;
-    typedef typename Point::UnsignedComponent Size;
-    typedef HyperRectDomain< Space > Domain;
-    typedef typename Domain::ConstIterator DomainConstIterator;
-    Point d1 = Point::diagonal( 1 );
-    Q.clear();
-    // Scan surroundings of all points of P.
-    for ( PointSetConstIterator it = P.begin(), itend = P.end(); 
-          it != itend; ++it )
-      {
-        Domain localDomain( *it - d1, *it + d1 );
-        for ( DomainConstIterator itd = localDomain.begin(), itdend = localDomain.end();
-              itd != itdend; ++itd )
-          {
-            Point p = *itd;
-            if ( P.find( p ) == P.end() ) Q.insert( p );
-          }
-      }
+    detail::digitalSetBorder<Space>( Q, P, detail::AlwaysInside<Point>(), true );
   }
 
   /**
      Given a set of points \a P, computes the set of \f$ Z^d \setminus P \f$ that touches P.
   */
   template <typename Space, typename Domain>
-  void computeBorderInDomain( std::set< typename Space::Point > & Q, 
-                              const std::set< typename Space::Point > & P, 
+  void computeBorderInDomain( std::set< typename Space::Point > & Q,
+                              const std::set< typename Space::Point > & P,
                               const Domain & domain )
   {
     typedef typename Space::Point Point;
-    typedef typename std::set< Point > PointSet;
-    typedef typename std::set< Point >::const_iterator PointSetConstIterator;
-    typedef typename Point::UnsignedComponent Size;
-    typedef HyperRectDomain< Space > LocalDomain;
-    typedef typename LocalDomain::ConstIterator LocalDomainConstIterator;
-    Point d1 = Point::diagonal( 1 );
-    Q.clear();
-    // Scan surroundings of all points of P.
-    for ( PointSetConstIterator it = P.begin(), itend = P.end(); 
-          it != itend; ++it )
-      {
-        LocalDomain localDomain( *it - d1, *it + d1 );
-        for ( LocalDomainConstIterator itd = localDomain.begin(), itdend = localDomain.end();
-              itd != itdend; ++itd )
-          {
-            Point p = *itd;
-            if ( ( P.find( p ) == P.end() ) 
-                 && domain.isInside( p ) ) 
-              Q.insert( p );
-          }
-      }
+    detail::digitalSetBorder<Space>
+      ( Q, P, [ &domain ] ( const Point & p ) { return domain.isInside( p ); }, true );
   }
 
   /**
      Given a set of points \a P, computes the set of \f$ Z^d \setminus P \f$ that touches P.
   */
   template <typename Space>
-  void removeInside( std::set< typename Space::Point > & Q, 
+  void removeInside( std::set< typename Space::Point > & Q,
                      const std::set< typename Space::Point > & P )
   {
     typedef typename Space::Point Point;
-    typedef typename std::set< Point > PointSet;
-    typedef typename std::set< Point >::const_iterator PointSetConstIterator;
-    typedef typename Point::UnsignedComponent Size;
-    typedef HyperRectDomain< Space > Domain;
-    typedef typename Domain::ConstIterator DomainConstIterator;
-    Point d1 = Point::diagonal( 1 );
-    Q.clear();
-    // Scan surroundings of all points of P.
-    for ( PointSetConstIterator it = P.begin(), itend = P.end(); 
-          it != itend; ++it )
-      {
-        Domain localDomain( *it - d1, *it + d1 );
-        unsigned int n = 0;
-        for ( DomainConstIterator itd = localDomain.begin(), itdend = localDomain.end();
-              itd != itdend; ++itd )
-          {
-            Point p = *itd;
-            if ( P.find( p ) != P.end() ) ++n;
-          }
-        if ( n != localDomain.size() ) Q.insert( *it );
-      }
+    detail::digitalSetBorder<Space>( Q, P, detail::AlwaysInside<Point>(), false );
   }
 
   /**
      Given a set of points \a P, computes the set of \f$ Z^d \setminus P \f$ that touches P.
   */
   template <typename Space, typename Domain>
-  void removeInsideInDomain( std::set< typename Space::Point > & Q, 
+  void removeInsideInDomain( std::set< typename Space::Point > & Q,
                              const std::set< typename Space::Point > & P,
                              const Domain & domain )
   {
     typedef typename Space::Point Point;
-    typedef typename std::set< Point > PointSet;
-    typedef typename std::set< Point >::const_iterator PointSetConstIterator;
-    typedef typename Point::UnsignedComponent Size;
-    typedef HyperRectDomain< Space > LocalDomain;
-    typedef typename LocalDomain::ConstIterator LocalDomainConstIterator;
-    Point d1 = Point::diagonal( 1 );
-    Q.clear();
-    // Scan surroundings of all points of P.
-    for ( PointSetConstIterator it = P.begin(), itend = P.end(); 
-          it != itend; ++it )
-      {
-        LocalDomain localDomain( *it - d1, *it + d1 );
-        unsigned int n = 0, nd = 0;
-        for ( LocalDomainConstIterator itd = localDomain.begin(), itdend = localDomain.end();
-              itd != itdend; ++itd )
-          {
-            Point p = *itd;
-            if ( domain.isInside( p ) )
-              {
-                ++nd;
-                if ( P.find( p ) != P.end() ) ++n;
-              }
-          }
-        if ( n != nd ) Q.insert( *it );
-      }
+    detail::digitalSetBorder<Space>
+      ( Q, P, [ &domain ] ( const Point & p ) { return domain.isInside( p ); }, false );
   }
 
 }
@@ -46,6 +46,7 @@
 #include <DGtal/kernel/CSpace.h>
 #include <DGtal/helpers/StdDefs.h>
 #include "BezierTriangle2.h"
+#include "ImageWriter.h"
 #include "cairo.h"
 
 //////////////////////////////////////////////////////////////////////////////
@@ -96,6 +97,8 @@ namespace DGtal
     double _st;        ///< discontinuity stiffness.
     double _am;        ///< discontinuity amplitude.
     double _s0, _sm, _s1; ///< precomputed abscissae from stiffness.
+    int _png_level;    ///< zlib compression level of PNG outputs.
+    bool _async;       ///< when 'true', outputs are written in the background.
 
   public:
     /**
@@ -112,7 +115,8 @@ namespace DGtal
 	_width( round( (x1-x0) * xfactor + 1 ) ),
 	_height(round( (y1-y0) * xfactor + 1 ) ),
 	_xf( xfactor ), _yf( yfactor ), _shading( shading ),
-	_color( color ), _st( disc_stiffness ), _am( disc_amplitude )
+	_color( color ), _st( disc_stiffness ), _am( disc_amplitude ),
+	_png_level( -1 ), _async( false )
     {
       _surface = cairo_image_surface_create( CAIRO_FORMAT_ARGB32,
 					     _width, _height );
@@ -142,31 +146,69 @@ namespace DGtal
       cairo_set_line_join( _cr, CAIRO_LINE_JOIN_BEVEL );
     }
 
+    /// Sets the zlib compression level of PNG outputs (0-9, -1 is
+    /// default) and tells if outputs are written by a background
+    /// thread (see ImageWriter). By default, outputs are written
+    /// synchronously.
+    void setOutput( int png_level, bool async = true )
+    {
+      _png_level = png_level;
+      _async     = async;
+    }
+
+    /// @return a copy of the current drawing as an RGBA image.
+    RGBAImage image() const
+    {
+      cairo_surface_flush( _surface );
+      const unsigned char* data = cairo_image_surface_get_data( _surface );
+      const int          stride = cairo_image_surface_get_stride( _surface );
+      RGBAImage img( _width, _height );
+      for ( int y = 0; y < _height; ++y ) {
+	const uint32_t* src = (const uint32_t*) ( data + y * stride );
+	unsigned char*  dst = img.row( y );
+	for ( int x = 0; x < _width; ++x, dst += 4 ) {
+	  const uint32_t argb = src[ x ];
+	  const uint32_t    a = argb >> 24;
+	  uint32_t rgb[ 3 ] = { ( argb >> 16 ) & 0xff, ( argb >> 8 ) & 0xff, argb & 0xff };
+	  if ( a != 0 && a != 255 ) // cairo stores premultiplied alpha.
+	    for ( int m = 0; m < 3; ++m ) rgb[ m ] = ( rgb[ m ] * 255 + a / 2 ) / a;
+	  dst[ 0 ] = rgb[ 0 ]; dst[ 1 ] = rgb[ 1 ]; dst[ 2 ] = rgb[ 2 ]; dst[ 3 ] = a;
+	}
+      }
+      return img;
+    }
+
+    /// Saves the drawing as PNG, PPM or PAM according to the extension
+    /// of \a file_name. Asynchronous writes (see setOutput) are
+    /// completed at the latest when the process exits.
     void save( const char* file_name ) const
     {
-      cairo_surface_write_to_png( _surface, file_name );
+      if ( _async )
+	ImageWriter::instance().writeAsync( file_name, image(), _png_level );
+      else
+	ImageWriter::write( file_name, image(), _png_level );
     }
 
     inline double i( double x ) const
     {
       //return ( (x+0.5) * _xf ) - _x0;
       // Avoids bad approximations around 1/(_xf*_yf) pixels
-      return x * _xf - _x0 + 0.5;
+      return ( x - _x0 ) * _xf + 0.5;
     }
     inline double x( double i ) const
     {
-      return ( i - 0.5 + _x0 ) / _xf;
+      return ( i - 0.5 ) / _xf + _x0;
     }
     
     inline double j( double y ) const
     {
       //return _height - (( (y+0.5) * _yf ) - _y0) - 1;
       // Avoids bad approximations around 1/(_xf*_yf) pixels
-      return _height - ( y * _yf - _y0) - 0.5;
+      return _height - ( y - _y0 ) * _yf - 0.5;
     }
     inline double y( double j ) const
     {
-      return ( _height + _y0 - j - 0.5 ) / _yf;
+      return ( _height - j - 0.5 ) / _yf + _y0;
     }
 
     inline RealPoint ij( RealPoint a_xy ) const
@@ -179,131 +221,155 @@ namespace DGtal
       return RealPoint( x( a_ij[ 0 ] ), y( a_ij[ 1 ] ) );
     }
     
+    /// The geometric terms of a triangle that are shared by the
+    /// linear gradients of all its channels.
+    struct GradientTriangle {
+      RealPoint   pts[ 3 ]; ///< the vertices
+      RealPoint   ijs[ 3 ]; ///< the vertices in image coordinates
+      RealVector3 gx, gy;   ///< the gradient of values V is ( V.gx, V.gy )
+    };
+
+    /// The linear gradient of one channel over a triangle.
+    struct LinearGradient {
+      bool      linear;     ///< 'false' iff the channel is drawn flat.
+      RealPoint s, e;       ///< start and end points in image coordinates
+      Scalar    t;          ///< abscissa of the middle stop (in 0..1)
+      Scalar    gs, gm, ge; ///< values at start, middle and end stops
+    };
+
+    /// Computes the terms of triangle abc shared by all its channels.
+    void setupGradientTriangle( RealPoint a, RealPoint b, RealPoint c,
+				GradientTriangle& T ) const
+    {
+      const RealVector3 One = RealVector3::diagonal( 1 );
+      const RealVector3   X = RealVector3( a[ 0 ], b[ 0 ], c[ 0 ] );
+      const RealVector3   Y = RealVector3( a[ 1 ], b[ 1 ], c[ 1 ] );
+      // (V x Y).1 = V.(Y x 1) and (X x V).1 = V.(1 x X)
+      T.gx = Y.crossProduct( One );
+      T.gy = One.crossProduct( X );
+      T.pts[ 0 ] = a;       T.pts[ 1 ] = b;       T.pts[ 2 ] = c;
+      T.ijs[ 0 ] = ij( a ); T.ijs[ 1 ] = ij( b ); T.ijs[ 2 ] = ij( c );
+    }
+
+    /// Computes the linear gradient of values V over triangle T. A
+    /// constant or degenerate gradient gives a flat gradient of the
+    /// mean value.
+    void computeLinearGradient( const GradientTriangle& T, const RealVector3& V,
+				LinearGradient& G ) const
+    {
+      const RealPoint Gr = RealPoint( V.dot( T.gx ), V.dot( T.gy ) );
+      Scalar  td[ 3 ] = { Gr.dot( T.pts[ 0 ] ), Gr.dot( T.pts[ 1 ] ),
+			  Gr.dot( T.pts[ 2 ] ) };
+      const int middle[3][3] = { { -1, 2, 1 }, { 2, -1, 0 }, { 1, 0, -1 } }; 
+      int m = ( td[0] < td[1] ) ? ( ( td[0] < td[2] ) ? 0 : 2 ) : ( td[1] < td[2] ? 1 : 2 );
+      int M = ( td[0] >= td[1] ) ? ( ( td[0] >= td[2] ) ? 0 : 2 ) : ( td[1] >= td[2] ? 1 : 2 );
+      int k = ( m == M ) ? -1 : middle[ m ][ M ];
+      if ( ( k == -1 ) || ( td[ m ] == td[ M ] ) ) {
+	G.linear = false;
+	G.gs = G.gm = G.ge = ( V[ 0 ] + V[ 1 ] + V[ 2 ] ) / 3.0;
+	G.s  = G.e = T.ijs[ 0 ];
+	G.t  = 0.0;
+	return;
+      }
+      // Gr is not normalized: the projections on Ur are td / |Gr|, and
+      // the image of the projection of pts[ M ] is an affine function of
+      // pts, hence of ijs.
+      const Scalar   l2 = Gr.dot( Gr );
+      const RealPoint d = ( ( td[ M ] - td[ m ] ) / l2 ) * Gr;
+      G.linear = true;
+      G.s  = T.ijs[ m ];
+      G.e  = ij( T.pts[ m ] + d );
+      G.t  = ( td[ k ] - td[ m ] ) / ( td[ M ] - td[ m ] );
+      G.gs = V[ m ];
+      G.gm = V[ k ];
+      G.ge = V[ M ];
+    }
+
     bool computeLinearGradient( RealPoint a, RealPoint b, RealPoint c,
 				RealVector3 V,
 				RealPoint& s, RealPoint& mid, RealPoint& e,
 				Scalar& gs, Scalar& gmid, Scalar& ge )
     {
-      const RealVector3 One = RealVector3::diagonal( 1 );
-      const RealVector3   X = RealVector3( a[ 0 ], b[ 0 ], c[ 0 ] );
-      const RealVector3   Y = RealVector3( a[ 1 ], b[ 1 ], c[ 1 ] );
-      const RealPoint    Gr = RealPoint( V.crossProduct( Y ).dot( One ),
-					 X.crossProduct( V ).dot( One ) );
-      if ( Gr == RealPoint::zero ) {
-	s   = ij( a );	mid = ij( b );	e   = ij( c );
-	gs  = V[ 0 ];	gmid= V[ 1 ];	ge  = V[ 2 ];
-	return false;
+      GradientTriangle T;
+      LinearGradient   G;
+      setupGradientTriangle( a, b, c, T );
+      computeLinearGradient( T, V, G );
+      s    = G.s;
+      e    = G.e;
+      mid  = s + G.t * ( e - s );
+      gs   = G.gs;
+      gmid = G.gm;
+      ge   = G.ge;
+      return G.linear;
+    }
+
+    /// Fills (or preserves) the current path with gradient G, whose
+    /// values are multiplied by \a rgb to get the color. The middle
+    /// stop is at G.t, or at the discontinuity stops if \a stiff.
+    void fillLinearGradient( const LinearGradient& G, const RealVector3& rgb,
+			     bool stiff, bool preserve )
+    {
+      if ( G.linear ) {
+	cairo_pattern_t* pat
+	  = cairo_pattern_create_linear( G.s[ 0 ], G.s[ 1 ], G.e[ 0 ], G.e[ 1 ] );
+	addColorStop( pat, 0.0, G.gs, rgb );
+	if ( stiff ) {
+	  addColorStop( pat, _s0, disY0( G.gs, G.ge ), rgb );
+	  addColorStop( pat, _sm, disYm( G.gs, G.ge ), rgb );
+	  addColorStop( pat, _s1, disY1( G.gs, G.ge ), rgb );
+	} else
+	  addColorStop( pat, G.t, G.gm, rgb );
+	addColorStop( pat, 1.0, G.ge, rgb );
+	cairo_set_source( _cr, pat );
+	if ( preserve ) cairo_fill_preserve( _cr ); else cairo_fill( _cr );
+	cairo_pattern_destroy( pat );
+      } else {
+	cairo_set_source_rgb( _cr, G.gs * rgb[ 0 ], G.gs * rgb[ 1 ], G.gs * rgb[ 2 ] );
+	if ( preserve ) cairo_fill_preserve( _cr ); else cairo_fill( _cr );
       }
-      const RealPoint Ur = Gr.getNormalized();
-      const Scalar    da = Ur.dot( a );
-      const Scalar    db = Ur.dot( b );
-      const Scalar    dc = Ur.dot( c );
-      Scalar td[ 3 ] = { da, db, dc };
-      const int middle[3][3] = { { -1, 2, 1 }, { 2, -1, 0 }, { 1, 0, -1 } }; 
-      int m = ( da < db ) ? ( ( da < dc ) ? 0 : 2 ) : ( db < dc ? 1 : 2 );
-      int M = ( da >= db ) ? ( ( da >= dc ) ? 0 : 2 ) : ( db >= dc ? 1 : 2 );
-      int k = middle[ m ][ M ];
-      if ( ( k == -1 ) || ( td[ m ] == td[ M ] ) )
-	trace.error() << "Invalid mid m=" << m << " k=" << k << " M=" << M
-		      << " da=" << da << " db=" << db << " dc=" << dc
-		      << " X=" << X << "Y=" << Y << " V=" << V
-		      << " Gr=" << Gr << " Ur=" << Ur
-		      << std::endl;
-      const RealPoint pts[ 3 ] = { a, b, c };
-      const RealPoint d1( pts[ m ] );
-      s    = RealPoint( i( d1[ 0 ] ), j( d1[ 1 ] ) );
-      gs   = V[ m ];
-      const RealPoint d2( pts[ m ] + ( pts[ k ] - pts[ m ] ).dot( Ur ) * Ur );
-      mid  = RealPoint( i( d2[ 0 ] ), j( d2[ 1 ] ) );
-      gmid = V[ k ];
-      const RealPoint d3( pts[ m ] + ( pts[ M ] - pts[ m ] ).dot( Ur ) * Ur );
-      e    = RealPoint( i( d3[ 0 ] ), j( d3[ 1 ] ) );
-      ge   = V[ M ];
-      return true;
     }
 
-    void drawLinearGradientTriangle( RealPoint a, RealPoint b, RealPoint c, 
-				     Value val_a, Value val_b, Value val_c ) 
+    void addColorStop( cairo_pattern_t* pat, Scalar offset, Scalar val,
+		       const RealVector3& rgb )
     {
-      RealPoint s, m, e;
-      Scalar  gs, gm, ge;
-      Scalar  t;
-      cairo_pattern_t *pat;
+      cairo_pattern_add_color_stop_rgb( pat, offset,
+					val * rgb[ 0 ], val * rgb[ 1 ], val * rgb[ 2 ] );
+    }
+
+    /// Draws the triangle with one linear gradient per channel (or a
+    /// gray-level one), using discontinuity stops if \a stiff.
+    void drawGradientTriangle( RealPoint a, RealPoint b, RealPoint c, 
+			       Value val_a, Value val_b, Value val_c,
+			       bool stiff )
+    {
+      GradientTriangle T;
+      LinearGradient   G;
+      setupGradientTriangle( a, b, c, T );
+      // Draw path
+      cairo_move_to( _cr, T.ijs[ 0 ][ 0 ], T.ijs[ 0 ][ 1 ] );
+      cairo_line_to( _cr, T.ijs[ 1 ][ 0 ], T.ijs[ 1 ][ 1 ] );
+      cairo_line_to( _cr, T.ijs[ 2 ][ 0 ], T.ijs[ 2 ][ 1 ] );
+      cairo_close_path( _cr );
       if ( _color ) {
-	const RealVector3 Vr = Value( val_a[ 0 ], val_b[ 0 ], val_c[ 0 ] );
-	const RealVector3 Vg = Value( val_a[ 1 ], val_b[ 1 ], val_c[ 1 ] );
-	const RealVector3 Vb = Value( val_a[ 2 ], val_b[ 2 ], val_c[ 2 ] );
-	// Draw path
-	cairo_move_to( _cr, i( a[ 0 ] ), j( a[ 1 ] ) );
-	cairo_line_to( _cr, i( b[ 0 ] ), j( b[ 1 ] ) );
-	cairo_line_to( _cr, i( c[ 0 ] ), j( c[ 1 ] ) );
-	cairo_close_path( _cr );
-	// Draw red
-	if ( computeLinearGradient( a, b, c, Vr, s, m, e, gs, gm, ge ) ) {
-	  pat = cairo_pattern_create_linear(s[0],s[1],e[0],e[1]);
-	  t = (m-s).norm() / (e-s).norm();
-	  cairo_pattern_add_color_stop_rgb (pat, 0, gs * _redf, 0, 0);
-	  cairo_pattern_add_color_stop_rgb (pat, t, gm * _redf, 0, 0);
-	  cairo_pattern_add_color_stop_rgb (pat, 1, ge * _redf, 0, 0);
-	  cairo_set_source( _cr, pat );
-	  cairo_fill_preserve( _cr );
-	  cairo_pattern_destroy( pat );
-	} else {
-	  cairo_set_source_rgb( _cr, gs * _redf, 0, 0 );
-	  cairo_fill_preserve( _cr );
-	}
-	// Draw green
-	if ( computeLinearGradient( a, b, c, Vg, s, m, e, gs, gm, ge ) ) {
-	  pat = cairo_pattern_create_linear(s[0],s[1],e[0],e[1]);
-	  t = (m-s).norm() / (e-s).norm();
-	  cairo_pattern_add_color_stop_rgb (pat, 0, 0, gs * _greenf, 0);
-	  cairo_pattern_add_color_stop_rgb (pat, t, 0, gm * _greenf, 0);
-	  cairo_pattern_add_color_stop_rgb (pat, 1, 0, ge * _greenf, 0);
-	  cairo_set_source( _cr, pat );
-	  cairo_fill_preserve( _cr );
-	  cairo_pattern_destroy( pat );
-	} else {
-	  cairo_set_source_rgb( _cr, 0, gs * _greenf, 0 );
-	  cairo_fill_preserve( _cr );
-	}
-	// Draw blue
-	if ( computeLinearGradient( a, b, c, Vb, s, m, e, gs, gm, ge ) ) {
-	  pat = cairo_pattern_create_linear(s[0],s[1],e[0],e[1]);
-	  t = (m-s).norm() / (e-s).norm();
-	  cairo_pattern_add_color_stop_rgb (pat, 0, 0, 0, gs * _bluef );
-	  cairo_pattern_add_color_stop_rgb (pat, t, 0, 0, gm * _bluef );
-	  cairo_pattern_add_color_stop_rgb (pat, 1, 0, 0, ge * _bluef );
-	  cairo_set_source( _cr, pat );
-	  cairo_fill( _cr );
-	  cairo_pattern_destroy( pat );
-	} else {
-	  cairo_set_source_rgb( _cr, 0, 0, gs * _bluef );
-	  cairo_fill( _cr );
+	const RealVector3 rgb[ 3 ] = { RealVector3( _redf, 0, 0 ),
+				       RealVector3( 0, _greenf, 0 ),
+				       RealVector3( 0, 0, _bluef ) };
+	for ( int m = 0; m < 3; ++m ) {
+	  computeLinearGradient( T, RealVector3( val_a[ m ], val_b[ m ], val_c[ m ] ), G );
+	  fillLinearGradient( G, rgb[ m ], stiff, m < 2 );
 	}
       } else { // monochrome
-	const Value  Vm = Value( val_a[ 0 ], val_b[ 0 ], val_c[ 0 ] );
-	// Draw path
-	cairo_move_to( _cr, i( a[ 0 ] ), j( a[ 1 ] ) );
-	cairo_line_to( _cr, i( b[ 0 ] ), j( b[ 1 ] ) );
-	cairo_line_to( _cr, i( c[ 0 ] ), j( c[ 1 ] ) );
-	cairo_close_path( _cr );
-	// Draw gray-level
-	if ( computeLinearGradient( a, b, c, Vm, s, m, e, gs, gm, ge ) ) {
-	  pat = cairo_pattern_create_linear(s[0],s[1],e[0],e[1]);
-	  t = (m-s).norm() / (e-s).norm();
-	  cairo_pattern_add_color_stop_rgb (pat, 0, gs * _redf, gs * _greenf, gs * _bluef );
-	  cairo_pattern_add_color_stop_rgb (pat, t, gm * _redf, gm * _greenf, gm * _bluef );
-	  cairo_pattern_add_color_stop_rgb (pat, 1, ge * _redf, ge * _greenf, ge * _bluef );
-	  cairo_set_source( _cr, pat );
-	  cairo_fill( _cr );
-	  cairo_pattern_destroy( pat );
-	} else {
-	  cairo_set_source_rgb( _cr, gs * _redf, gs * _greenf, gs * _bluef );
-	  cairo_fill( _cr );
-	}
+	computeLinearGradient( T, RealVector3( val_a[ 0 ], val_b[ 0 ], val_c[ 0 ] ), G );
+	fillLinearGradient( G, RealVector3( _redf, _greenf, _bluef ), stiff, false );
       }
     }
 
+    void drawLinearGradientTriangle( RealPoint a, RealPoint b, RealPoint c, 
+				     Value val_a, Value val_b, Value val_c ) 
+    {
+      drawGradientTriangle( a, b, c, val_a, val_b, val_c, false );
+    }
+
     double disY0( double gs, double ge ) const {
       return std::max( 0.0, std::min( 255.0, _am * gs + (1.0 - _am ) * ge ) );
     }
@@ -317,87 +383,9 @@ namespace DGtal
     void drawNonLinearGradientTriangle( RealPoint a, RealPoint b, RealPoint c, 
 					Value val_a, Value val_b, Value val_c )
     {
-      RealPoint s, m, e;
-      Scalar  gs, gm, ge;
-      cairo_pattern_t *pat;
-      if ( _color ) {
-	const Value  Vr = Value( val_a[ 0 ], val_b[ 0 ], val_c[ 0 ] );
-	const Value  Vg = Value( val_a[ 1 ], val_b[ 1 ], val_c[ 1 ] );
-	const Value  Vb = Value( val_a[ 2 ], val_b[ 2 ], val_c[ 2 ] );
-	// Draw path
-	cairo_move_to( _cr, i( a[ 0 ] ), j( a[ 1 ] ) );
-	cairo_line_to( _cr, i( b[ 0 ] ), j( b[ 1 ] ) );
-	cairo_line_to( _cr, i( c[ 0 ] ), j( c[ 1 ] ) );
-	cairo_close_path( _cr );
-	// Draw red
-	if ( computeLinearGradient( a, b, c, Vr, s, m, e, gs, gm, ge ) ) {
-	  pat = cairo_pattern_create_linear(s[0],s[1],e[0],e[1]);
-	  cairo_pattern_add_color_stop_rgb (pat, 0.0, gs           * _redf, 0, 0);
-	  cairo_pattern_add_color_stop_rgb (pat, _s0, disY0(gs,ge) * _redf, 0, 0);
-	  cairo_pattern_add_color_stop_rgb (pat, _sm, disYm(gs,ge) * _redf, 0, 0);
-	  cairo_pattern_add_color_stop_rgb (pat, _s1, disY1(gs,ge) * _redf, 0, 0);
-	  cairo_pattern_add_color_stop_rgb (pat, 1.0, ge           * _redf, 0, 0);
-	  cairo_set_source( _cr, pat );
-	  cairo_fill_preserve( _cr );
-	  cairo_pattern_destroy( pat );
-	} else {
-	  cairo_set_source_rgb( _cr, gs * _redf, 0, 0 );
-	  cairo_fill_preserve( _cr );
-	}
-	// Draw green
-	if ( computeLinearGradient( a, b, c, Vg, s, m, e, gs, gm, ge ) ) {
-	  pat = cairo_pattern_create_linear(s[0],s[1],e[0],e[1]);
-	  cairo_pattern_add_color_stop_rgb (pat, 0.0, 0, gs           * _greenf, 0);
-	  cairo_pattern_add_color_stop_rgb (pat, _s0, 0, disY0(gs,ge) * _greenf, 0);
-	  cairo_pattern_add_color_stop_rgb (pat, _sm, 0, disYm(gs,ge) * _greenf, 0);
-	  cairo_pattern_add_color_stop_rgb (pat, _s1, 0, disY1(gs,ge) * _greenf, 0);
-	  cairo_pattern_add_color_stop_rgb (pat, 1.0, 0, ge           * _greenf, 0);
-	  cairo_set_source( _cr, pat );
-	  cairo_fill_preserve( _cr );
-	  cairo_pattern_destroy( pat );
-	} else {
-	  cairo_set_source_rgb( _cr, 0, gs * _greenf, 0 );
-	  cairo_fill_preserve( _cr );
-	}
-	// Draw blue
-	if ( computeLinearGradient( a, b, c, Vb, s, m, e, gs, gm, ge ) ) {
-	  pat = cairo_pattern_create_linear(s[0],s[1],e[0],e[1]);
-	  cairo_pattern_add_color_stop_rgb (pat, 0.0, 0, 0, gs           * _bluef );
-	  cairo_pattern_add_color_stop_rgb (pat, _s0, 0, 0, disY0(gs,ge) * _bluef );
-	  cairo_pattern_add_color_stop_rgb (pat, _sm, 0, 0, disYm(gs,ge) * _bluef );
-	  cairo_pattern_add_color_stop_rgb (pat, _s1, 0, 0, disY1(gs,ge) * _bluef );
-	  cairo_pattern_add_color_stop_rgb (pat, 1.0, 0, 0, ge           * _bluef );
-	  cairo_set_source( _cr, pat );
-	  cairo_fill( _cr );
-	  cairo_pattern_destroy( pat );
-	} else {
-	  cairo_set_source_rgb( _cr, 0, 0, gs * _bluef );
-	  cairo_fill( _cr );
-	}
-      } else { // monochrome
-	const Value  Vm = Value( val_a[ 0 ], val_b[ 0 ], val_c[ 0 ] );
-	// Draw path
-	cairo_move_to( _cr, i( a[ 0 ] ), j( a[ 1 ] ) );
-	cairo_line_to( _cr, i( b[ 0 ] ), j( b[ 1 ] ) );
-	cairo_line_to( _cr, i( c[ 0 ] ), j( c[ 1 ] ) );
-	cairo_close_path( _cr );
-	// Draw gray-level
-	if ( computeLinearGradient( a, b, c, Vm, s, m, e, gs, gm, ge ) ) {
-	  pat = cairo_pattern_create_linear(s[0],s[1],e[0],e[1]);
-	  cairo_pattern_add_color_stop_rgb(pat, 0.0, gs * _redf, gs * _greenf, gs * _bluef );
-	  cairo_pattern_add_color_stop_rgb (pat, _s0, disY0(gs,ge) * _redf, disY0(gs,ge) * _greenf, disY0(gs,ge) * _bluef );
-	  cairo_pattern_add_color_stop_rgb (pat, _sm, disYm(gs,ge) * _redf, disYm(gs,ge) * _greenf, disYm(gs,ge) * _bluef );
-	  cairo_pattern_add_color_stop_rgb (pat, _s1, disY1(gs,ge) * _redf, disY1(gs,ge) * _greenf, disY1(gs,ge) * _bluef);
-	  cairo_pattern_add_color_stop_rgb (pat, 1.0, ge * _redf, ge * _greenf, ge * _bluef );
-	  cairo_set_source( _cr, pat );
-	  cairo_fill( _cr );
-	  cairo_pattern_destroy( pat );
-	} else {
-	  cairo_set_source_rgb( _cr, gs * _redf, gs * _greenf, gs * _bluef );
-	  cairo_fill( _cr );
-	}
-      }
+      drawGradientTriangle( a, b, c, val_a, val_b, val_c, true );
     }
+
     void drawGouraudTriangle( RealPoint a, RealPoint b, RealPoint c, 
 			      Value val_a, Value val_b, Value val_c ) 
     {
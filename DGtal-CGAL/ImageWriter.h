@@ -0,0 +1,292 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **/
+
+#pragma once
+
+/**
+ * @file ImageWriter.h
+ * @author Jacques-Olivier Lachaud (\c jacques-olivier.lachaud@univ-savoie.fr )
+ * Laboratory of Mathematics (CNRS, UMR 5807), University of Savoie, France
+ *
+ * @date 2018/02/12
+ *
+ * Header file for module ImageWriter.cpp
+ *
+ * This file is part of the DGtal library.
+ */
+
+#if defined(ImageWriter_RECURSES)
+#error Recursive header files inclusion detected in ImageWriter.h
+#else // defined(ImageWriter_RECURSES)
+/** Prevents recursive inclusion of headers. */
+#define ImageWriter_RECURSES
+
+#if !defined ImageWriter_h
+/** Prevents repeated inclusion of headers. */
+#define ImageWriter_h
+
+//////////////////////////////////////////////////////////////////////////////
+// Inclusions
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <zlib.h>
+
+//////////////////////////////////////////////////////////////////////////////
+
+namespace DGtal
+{
+
+  /////////////////////////////////////////////////////////////////////////////
+  // struct RGBAImage
+  /**
+     Description of struct 'RGBAImage' <p> \brief Aim: A raw 8-bit
+     RGBA image, stored row by row from top to bottom, that can be
+     written as PNG, PPM or PAM.
+  */
+  struct RGBAImage {
+    int                        width;
+    int                        height;
+    std::vector<unsigned char> data; ///< 4*width*height bytes (r,g,b,a)
+
+    RGBAImage( int w = 0, int h = 0 )
+      : width( w ), height( h ), data( 4 * w * h, 0 ) {}
+    unsigned char* row( int y ) { return &data[ 4 * width * y ]; }
+    const unsigned char* row( int y ) const { return &data[ 4 * width * y ]; }
+  };
+
+  /////////////////////////////////////////////////////////////////////////////
+  // class ImageWriter
+  /**
+     Description of class 'ImageWriter' <p> \brief Aim: Writes
+     RGBAImage in PNG (with a chosen zlib compression level), PPM
+     (binary P6, alpha is dropped) or PAM (binary P7 RGB_ALPHA).
+
+     The format is deduced from the extension of the filename: ".ppm",
+     ".pam", otherwise PNG.
+
+     Writes may be done synchronously (write) or by a background
+     thread (writeAsync) so that the caller can go on with its next
+     rendering. At most MAX_PENDING images wait in the queue:
+     writeAsync blocks when it is full, so that long batch runs do not
+     pile up images in memory. Pending writes are completed by flush()
+     or, at the latest, when the process exits.
+  */
+  class ImageWriter {
+  public:
+    enum Format { PNG, PPM, PAM };
+    /// The maximal number of images waiting to be written.
+    static const std::size_t MAX_PENDING = 4;
+
+    /// @return the format corresponding to the extension of \a fname.
+    static Format format( const std::string& fname )
+    {
+      std::string ext = fname.substr( fname.find_last_of( '.' ) + 1 );
+      if ( ext == "ppm" ) return PPM;
+      if ( ext == "pam" ) return PAM;
+      return PNG;
+    }
+
+    /// Writes \a img in \a fname (format deduced from extension).
+    /// @param level the zlib compression level (0-9, -1 is default) for PNG.
+    /// @return 'true' iff everything went well.
+    static bool write( const std::string& fname, const RGBAImage& img,
+                       int level = -1 )
+    {
+      std::ofstream out( fname.c_str(), std::ios::out | std::ios::binary );
+      if ( ! out.good() ) return false;
+      bool ok = true;
+      switch ( format( fname ) ) {
+      case PPM: writePPM( out, img ); break;
+      case PAM: writePAM( out, img ); break;
+      default:  ok = writePNG( out, img, level );
+      }
+      return ok && out.good();
+    }
+
+    /// Writes binary PPM (P6).
+    static void writePPM( std::ostream& out, const RGBAImage& img )
+    {
+      out << "P6\n" << img.width << " " << img.height << "\n255\n";
+      std::vector<unsigned char> rgb( 3 * img.width );
+      for ( int y = 0; y < img.height; ++y ) {
+        const unsigned char* p = img.row( y );
+        for ( int x = 0; x < img.width; ++x, p += 4 ) {
+          rgb[ 3*x ] = p[ 0 ]; rgb[ 3*x+1 ] = p[ 1 ]; rgb[ 3*x+2 ] = p[ 2 ];
+        }
+        out.write( (const char*) rgb.data(), rgb.size() );
+      }
+    }
+
+    /// Writes binary PAM (P7, RGB_ALPHA).
+    static void writePAM( std::ostream& out, const RGBAImage& img )
+    {
+      out << "P7\nWIDTH " << img.width << "\nHEIGHT " << img.height
+          << "\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n";
+      out.write( (const char*) img.data.data(), img.data.size() );
+    }
+
+    /// Writes a PNG (8-bit RGBA, no filtering) compressed with zlib at
+    /// the given \a level.
+    /// @return 'false' if the compression failed, in which case
+    /// nothing is written.
+    static bool writePNG( std::ostream& out, const RGBAImage& img,
+                          int level = -1 )
+    {
+      // IDAT: each row is preceded by its filter type (0: none).
+      const std::size_t line = 4 * img.width + 1;
+      std::vector<unsigned char> raw( line * img.height );
+      for ( int y = 0; y < img.height; ++y ) {
+        raw[ line * y ] = 0;
+        std::copy( img.row( y ), img.row( y ) + 4 * img.width,
+                   raw.begin() + line * y + 1 );
+      }
+      uLongf size = compressBound( raw.size() );
+      std::vector<unsigned char> idat( size );
+      const int err = compress2( idat.data(), &size, raw.data(), raw.size(), level );
+      if ( err != Z_OK ) {
+        std::cerr << "[ImageWriter] zlib compression failed: "
+                  << zError( err ) << std::endl;
+        return false;
+      }
+      static const unsigned char signature[ 8 ] =
+        { 137, 80, 78, 71, 13, 10, 26, 10 };
+      out.write( (const char*) signature, 8 );
+      // IHDR: size, depth 8, color type 6 (RGBA), no interlace.
+      unsigned char ihdr[ 13 ];
+      putU32( ihdr, img.width );
+      putU32( ihdr + 4, img.height );
+      ihdr[ 8 ] = 8; ihdr[ 9 ] = 6; ihdr[ 10 ] = 0; ihdr[ 11 ] = 0; ihdr[ 12 ] = 0;
+      writeChunk( out, "IHDR", ihdr, 13 );
+      writeChunk( out, "IDAT", idat.data(), size );
+      writeChunk( out, "IEND", 0, 0 );
+      return true;
+    }
+
+    /// @return the writer shared by the whole process.
+    static ImageWriter& instance()
+    {
+      static ImageWriter writer;
+      return writer;
+    }
+
+    /// Queues the writing of \a img in \a fname. The image is written
+    /// by a background thread. Blocks while MAX_PENDING images are
+    /// already waiting.
+    void writeAsync( const std::string& fname, RGBAImage&& img, int level = -1 )
+    {
+      std::unique_lock<std::mutex> lock( _mutex );
+      _cv.wait( lock, [ this ] { return _jobs.size() < MAX_PENDING; } );
+      if ( ! _thread.joinable() )
+        _thread = std::thread( &ImageWriter::run, this );
+      _jobs.push_back( Job{ fname, std::move( img ), level } );
+      _cv.notify_all();
+    }
+
+    /// Waits for all queued writes to be done.
+    void flush()
+    {
+      std::unique_lock<std::mutex> lock( _mutex );
+      _cv.wait( lock, [ this ] { return _jobs.empty() && ! _busy; } );
+    }
+
+    /// Destructor. Completes all pending writes.
+    ~ImageWriter()
+    {
+      {
+        std::unique_lock<std::mutex> lock( _mutex );
+        _stop = true;
+        _cv.notify_all();
+      }
+      if ( _thread.joinable() ) _thread.join();
+    }
+
+  protected:
+    struct Job {
+      std::string fname;
+      RGBAImage   image;
+      int         level;
+    };
+
+    std::mutex              _mutex;
+    std::condition_variable _cv;
+    std::deque<Job>         _jobs;
+    std::thread             _thread;
+    bool                    _busy = false;
+    bool                    _stop = false;
+
+    ImageWriter() {}
+
+    /// The background thread: writes queued images until stopped
+    /// and every job is done.
+    void run()
+    {
+      std::unique_lock<std::mutex> lock( _mutex );
+      while ( true ) {
+        _cv.wait( lock, [ this ] { return _stop || ! _jobs.empty(); } );
+        if ( _jobs.empty() ) break; // stopped and nothing left.
+        Job job = std::move( _jobs.front() );
+        _jobs.pop_front();
+        _busy = true;
+        lock.unlock();
+        if ( ! write( job.fname, job.image, job.level ) )
+          std::cerr << "[ImageWriter] Error writing " << job.fname << std::endl;
+        lock.lock();
+        _busy = false;
+        _cv.notify_all();
+      }
+    }
+
+    static void putU32( unsigned char* p, unsigned long v )
+    {
+      p[ 0 ] = ( v >> 24 ) & 0xff; p[ 1 ] = ( v >> 16 ) & 0xff;
+      p[ 2 ] = ( v >> 8 ) & 0xff;  p[ 3 ] = v & 0xff;
+    }
+
+    static void writeChunk( std::ostream& out, const char* type,
+                            const unsigned char* data, std::size_t size )
+    {
+      unsigned char buf[ 4 ];
+      putU32( buf, size );
+      out.write( (const char*) buf, 4 );
+      out.write( type, 4 );
+      if ( size > 0 ) out.write( (const char*) data, size );
+      uLong crc = crc32( 0L, (const Bytef*) type, 4 );
+      if ( size > 0 ) crc = crc32( crc, data, size );
+      putU32( buf, crc );
+      out.write( (const char*) buf, 4 );
+    }
+
+  }; // end of class ImageWriter
+
+} // namespace DGtal
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Includes inline functions.
+
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // !defined ImageWriter_h
+
+#undef ImageWriter_RECURSES
+#endif // else defined(ImageWriter_RECURSES)
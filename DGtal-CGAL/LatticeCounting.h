@@ -0,0 +1,239 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **/
+
+#pragma once
+
+/**
+ * @file LatticeCounting.h
+ * @author Jacques-Olivier Lachaud (\c jacques-olivier.lachaud@univ-savoie.fr )
+ * Laboratory of Mathematics (CNRS, UMR 5807), University of Savoie, France
+ *
+ * @date 2018/03/05
+ *
+ * Header file for module LatticeCounting.cpp
+ *
+ * This file is part of the DGtal library.
+ */
+
+#if defined(LatticeCounting_RECURSES)
+#error Recursive header files inclusion detected in LatticeCounting.h
+#else // defined(LatticeCounting_RECURSES)
+/** Prevents recursive inclusion of headers. */
+#define LatticeCounting_RECURSES
+
+#if !defined LatticeCounting_h
+/** Prevents repeated inclusion of headers. */
+#define LatticeCounting_h
+
+//////////////////////////////////////////////////////////////////////////////
+// Inclusions
+#include <cstdint>
+#include <algorithm>
+
+//////////////////////////////////////////////////////////////////////////////
+
+namespace DGtal
+{
+
+  /////////////////////////////////////////////////////////////////////////////
+  // struct LatticeCounting
+  /**
+     Description of struct 'LatticeCounting' <p> \brief Aim: Counts
+     the lattice points of lattice triangles and tetrahedra without
+     scanning their bounding box.
+
+     In 2D, counts follow from Pick's theorem \f$ 2A = 2I + B - 2 \f$,
+     where the number B of boundary points is given by the gcd of the
+     coordinates of the edge vectors. In 3D, the tetrahedron is cut
+     into lines parallel to its longest axis: the lattice points of
+     each line form an interval that is computed exactly from the
+     four supporting half-spaces.
+
+     Points are any type with integer coordinates accessible with
+     operator[]. Computations are done with 64-bit integers.
+  */
+  struct LatticeCounting {
+    typedef std::int64_t Integer;
+
+    /// @return the (non-negative) gcd of \a a and \a b.
+    static Integer gcd( Integer a, Integer b )
+    {
+      if ( a < 0 ) a = -a;
+      if ( b < 0 ) b = -b;
+      while ( b != 0 ) { Integer r = a % b; a = b; b = r; }
+      return a;
+    }
+
+    /// @return floor( a / b ), b != 0.
+    static Integer floorDiv( Integer a, Integer b )
+    {
+      Integer q = a / b;
+      return ( ( a % b != 0 ) && ( ( a < 0 ) != ( b < 0 ) ) ) ? q - 1 : q;
+    }
+
+    /// @return ceil( a / b ), b != 0.
+    static Integer ceilDiv( Integer a, Integer b )
+    {
+      Integer q = a / b;
+      return ( ( a % b != 0 ) && ( ( a < 0 ) == ( b < 0 ) ) ) ? q + 1 : q;
+    }
+
+    /// @return twice the signed area of the triangle abc.
+    template <typename Point2>
+    static Integer twiceSignedArea( const Point2 & a, const Point2 & b, const Point2 & c )
+    {
+      return ( (Integer) b[ 0 ] - a[ 0 ] ) * ( (Integer) c[ 1 ] - a[ 1 ] )
+        -    ( (Integer) b[ 1 ] - a[ 1 ] ) * ( (Integer) c[ 0 ] - a[ 0 ] );
+    }
+
+    /// @return the number of lattice points of the segment [ab], \a b excluded.
+    template <typename Point2>
+    static Integer segmentPoints( const Point2 & a, const Point2 & b )
+    {
+      return gcd( (Integer) b[ 0 ] - a[ 0 ], (Integer) b[ 1 ] - a[ 1 ] );
+    }
+
+    /// @return the number of lattice points on the boundary of the
+    /// triangle abc.
+    template <typename Point2>
+    static Integer boundaryPoints( const Point2 & a, const Point2 & b, const Point2 & c )
+    {
+      if ( twiceSignedArea( a, b, c ) == 0 ) // flat: the longest side.
+        return std::max( segmentPoints( a, b ),
+                         std::max( segmentPoints( b, c ), segmentPoints( c, a ) ) ) + 1;
+      return segmentPoints( a, b ) + segmentPoints( b, c ) + segmentPoints( c, a );
+    }
+
+    /// @return the number of lattice points in the interior of the
+    /// triangle abc (Pick's theorem).
+    template <typename Point2>
+    static Integer interiorPoints( const Point2 & a, const Point2 & b, const Point2 & c )
+    {
+      Integer d = twiceSignedArea( a, b, c );
+      if ( d == 0 ) return 0;
+      if ( d < 0 ) d = -d;
+      return ( d - boundaryPoints( a, b, c ) + 2 ) / 2;
+    }
+
+    /// @return the number of lattice points of the closed triangle abc.
+    template <typename Point2>
+    static Integer trianglePoints( const Point2 & a, const Point2 & b, const Point2 & c )
+    {
+      return interiorPoints( a, b, c ) + boundaryPoints( a, b, c );
+    }
+
+    /// @return 'true' iff the only lattice points of the triangle abc
+    /// are its vertices, i.e. iff its area is 1/2.
+    template <typename Point2>
+    static bool isEmptyTriangle( const Point2 & a, const Point2 & b, const Point2 & c )
+    {
+      Integer d = twiceSignedArea( a, b, c );
+      return ( d == 1 ) || ( d == -1 );
+    }
+
+    /**
+       Counts the lattice points of the closed tetrahedron abcd, i.e.
+       the points of its bounding box that lie on the inner side of
+       the planes abc, bcd, cda and dab.
+
+       @param bound if non-negative, the count stops as soon as it
+       exceeds \a bound.
+       @return the number of lattice points, or bound+1 if there are
+       more than \a bound of them.
+    */
+    template <typename Point3>
+    static Integer tetrahedronPoints( const Point3 & a, const Point3 & b,
+                                      const Point3 & c, const Point3 & d,
+                                      Integer bound = -1 )
+    {
+      const Point3* V[ 4 ] = { &a, &b, &c, &d };
+      Integer n[ 4 ][ 3 ], shift[ 4 ], inf[ 3 ], sup[ 3 ];
+      for ( int k = 0; k < 3; ++k )
+        {
+          inf[ k ] = std::min( std::min( (Integer) a[ k ], (Integer) b[ k ] ),
+                               std::min( (Integer) c[ k ], (Integer) d[ k ] ) );
+          sup[ k ] = std::max( std::max( (Integer) a[ k ], (Integer) b[ k ] ),
+                               std::max( (Integer) c[ k ], (Integer) d[ k ] ) );
+        }
+      // Plane i goes through V[i], V[i+1], V[i+2] and is oriented
+      // toward V[i+3].
+      for ( int i = 0; i < 4; ++i )
+        {
+          const Point3 & p = *V[ i ];
+          const Point3 & q = *V[ ( i + 1 ) % 4 ];
+          const Point3 & r = *V[ ( i + 2 ) % 4 ];
+          const Point3 & s = *V[ ( i + 3 ) % 4 ];
+          Integer u[ 3 ], v[ 3 ];
+          for ( int k = 0; k < 3; ++k )
+            {
+              u[ k ] = (Integer) q[ k ] - p[ k ];
+              v[ k ] = (Integer) r[ k ] - q[ k ];
+            }
+          n[ i ][ 0 ] = u[ 1 ] * v[ 2 ] - u[ 2 ] * v[ 1 ];
+          n[ i ][ 1 ] = u[ 2 ] * v[ 0 ] - u[ 0 ] * v[ 2 ];
+          n[ i ][ 2 ] = u[ 0 ] * v[ 1 ] - u[ 1 ] * v[ 0 ];
+          shift[ i ] = dot( n[ i ], p );
+          if ( dot( n[ i ], s ) < shift[ i ] )
+            {
+              for ( int k = 0; k < 3; ++k ) n[ i ][ k ] = -n[ i ][ k ];
+              shift[ i ] = -shift[ i ];
+            }
+        }
+      // Lines are parallel to the longest axis x, and scanned along y and z.
+      int x = 0;
+      for ( int k = 1; k < 3; ++k )
+        if ( sup[ k ] - inf[ k ] > sup[ x ] - inf[ x ] ) x = k;
+      int y = ( x + 1 ) % 3;
+      int z = ( x + 2 ) % 3;
+      Integer nb = 0;
+      for ( Integer pz = inf[ z ]; pz <= sup[ z ]; ++pz )
+        for ( Integer py = inf[ y ]; py <= sup[ y ]; ++py )
+          {
+            Integer lo = inf[ x ], hi = sup[ x ];
+            for ( int i = 0; ( i < 4 ) && ( lo <= hi ); ++i )
+              { // n.x * px >= r
+                Integer r = shift[ i ] - n[ i ][ y ] * py - n[ i ][ z ] * pz;
+                if ( n[ i ][ x ] > 0 )      lo = std::max( lo, ceilDiv( r, n[ i ][ x ] ) );
+                else if ( n[ i ][ x ] < 0 ) hi = std::min( hi, floorDiv( r, n[ i ][ x ] ) );
+                else if ( r > 0 )           hi = lo - 1;
+              }
+            if ( lo <= hi ) nb += hi - lo + 1;
+            if ( ( bound >= 0 ) && ( nb > bound ) ) return bound + 1;
+          }
+      return nb;
+    }
+
+  private:
+    template <typename Point3>
+    static Integer dot( const Integer n[ 3 ], const Point3 & p )
+    {
+      return n[ 0 ] * (Integer) p[ 0 ] + n[ 1 ] * (Integer) p[ 1 ] + n[ 2 ] * (Integer) p[ 2 ];
+    }
+  }; // end of struct LatticeCounting
+
+} // namespace DGtal
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Includes inline functions.
+
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // !defined LatticeCounting_h
+
+#undef LatticeCounting_RECURSES
+#endif // else defined(LatticeCounting_RECURSES)
@@ -0,0 +1,194 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **/
+
+#pragma once
+
+/**
+ * @file LatticeKernel.h
+ * @author Jacques-Olivier Lachaud (\c jacques-olivier.lachaud@univ-savoie.fr )
+ * Laboratory of Mathematics (CNRS, UMR 5807), University of Savoie, France
+ *
+ * @date 2018/03/06
+ *
+ * Header file for module LatticeKernel.cpp
+ *
+ * This file is part of the DGtal library.
+ */
+
+#if defined(LatticeKernel_RECURSES)
+#error Recursive header files inclusion detected in LatticeKernel.h
+#else // defined(LatticeKernel_RECURSES)
+/** Prevents recursive inclusion of headers. */
+#define LatticeKernel_RECURSES
+
+#if !defined LatticeKernel_h
+/** Prevents repeated inclusion of headers. */
+#define LatticeKernel_h
+
+//////////////////////////////////////////////////////////////////////////////
+// Inclusions
+#include <cstdint>
+#include <cmath>
+#include <CGAL/Simple_cartesian.h>
+#include <CGAL/Filtered_kernel.h>
+
+//////////////////////////////////////////////////////////////////////////////
+
+namespace DGtal
+{
+
+  /////////////////////////////////////////////////////////////////////////////
+  // struct LatticeCoordinates
+  /**
+     Description of struct 'LatticeCoordinates' <p> \brief Aim: Reads
+     the coordinates of a 2D kernel point as integers, when the point
+     is a lattice point of the given bound.
+  */
+  struct LatticeCoordinates {
+    typedef std::int64_t Integer;
+
+    /// Stores in \a x, \a y the coordinates of \a p.
+    /// @return 'true' iff they are integers of absolute value smaller than \a bound.
+    template <typename Point2>
+    static bool get( const Point2 & p, Integer bound, Integer & x, Integer & y )
+    {
+      const double px = p.x(), py = p.y();
+      if ( ! ( std::fabs( px ) < (double) bound && std::fabs( py ) < (double) bound ) )
+        return false;
+      x = (Integer) px;
+      y = (Integer) py;
+      return ( (double) x == px ) && ( (double) y == py );
+    }
+
+    static CGAL::Sign sign( Integer v )
+    {
+      return v > 0 ? CGAL::POSITIVE : ( v < 0 ? CGAL::NEGATIVE : CGAL::ZERO );
+    }
+  };
+
+  /// Orientation of three points, computed with 64-bit integers for
+  /// lattice points and by the filtered predicate \a TBase otherwise.
+  template <typename TKernel, typename TBase>
+  struct LatticeOrientation_2 : public TBase {
+    typedef typename TKernel::Point_2 Point_2;
+    typedef CGAL::Orientation         result_type;
+    typedef LatticeCoordinates::Integer Integer;
+    /// Differences are below 2^31, hence products below 2^62.
+    static const Integer BOUND = Integer( 1 ) << 30;
+
+    using TBase::operator();
+
+    result_type operator()( const Point_2 & p, const Point_2 & q, const Point_2 & r ) const
+    {
+      Integer px, py, qx, qy, rx, ry;
+      if ( LatticeCoordinates::get( p, BOUND, px, py )
+           && LatticeCoordinates::get( q, BOUND, qx, qy )
+           && LatticeCoordinates::get( r, BOUND, rx, ry ) )
+        return LatticeCoordinates::sign( ( qx - px ) * ( ry - py ) - ( qy - py ) * ( rx - px ) );
+      return TBase::operator()( p, q, r );
+    }
+  };
+
+  /// Side of t with respect to the oriented circle pqr, computed with
+  /// 64-bit integers for lattice points and by the filtered predicate
+  /// \a TBase otherwise. Same formula as CGAL::side_of_oriented_circleC2.
+  template <typename TKernel, typename TBase>
+  struct LatticeSide_of_oriented_circle_2 : public TBase {
+    typedef typename TKernel::Point_2 Point_2;
+    typedef CGAL::Oriented_side       result_type;
+    typedef LatticeCoordinates::Integer Integer;
+    /// Differences are below 2^15, 2x2 minors below 2^31, hence the
+    /// determinant terms below 2^62.
+    static const Integer BOUND = Integer( 1 ) << 14;
+
+    using TBase::operator();
+
+    result_type operator()( const Point_2 & p, const Point_2 & q,
+                            const Point_2 & r, const Point_2 & t ) const
+    {
+      Integer px, py, qx, qy, rx, ry, tx, ty;
+      if ( LatticeCoordinates::get( p, BOUND, px, py )
+           && LatticeCoordinates::get( q, BOUND, qx, qy )
+           && LatticeCoordinates::get( r, BOUND, rx, ry )
+           && LatticeCoordinates::get( t, BOUND, tx, ty ) )
+        {
+          Integer qpx = qx - px, qpy = qy - py;
+          Integer rpx = rx - px, rpy = ry - py;
+          Integer tpx = tx - px, tpy = ty - py;
+          Integer a00 = qpx * tpy - qpy * tpx;
+          Integer a01 = tpx * ( tx - qx ) + tpy * ( ty - qy );
+          Integer a10 = qpx * rpy - qpy * rpx;
+          Integer a11 = rpx * ( rx - qx ) + rpy * ( ry - qy );
+          return LatticeCoordinates::sign( a00 * a11 - a10 * a01 );
+        }
+      return TBase::operator()( p, q, r, t );
+    }
+  };
+
+  /// Replaces the orientation and in-circle predicates of the kernel
+  /// \a TKernelBase by their lattice versions.
+  template <typename TKernel, typename TKernelBase>
+  struct LatticeKernelBase : public TKernelBase {
+    typedef LatticeOrientation_2< TKernel, typename TKernelBase::Orientation_2 >
+    Orientation_2;
+    typedef LatticeSide_of_oriented_circle_2< TKernel, typename TKernelBase::Side_of_oriented_circle_2 >
+    Side_of_oriented_circle_2;
+
+    Orientation_2 orientation_2_object() const
+    { return Orientation_2(); }
+    Side_of_oriented_circle_2 side_of_oriented_circle_2_object() const
+    { return Side_of_oriented_circle_2(); }
+  };
+
+  /////////////////////////////////////////////////////////////////////////////
+  // struct LatticeKernel
+  /**
+     Description of struct 'LatticeKernel' <p> \brief Aim: A CGAL 2D
+     kernel for triangulations of digital points. It is
+     CGAL::Exact_predicates_inexact_constructions_kernel, except that
+     the orientation and in-circle predicates, which dominate the cost
+     of (constrained) Delaunay triangulations, are evaluated exactly
+     with 64-bit integers whenever their points are lattice points,
+     without interval filtering. Other points go through the usual
+     filtered predicates.
+
+     Coordinates are still stored as doubles: the tools compute
+     angles, barycenters and interpolated values in floating point
+     from the vertex positions, and digital points are exactly
+     representable.
+  */
+  struct LatticeKernel
+    : public LatticeKernelBase
+      < LatticeKernel,
+        CGAL::Filtered_kernel_adaptor
+        < CGAL::Type_equality_wrapper
+          < CGAL::Simple_cartesian<double>::Base<LatticeKernel>::Type, LatticeKernel >,
+          true > >
+  {};
+
+} // namespace DGtal
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Includes inline functions.
+
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // !defined LatticeKernel_h
+
+#undef LatticeKernel_RECURSES
+#endif // else defined(LatticeKernel_RECURSES)
@@ -41,6 +41,10 @@
 //////////////////////////////////////////////////////////////////////////////
 // Inclusions
 #include <iostream>
+#include <vector>
+#include <set>
+#include <thread>
+#include <algorithm>
 #include "DGtal/base/Common.h"
 #include "Triangulation3DHelper.h"
 #include "SimplicialStrip3D.h"
@@ -369,7 +373,8 @@ namespace DGtal
        Used by relativeHull2 to insert candidate concavities into the Queue.
        Check all possibilities for a facet specified as 3 vertices.
     */
-    void insertQueue( std::set< BorderFacet > & inQueue,
+    template <typename BorderFacets>
+    void insertQueue( BorderFacets & inQueue,
                       const Facet & f,
                       const CheckVertexLabelingInequality & predicate ) const
     {
@@ -402,7 +407,7 @@ namespace DGtal
               // DGtal::trace.info() << "- strip s=" << strip.size() << " a=" << strip.angle()
               //                     << std::endl;
               if ( strip.isConcave() ) 
-                inQueue.insert( BorderFacet( v[ l ], v[ (l+1)%3 ], v[ (l+2)%3 ] ) );
+                inQueue.insert( inQueue.end(), BorderFacet( v[ l ], v[ (l+1)%3 ], v[ (l+2)%3 ] ) );
             }
         }
     }
@@ -430,12 +435,30 @@ namespace DGtal
       CheckVertexLabelingInequality predNotL( labeling(), l );
       Strip strip( T() );
       // DGtal::trace.beginBlock( "Searching concavities" );
+      // The search does not modify the triangulation: facets are
+      // split among threads, each one gathering its own candidates.
+      std::vector<Facet> facets;
       for ( FiniteFacetsIterator it = T().finite_facets_begin(), itend = T().finite_facets_end();
             it != itend; ++it )
         {
           Facet f = *it;
           if ( T().is_infinite( T().mirror_facet( f ) ) ) continue; // both facets should be finite.
-          insertQueue( inQueue, f, predNotL );
+          facets.push_back( f );
+        }
+      std::size_t nt = std::max( 1u, std::thread::hardware_concurrency() );
+      nt = std::max( std::size_t( 1 ), std::min( nt, facets.size() / 1024 ) );
+      std::vector< std::vector< BorderFacet > > found( nt );
+      std::vector< std::thread > threads;
+      for ( std::size_t r = 0; r < nt; ++r )
+        threads.push_back( std::thread( [ &, r ] () {
+              for ( std::size_t i = r * facets.size() / nt, e = ( r + 1 ) * facets.size() / nt;
+                    i < e; ++i )
+                insertQueue( found[ r ], facets[ i ], predNotL );
+            } ) );
+      for ( std::size_t r = 0; r < nt; ++r )
+        {
+          threads[ r ].join();
+          inQueue.insert( found[ r ].begin(), found[ r ].end() );
         }
       DGtal::trace.info() << "- Found " << inQueue.size() << " potential concavities." 
                           << std::endl;
@@ -41,7 +41,7 @@
 //////////////////////////////////////////////////////////////////////////////
 // Inclusions
 #include <iostream>
-#include <deque>
+#include <vector>
 #include "DGtal/base/Common.h"
 #include "Triangulation2DHelper.h"
 //////////////////////////////////////////////////////////////////////////////
@@ -143,14 +143,17 @@ namespace DGtal
       if ( ! myLoop )
         {
           myUmbrella.push_back( e ); // last
+          // Edges before \a edge are collected backward, then put in front.
+          myFront.clear();
           Edge e = TH.nextCWAroundSourceVertex( edge );
           while ( predicate( TH.target( e ) ) )
             {
-              myUmbrella.push_front( e );
+              myFront.push_back( e );
               e = TH.nextCWAroundSourceVertex( e );
               ASSERT( TH.source( e ) == pivot );
             }
-          myUmbrella.push_front( e );
+          myFront.push_back( e );
+          myUmbrella.insert( myUmbrella.begin(), myFront.rbegin(), myFront.rend() );
         }
       checkInfinite();
     }
@@ -301,7 +304,7 @@ namespace DGtal
       if ( isLoop() ) return 2.0*M_PI;
       if ( isTrivial() ) return 2.0*M_PI;
       Component totalAngle = 0.0;
-      for ( typename std::deque<Edge>::const_iterator it = myUmbrella.begin(), ite = myUmbrella.end() - 1;
+      for ( typename std::vector<Edge>::const_iterator it = myUmbrella.begin(), ite = myUmbrella.end() - 1;
             it != ite; ++it )
         {
           totalAngle += TH.innerAngle( *it );
@@ -413,9 +416,12 @@ namespace DGtal
 
     /**
        The sequence of edges (v,v_i). The face of the last edge is not
-       included in the umbrella.
+       included in the umbrella. Its storage is reused by successive
+       calls to init.
     */
-    std::deque<Edge> myUmbrella;
+    std::vector<Edge> myUmbrella;
+    /// Buffer used by init to gather the edges before the initial one.
+    std::vector<Edge> myFront;
     /// True iff the umbrella contains all incident edges to the pivot.
     bool myLoop;
     /// True iff the umbrella contains at least one infinite edge/face.
@@ -2,6 +2,10 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
 #include <boost/program_options/options_description.hpp>
 #include <boost/program_options/parsers.hpp>
 #include <boost/program_options/variables_map.hpp>
@@ -117,6 +121,17 @@ namespace DGtal {
     Value                _upflip;
     /// true iff some edges cannot be flipped.
     bool                 _check_edge;
+    /// Incremented whenever all faces may have changed.
+    Integer              _generation;
+    /// Faces whose geometry or energy changed during this generation.
+    std::vector<Face>    _changed_faces;
+    /// Cached keys energyTV(f) * diameter(f) for selecting discontinuities.
+    ScalarForm           _disc_keys;
+    /// Faces ordered so that discontinuities come first.
+    std::vector<Face>    _disc_order;
+    /// Generation and number of processed changed faces of the cached keys.
+    Integer              _disc_generation;
+    std::size_t          _disc_nb_changed;
     
     /// @return the regularized value at vertex v.
     const Value& u( const VertexIndex v ) const
@@ -262,6 +277,7 @@ namespace DGtal {
     Scalar computeEnergyTV( const Face f )
     {
       VertexRange V = T.verticesAroundFace( f );
+      changed( f );
       return ( _tv_per_triangle[ f ] = computeEnergyTV( V[ 0 ], V[ 1 ], V[ 2 ] ));
     }
     
@@ -286,6 +302,7 @@ namespace DGtal {
 	E += computeEnergyTV( f );
       }
       _tv_energy = E;
+      changedAll();
       // trace.info() << "TV(u) = " << E << std::endl;
       return E;
     }
@@ -296,6 +313,76 @@ namespace DGtal {
       return _tv_energy;
     }
 
+    /// Tells that the geometry or the energy of face \a f has changed.
+    void changed( const Face f )
+    {
+      if ( _changed_faces.size() >= T.nbFaces() ) changedAll();
+      else _changed_faces.push_back( f );
+    }
+
+    /// Tells that all faces may have changed.
+    void changedAll()
+    {
+      _generation += 1;
+      _changed_faces.clear();
+    }
+
+    /**
+       Selects the faces with greatest energyTV(f) * diameter(f) such
+       that their cumulative energy is lower than \a ratio times the
+       total energy, i.e. the faces displayed as discontinuities.
+
+       Keys are cached and only the keys of the faces changed since
+       the last call are recomputed. Faces are then partitioned with
+       successive nth_element, in linear expected time.
+       
+       @return the number k of selected faces, which are the k first
+       faces of _disc_order.
+    */
+    Integer selectDiscontinuities( Scalar ratio )
+    {
+      const Face nb = T.nbFaces();
+      // Updates keys.
+      if ( _disc_generation != _generation || _disc_keys.size() > nb ) {
+	_disc_keys.resize( nb );
+	_disc_order.resize( nb );
+	for ( Face f = 0; f < nb; ++f ) {
+	  _disc_keys [ f ] = energyTV( f ) * diameter( f );
+	  _disc_order[ f ] = f;
+	}
+      } else {
+	for ( Face f = _disc_keys.size(); f < nb; ++f ) {
+	  _disc_keys.push_back( energyTV( f ) * diameter( f ) );
+	  _disc_order.push_back( f );
+	}
+	for ( std::size_t i = _disc_nb_changed; i < _changed_faces.size(); ++i ) {
+	  const Face f = _changed_faces[ i ];
+	  _disc_keys[ f ] = energyTV( f ) * diameter( f );
+	}
+      }
+      _disc_generation = _generation;
+      _disc_nb_changed = _changed_faces.size();
+      // Selects faces by decreasing keys while cumulative energy is
+      // lower than the threshold. The previous order is kept, so that
+      // few changes imply few swaps.
+      const Scalar Otv = getEnergyTV() * ratio;
+      Scalar       Ctv = 0.0;
+      auto   greater = [ this ] ( Face f1, Face f2 ) -> bool
+	{ return _disc_keys[ f1 ] > _disc_keys[ f2 ]; };
+      std::size_t lo = 0;
+      std::size_t hi = nb;
+      while ( lo < hi ) {
+	const std::size_t mid = lo + ( hi - lo ) / 2;
+	std::nth_element( _disc_order.begin() + lo, _disc_order.begin() + mid,
+			  _disc_order.begin() + hi, greater );
+	Scalar E = 0.0;
+	for ( std::size_t i = lo; i <= mid; ++i ) E += energyTV( _disc_order[ i ] );
+	if ( Ctv + E < Otv ) { Ctv += E; lo = mid + 1; }
+	else hi = mid;
+      }
+      return lo;
+    }
+
     /// @return the aspect ratio of a face (the greater, the most elongated it is.
     Scalar aspectRatio( const Face f ) const
     {
@@ -343,7 +430,8 @@ namespace DGtal {
 		     Scalar lo_v = 0,
 		     Scalar up_v = 0 )
       : _lowflip( Value( lo_v, lo_v, lo_v ) ),
-	_upflip( Value( up_v, up_v, up_v ) )
+	_upflip( Value( up_v, up_v, up_v ) ),
+	_generation( 0 ), _disc_generation( -1 ), _disc_nb_changed( 0 )
     {
       _check_edge = ( _lowflip != Value( 0, 0, 0 ) )
 	||          ( _upflip != Value( 255, 255, 255 ) );
@@ -536,6 +624,8 @@ namespace DGtal {
 	  T.flip( a );
 	  _tv_per_triangle[ f012 ] = E123; // f012 -> f123
 	  _tv_per_triangle[ f023 ] = E013; // f023 -> f013
+	  changed( f012 );
+	  changed( f023 );
 	  _tv_energy += Eflip - Ecurr;
 	  return 1;
 	}
@@ -675,6 +765,8 @@ namespace DGtal {
 	if ( update == 0 ) {
 	  // Save arcs that may be affected.
 	  queueSurroundingArcs( a );
+	  changed( T.faceAroundArc( a ) );
+	  changed( T.faceAroundArc( T.opposite( a ) ) );
 	  T.flip( a );
 	  nbflip++;
 	}
@@ -695,6 +787,8 @@ namespace DGtal {
 	  if ( randomUniform() < p ) {
 	    // Save arcs that may be affected.
 	    queueSurroundingArcs( a );
+	    changed( T.faceAroundArc( a ) );
+	    changed( T.faceAroundArc( T.opposite( a ) ) );
 	    T.flip( a );
 	    nbflip++;
 	  } 
@@ -747,6 +841,139 @@ namespace DGtal {
     
   };
 
+  /**
+     A level-of-detail structure over the faces of a TVTriangulation,
+     for rendering large triangulations at any scale. It is a bounding
+     volume hierarchy where each node stores the bounding box of its
+     faces, their total area, area-weighted centroid and mean color,
+     and an upper bound of the deviation of any vertex value of its
+     faces to this mean color.
+
+     It must be rebuilt whenever the triangulation or its values
+     change.
+  */
+  struct TVTriangulationLOD
+  {
+    typedef TVTriangulation::Point       Point;
+    typedef TVTriangulation::Value       Value;
+    typedef TVTriangulation::Face        Face;
+    typedef TVTriangulation::Scalar      Scalar;
+    typedef TVTriangulation::VertexRange VertexRange;
+
+    struct Node {
+      Point  lo, hi;        ///< bounding box of its faces
+      Point  centroid;      ///< area-weighted centroid of its faces
+      Value  color;         ///< area-weighted mean color of its faces
+      Scalar area;          ///< total area of its faces
+      Scalar error;         ///< max deviation (sup norm) of a vertex value to color
+      int    first, count;  ///< its faces are _faces[ first .. first+count-1 ]
+      int    left, right;   ///< children indices (-1 for leaves)
+    };
+
+    /// The nodes, the root being the first one.
+    std::vector<Node> _nodes;
+    /// The faces of the triangulation, ordered so that each node is a range.
+    std::vector<Face> _faces;
+
+    /// Builds the hierarchy over the faces of \a tvT, leaves having
+    /// at most \a leaf_size faces.
+    TVTriangulationLOD( const TVTriangulation& tvT, int leaf_size = 4 )
+    {
+      const Face nb = tvT.T.nbFaces();
+      _faces.resize( nb );
+      std::vector<Point> centers( nb );
+      for ( Face f = 0; f < nb; ++f ) {
+        _faces[ f ] = f;
+        VertexRange V = tvT.T.verticesAroundFace( f );
+        centers[ f ]  = ( tvT.T.position( V[ 0 ] ) + tvT.T.position( V[ 1 ] )
+                          + tvT.T.position( V[ 2 ] ) ) / 3.0;
+      }
+      if ( nb > 0 ) build( tvT, centers, 0, nb, std::max( 1, leaf_size ) );
+    }
+
+    /// @return the root node.
+    const Node& root() const { return _nodes[ 0 ]; }
+
+  protected:
+
+    /// Builds the node of faces [first,last) and returns its index.
+    int build( const TVTriangulation& tvT, const std::vector<Point>& centers,
+               int first, int last, int leaf_size )
+    {
+      const int idx = _nodes.size();
+      _nodes.push_back( Node() );
+      Node N;
+      N.first = first;
+      N.count = last - first;
+      N.left  = N.right = -1;
+      if ( N.count <= leaf_size ) {
+        N.lo = N.hi = tvT.T.position( tvT.T.verticesAroundFace( _faces[ first ] )[ 0 ] );
+        N.area  = 0.0;
+        N.centroid = Point( 0, 0 );
+        N.color = Value( 0, 0, 0 );
+        Value sum_color( 0, 0, 0 );
+        for ( int i = first; i < last; ++i ) {
+          VertexRange  V = tvT.T.verticesAroundFace( _faces[ i ] );
+          const Point& a = tvT.T.position( V[ 0 ] );
+          const Point& b = tvT.T.position( V[ 1 ] );
+          const Point& c = tvT.T.position( V[ 2 ] );
+          const Scalar A = 0.5 * fabs( TVTriangulation::doesTurnLeft( a, b, c ) );
+          N.lo = N.lo.inf( a ).inf( b ).inf( c );
+          N.hi = N.hi.sup( a ).sup( b ).sup( c );
+          N.area     += A;
+          N.centroid += A * centers[ _faces[ i ] ];
+          sum_color  += A * ( tvT.u( V[ 0 ] ) + tvT.u( V[ 1 ] ) + tvT.u( V[ 2 ] ) ) / 3.0;
+        }
+        if ( N.area > 0.0 ) {
+          N.centroid /= N.area;
+          N.color     = sum_color / N.area;
+        } else {
+          N.centroid = 0.5 * ( N.lo + N.hi );
+        }
+        N.error = 0.0;
+        for ( int i = first; i < last; ++i ) {
+          VertexRange V = tvT.T.verticesAroundFace( _faces[ i ] );
+          for ( int k = 0; k < 3; ++k )
+            N.error = std::max( N.error, ( tvT.u( V[ k ] ) - N.color ).normInfinity() );
+        }
+        _nodes[ idx ] = N;
+        return idx;
+      }
+      // Splits faces at the median of their centers along the largest axis.
+      Point lo = centers[ _faces[ first ] ];
+      Point hi = lo;
+      for ( int i = first + 1; i < last; ++i ) {
+        lo = lo.inf( centers[ _faces[ i ] ] );
+        hi = hi.sup( centers[ _faces[ i ] ] );
+      }
+      const int axis = ( hi[ 0 ] - lo[ 0 ] >= hi[ 1 ] - lo[ 1 ] ) ? 0 : 1;
+      const int  mid = first + ( last - first ) / 2;
+      std::nth_element( _faces.begin() + first, _faces.begin() + mid,
+                        _faces.begin() + last,
+                        [ &centers, axis ] ( Face f1, Face f2 )
+                        { return centers[ f1 ][ axis ] < centers[ f2 ][ axis ]; } );
+      N.left  = build( tvT, centers, first, mid, leaf_size );
+      N.right = build( tvT, centers, mid, last, leaf_size );
+      // Aggregates children.
+      const Node& L = _nodes[ N.left ];
+      const Node& R = _nodes[ N.right ];
+      N.lo   = L.lo.inf( R.lo );
+      N.hi   = L.hi.sup( R.hi );
+      N.area = L.area + R.area;
+      if ( N.area > 0.0 ) {
+        N.centroid = ( L.area * L.centroid + R.area * R.centroid ) / N.area;
+        N.color    = ( L.area * L.color    + R.area * R.color    ) / N.area;
+      } else {
+        N.centroid = 0.5 * ( N.lo + N.hi );
+        N.color    = 0.5 * ( L.color + R.color );
+      }
+      N.error = std::max( L.error + ( L.color - N.color ).normInfinity(),
+                          R.error + ( R.color - N.color ).normInfinity() );
+      _nodes[ idx ] = N;
+      return idx;
+    }
+  };
+
   // Useful function for viewing triangulations.
 
   /**
@@ -870,30 +1097,76 @@ namespace DGtal {
 	}
     }
 
+    /**
+       Displays only the faces of the AVT that intersect the viewport,
+       with flat, Gouraud or linear gradient shading. Nodes of \a lod
+       that are smaller than \a max_pixels pixels (and whose error is
+       at most \a tolerance if they are bigger than one pixel) are
+       displayed as a square of same area and mean color at their
+       centroid, so that the number of drawn elements depends on the
+       number of visible pixels and not on the number of faces.
+    */
+    void view( TVT & tvT, const TVTriangulationLOD& lod,
+	       Scalar max_pixels = 1.0, Scalar tolerance = 0.0 )
+    {
+      if ( lod._nodes.empty() ) return;
+      cairo_set_operator( _cr,  CAIRO_OPERATOR_ADD );
+      cairo_set_line_width( _cr, 0.0 ); 
+      cairo_set_line_cap( _cr, CAIRO_LINE_CAP_BUTT );
+      cairo_set_line_join( _cr, CAIRO_LINE_JOIN_BEVEL );
+      // Viewport in triangulation coordinates.
+      const Point vlo( x( 0 ), y( _height ) );
+      const Point vhi( x( _width ), y( 0 ) );
+      std::vector<int> stack( 1, 0 );
+      while ( ! stack.empty() ) {
+	const TVTriangulationLOD::Node& N = lod._nodes[ stack.back() ];
+	stack.pop_back();
+	if ( N.hi[ 0 ] < vlo[ 0 ] || N.lo[ 0 ] > vhi[ 0 ]
+	     || N.hi[ 1 ] < vlo[ 1 ] || N.lo[ 1 ] > vhi[ 1 ] ) continue;
+	const Scalar pixels = std::max( ( N.hi[ 0 ] - N.lo[ 0 ] ) * _xf,
+					( N.hi[ 1 ] - N.lo[ 1 ] ) * _yf );
+	if ( pixels <= 1.0
+	     || ( pixels <= max_pixels && N.error <= tolerance ) ) {
+	  viewLODNode( N );
+	} else if ( N.left < 0 ) {
+	  for ( int k = N.first; k < N.first + N.count; ++k ) {
+	    const Face f = lod._faces[ k ];
+	    if ( _shading == 1 )      viewTVTGouraudTriangle( tvT, f );
+	    else if ( _shading == 2 ) viewTVTLinearGradientTriangle( tvT, f );
+	    else                      viewTVTFlatTriangle   ( tvT, f );
+	  }
+	} else {
+	  stack.push_back( N.right );
+	  stack.push_back( N.left );
+	}
+      }
+    }
+
+    /// Displays a LOD node as a square of same area and mean color,
+    /// centered at its centroid.
+    void viewLODNode( const TVTriangulationLOD::Node& N )
+    {
+      const Scalar side = sqrt( N.area );
+      const RealPoint c = ij( RealPoint( N.centroid[ 0 ], N.centroid[ 1 ] ) );
+      cairo_set_source_rgb( _cr,
+			    N.color[ 0 ] * _redf,
+			    N.color[ 1 ] * _greenf,
+			    N.color[ 2 ] * _bluef );
+      cairo_rectangle( _cr, c[ 0 ] - 0.5 * side * _xf, c[ 1 ] - 0.5 * side * _yf,
+		       side * _xf, side * _yf );
+      cairo_fill( _cr );
+    }
+
     /**
        Displays the AVT with flat or Gouraud shading, and displays a
        set of discontinuities as a percentage of the total energy.
     */
     void view( TVT & tvT, Scalar discontinuities )
     {
-      // We need first to sort faces according to their energyTV.
-      std::vector<Face> tv_faces( tvT.T.nbFaces() );
-      for ( Face f = 0; f < tvT.T.nbFaces(); ++f )
-	tv_faces[ f ] = f;
-      std::sort( tv_faces.begin(), tv_faces.end(),
-		 [ & tvT ] ( Face f1, Face f2 ) -> bool
-		 // { return ( tvT.energyTV( f1 ) ) > ( tvT.energyTV( f2 ) ); } 
-		 // { return ( tvT.aspectRatio( f1 ) )
-                 //     > ( tvT.aspectRatio( f2 ) ); } 
-		 { return ( tvT.energyTV( f1 ) * tvT.diameter( f1 ) )
-		     > ( tvT.energyTV( f2 ) * tvT.diameter( f2 ) ); } 
-		 // { return ( tvT.energyTV( f1 ) * tvT.aspectRatio( f1 ) )
-		 //     > ( tvT.energyTV( f2 ) * tvT.aspectRatio( f2 ) ); } 
-                 );
-      Scalar Etv = tvT.getEnergyTV();
-      Scalar Ctv = 0.0;
-      Scalar Otv = Etv * discontinuities;
-      
+      // Faces with greatest energyTV * diameter are selected first.
+      const TVT::Integer nb_disc = tvT.selectDiscontinuities( discontinuities );
+      const std::vector<Face>& tv_faces = tvT._disc_order;
+
       cairo_set_operator( _cr,  CAIRO_OPERATOR_ADD );
       cairo_set_line_width( _cr, 0.0 ); 
       cairo_set_line_cap( _cr, CAIRO_LINE_CAP_BUTT );
@@ -901,8 +1174,7 @@ namespace DGtal {
       for ( int i = 0; i < tv_faces.size(); ++i )
 	{
 	  Face f = tv_faces[ i ];
-	  Ctv   += tvT.energyTV( f );
-	  if ( Ctv < Otv ) { // display discontinuity
+	  if ( i < nb_disc ) { // display discontinuity
 	    // viewTVTTriangleDiscontinuity( tvT, f );
 	    viewTVTNonLinearGradientTriangle( tvT, f );
 	  }
@@ -930,11 +1202,12 @@ namespace DGtal {
   void viewTVTriangulation
   ( TVTriangulation& tvT, double b, double x0, double y0, double x1, double y1,
 	int shading, bool color, std::string fname, double discontinuities,
-    double stiffness, double amplitude )
+    double stiffness, double amplitude, int png_level = -1 )
   {
     CairoViewerTV cviewer
       ( x0, y0, x1, y1,
 	b, b, shading, color, stiffness, amplitude );
+    cviewer.setOutput( png_level );
     // CairoViewerTV cviewer
     //   ( (int) round( x0 ), (int) round( y0 ), 
     // 	(int) round( (x1+1 - x0) * b ), (int) round( (y1+1 - y0) * b ), 
@@ -943,20 +1216,36 @@ namespace DGtal {
     cviewer.save( fname.c_str() );
   }
   
+  // Displays the viewport [x0,x1]x[y0,y1] at magnification b with
+  // the level-of-detail structure lod.
+  void viewTVTriangulationViewport
+  ( TVTriangulation& tvT, const TVTriangulationLOD& lod,
+    double b, double x0, double y0, double x1, double y1,
+    int shading, bool color, std::string fname, int png_level = -1 )
+  {
+    CairoViewerTV cviewer
+      ( x0, y0, x1, y1, b, b, shading, color );
+    cviewer.setOutput( png_level );
+    cviewer.view( tvT, lod );
+    cviewer.save( fname.c_str() );
+  }
+
+  // ext: png, ppm or pam (images are written in the background).
   void viewTVTriangulationAll
   ( TVTriangulation& tvT, double b, double x0, double y0, double x1, double y1,
     bool color, std::string fname, int display, double discontinuities,
-    double stiffness, double amplitude )
+    double stiffness, double amplitude,
+    std::string ext = "png", int png_level = -1 )
   {
     if ( display & 0x1 )
-      viewTVTriangulation( tvT, b, x0, y0, x1, y1, 0, color, fname + ".png",
-			   discontinuities, stiffness, amplitude );
+      viewTVTriangulation( tvT, b, x0, y0, x1, y1, 0, color, fname + "." + ext,
+			   discontinuities, stiffness, amplitude, png_level );
     if ( display & 0x2 )
-      viewTVTriangulation( tvT, b, x0, y0, x1, y1, 1, color, fname + "-g.png",
-			   discontinuities, stiffness, amplitude );
+      viewTVTriangulation( tvT, b, x0, y0, x1, y1, 1, color, fname + "-g." + ext,
+			   discontinuities, stiffness, amplitude, png_level );
     if ( display & 0x4 )
-      viewTVTriangulation( tvT, b, x0, y0, x1, y1, 2, color, fname + "-lg.png",
-			   discontinuities, stiffness, amplitude );
+      viewTVTriangulation( tvT, b, x0, y0, x1, y1, 2, color, fname + "-lg." + ext,
+			   discontinuities, stiffness, amplitude, png_level );
   }
 
   void exportEPSMesh(TVTriangulation& tvT, const std::string &name, unsigned int width,
@@ -1005,7 +1294,7 @@ namespace DGtal {
     
   }
 
-  TVTriangulation::Arc pivotNext(TVTriangulation& tvT, TVTriangulation::Arc a,
+  TVTriangulation::Arc pivotNext(const TVTriangulation& tvT, TVTriangulation::Arc a,
                  const TVTriangulation::Value &valTrack)
   {
     TVTriangulation::Value currentHead =  tvT.u(tvT.T.head(a));
@@ -1019,21 +1308,32 @@ namespace DGtal {
 
 
 
-  std::vector<TVTriangulation::Point> trackBorderFromFace(TVTriangulation& tvT,  TVTriangulation::Face startArc,
-                                                          TVTriangulation::Value valInside, std::vector<bool> &markedArcs)
+  /**
+     Tracks the border of the region of value \a valInside starting
+     from arc \a startArc, and appends the centers of the traversed
+     faces to \a res. Every traversed arc is marked in \a markedArcs
+     and has its head of value \a valInside, so tracking regions of
+     different values touches disjoint parts of \a markedArcs.
+
+     @return the number of points appended to \a res.
+  */
+  std::size_t trackBorderFromFace(const TVTriangulation& tvT,  TVTriangulation::Arc startArc,
+                                  TVTriangulation::Value valInside,
+                                  std::vector<unsigned char> &markedArcs,
+                                  std::vector<TVTriangulation::Point> &res)
   {
-    std::vector<TVTriangulation::Point> res;
+    const std::size_t nb = res.size();
     
     // starting ext point: arc tail
     TVTriangulation::Face faceIni = tvT.T.faceAroundArc(startArc);
 
       if(faceIni == TVTriangulation::Triangulation::INVALID_FACE )
       {
-          return res;
+          return 0;
       }
     TVTriangulation::Arc currentArc = startArc;
     TVTriangulation::Face currentFace = faceIni;
-    markedArcs[startArc] = true;
+    markedArcs[startArc] = 1;
     
     do 
     {
@@ -1046,50 +1346,138 @@ namespace DGtal {
         {
             break;
         }
-        markedArcs[currentArc] = true;
+        markedArcs[currentArc] = 1;
     } while(currentFace != faceIni);
-    return res;
+    return res.size() - nb;
   }
-  
-  
-  std::vector<std::vector<TVTriangulation::Point> > trackBorders(TVTriangulation& tvT, unsigned int num)
+
+  /**
+     Extracts all the borders of the constant-valued regions of a
+     TVTriangulation. Every arc is visited once to group the arcs
+     separating two different values by the color of their head, then
+     the contours of each color are tracked independently (and in
+     parallel).
+
+     The contours of a given color are stored in a flat arena: all
+     their points are consecutive in \a points and contour \a k
+     spans [ starts[ k ], starts[ k+1 ] ).
+  */
+  struct TVTriangulationContours
   {
-    typedef std::map<DGtal::Color, std::vector<unsigned int> >  MapColorContours;
-    MapColorContours mapContours;
-    std::vector<std::vector<TVTriangulation::Point> > resAll;
-    std::vector<bool> markedArcs(tvT.T.nbArcs());
-    for(unsigned int i = 0; i< markedArcs.size(); i++){ markedArcs[i]=false; }
-    bool found = true;
-    while(found){
-      found = false;
-      for(unsigned int a = 0; a< markedArcs.size(); a++)
+    typedef TVTriangulation::Point     Point;
+    typedef TVTriangulation::Arc       Arc;
+    typedef TVTriangulation::Value     Value;
+    typedef std::vector<Point>         Contour;
+
+    /// The contours of all the regions of a given color.
+    struct ColorContours {
+      unsigned int             color;  ///< the color as 0xRRGGBB
+      std::vector<Arc>         seeds;  ///< the border arcs whose head has this color
+      std::vector<Point>       points; ///< the arena of contour points
+      std::vector<std::size_t> starts; ///< the offset of each contour in points (+ end)
+
+      std::size_t nbContours() const { return starts.size() - 1; }
+      Contour contour( std::size_t k ) const
       {
-          // tracking Head color
-        TVTriangulation::Value valH = tvT.u(tvT.T.head(a));
-        TVTriangulation::Value valT = tvT.u(tvT.T.tail(a));
-        
-        found = !markedArcs[a] && (valH[0]!=valT[0] || valH[1]!=valT[1] || valH[2]!=valT[2]);
-        if(found)
-        {
-          resAll.push_back( trackBorderFromFace(tvT, a, valH, markedArcs));
-          if (mapContours.count(DGtal::Color(valH[0], valH[1], valH[2]))==0)
-          {
-            std::vector<unsigned int> indexC;
-            indexC.push_back(resAll.size()-1);
-            mapContours[DGtal::Color(valH[0], valH[1], valH[2])]=indexC;
-          }
-          else
-          {
-            mapContours[DGtal::Color(valH[0], valH[1], valH[2])].push_back(resAll.size()-1);
-          }
+        return Contour( points.begin() + starts[ k ],
+                        points.begin() + starts[ k + 1 ] );
+      }
+    };
+
+    /// The contours grouped by color.
+    std::vector<ColorContours>                      _colors;
+    /// Index of each color in _colors.
+    std::unordered_map<unsigned int, std::size_t>   _index;
+
+    /// @return the component \a c rounded and clamped to [0,255] (0 for NaN).
+    static unsigned int colorComponent( double c )
+    {
+      return ! ( c > 0.0 ) ? 0u : ( c >= 255.0 ? 255u : (unsigned int) ( c + 0.5 ) );
+    }
+
+    /// @return the color of value \a v as 0xRRGGBB, each component
+    /// being rounded and clamped to [0,255].
+    static unsigned int colorKey( const Value& v )
+    {
+      return ( colorComponent( v[ 0 ] ) << 16 )
+        +    ( colorComponent( v[ 1 ] ) << 8 )
+        +      colorComponent( v[ 2 ] );
+    }
+
+    /// Extracts all contours of \a tvT, using at most \a nb_threads threads
+    /// (0 means the number of cores).
+    TVTriangulationContours( const TVTriangulation& tvT, unsigned int nb_threads = 0 )
+    {
+      // Groups border arcs by the color of their head (single pass).
+      for ( Arc a = 0; a < tvT.T.nbArcs(); ++a ) {
+        const Value& valH = tvT.u( tvT.T.head( a ) );
+        const Value& valT = tvT.u( tvT.T.tail( a ) );
+        if ( valH == valT ) continue;
+        const unsigned int c = colorKey( valH );
+        auto it = _index.find( c );
+        if ( it == _index.end() ) {
+          it = _index.insert( std::make_pair( c, _colors.size() ) ).first;
+          _colors.push_back( ColorContours() );
+          _colors.back().color = c;
         }
+        _colors[ it->second ].seeds.push_back( a );
       }
+      // Tracks the contours of each color. Arcs tracked for a color
+      // have a head of this color, so threads never mark the same arc.
+      std::vector<unsigned char> markedArcs( tvT.T.nbArcs(), 0 );
+      std::atomic<std::size_t>   next_color( 0 );
+      auto worker = [ & ] ()
+        {
+          for ( std::size_t i = next_color++; i < _colors.size(); i = next_color++ ) {
+            ColorContours& C = _colors[ i ];
+            C.starts.push_back( 0 );
+            for ( Arc a : C.seeds ) {
+              if ( markedArcs[ a ] ) continue;
+              trackBorderFromFace( tvT, a, tvT.u( tvT.T.head( a ) ), markedArcs, C.points );
+              C.starts.push_back( C.points.size() );
+            }
+          }
+        };
+      if ( nb_threads == 0 ) nb_threads = std::thread::hardware_concurrency();
+      nb_threads = std::max( 1u, std::min( nb_threads, (unsigned int) _colors.size() ) );
+      std::vector<std::thread> threads;
+      for ( unsigned int t = 1; t < nb_threads; ++t )
+        threads.push_back( std::thread( worker ) );
+      worker();
+      for ( auto& t : threads ) t.join();
     }
-    auto itMap = mapContours.begin();
-      for(unsigned int i=0;i < num; i++)  itMap++;
+
+    /// @return the number of distinct colors having a border.
+    std::size_t nbColors() const { return _colors.size(); }
+
+    /// @return the contours of color \a c (0xRRGGBB), or 0 if there is none.
+    const ColorContours* contours( unsigned int c ) const
+    {
+      auto it = _index.find( c );
+      return it != _index.end() ? &_colors[ it->second ] : 0;
+    }
+
+    /// @return the colors having a border, in increasing order.
+    std::vector<unsigned int> sortedColors() const
+    {
+      std::vector<unsigned int> colors;
+      for ( const ColorContours& C : _colors ) colors.push_back( C.color );
+      std::sort( colors.begin(), colors.end() );
+      return colors;
+    }
+  };
+  
+  /// @return the contours of the \a num-th color (colors sorted in
+  /// increasing order), or no contour if there are fewer colors.
+  std::vector<std::vector<TVTriangulation::Point> > trackBorders(TVTriangulation& tvT, unsigned int num)
+  {
+    TVTriangulationContours contours( tvT );
     std::vector<std::vector<TVTriangulation::Point> > res;
-    for(unsigned int i=0; i< (itMap->second).size(); i++){
-      res.push_back(resAll[(itMap->second)[i]]);
+    std::vector<unsigned int> colors = contours.sortedColors();
+    if ( num >= colors.size() ) return res;
+    const TVTriangulationContours::ColorContours* C = contours.contours( colors[ num ] );
+    for(std::size_t k = 0; k < C->nbContours(); k++){
+      res.push_back( C->contour( k ) );
     }
     return res;
   }
@@ -1181,6 +1569,9 @@ int main( int argc, char** argv )
     ("discontinuities", po::value<double>()->default_value( 0.0 ), "Tells to display a % of the TV discontinuities (the triangles with greatest energy)." ) 
     ("stiffness", po::value<double>()->default_value( 0.9 ), "Tells how to stiff the gradient around discontinuities (amplitude value is changed at stiffness * middle)." ) 
     ("amplitude", po::value<double>()->default_value( 0.75 ), "Tells the amplitude of the stiffness for the gradient around discontinuities." )
+    ("viewport", po::value< std::vector<double> >()->multitoken(), "Displays only the viewport x0 y0 x1 y1 (at magnification given by --bitmap) of the optimized triangulation in after-tv-opt-viewport, using a level-of-detail structure." )
+    ("image-format", po::value<std::string>()->default_value( "png" ), "The format of output bitmap images: png, ppm (uncompressed) or pam (uncompressed with alpha)." )
+    ("png-level", po::value<int>()->default_value( -1 ), "The zlib compression level of PNG outputs, from 0 (fastest) to 9 (smallest), -1 is the zlib default." )
     ("displayMesh", "display mesh of the eps display." )
     ("exportEPSMesh,e", po::value<std::string>(), "Export the triangle mesh." )
     ("exportEPSMeshDual,E", po::value<std::string>(), "Export the triangle mesh." )
@@ -1265,8 +1656,10 @@ int main( int argc, char** argv )
     double    y0 = 0.0;
     double    x1 = (double) image.domain().upperBound()[ 0 ];
     double    y1 = (double) image.domain().upperBound()[ 1 ];
+    std::string fmt = vm[ "image-format" ].as<std::string>();
+    int       level = vm[ "png-level" ].as<int>();
     viewTVTriangulationAll( TVT, b, x0, y0, x1, y1, color, "after-tv",
-			    display, disc, st, am );
+			    display, disc, st, am, fmt, level );
   }
   trace.endBlock();
   
@@ -1312,8 +1705,20 @@ int main( int argc, char** argv )
     double    y0 = 0.0;
     double    x1 = (double) image.domain().upperBound()[ 0 ];
     double    y1 = (double) image.domain().upperBound()[ 1 ];
+    std::string fmt = vm[ "image-format" ].as<std::string>();
+    int       level = vm[ "png-level" ].as<int>();
     viewTVTriangulationAll( TVT, b, x0, y0, x1, y1, color, "after-tv-opt",
-			    display, disc, st, am );
+			    display, disc, st, am, fmt, level );
+    if ( vm.count( "viewport" ) ) {
+      std::vector<double> V = vm[ "viewport" ].as< std::vector<double> >();
+      if ( V.size() != 4 )
+	trace.warning() << "--viewport requires 4 values x0 y0 x1 y1." << std::endl;
+      else {
+	TVTriangulationLOD lod( TVT );
+	viewTVTriangulationViewport( TVT, lod, b, V[ 0 ], V[ 1 ], V[ 2 ], V[ 3 ],
+				     2, color, "after-tv-opt-viewport." + fmt, level );
+      }
+    }
   }
   trace.endBlock();
     trace.beginBlock("Export base triangulation");
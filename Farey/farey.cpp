@@ -28,94 +28,71 @@
 
 ///////////////////////////////////////////////////////////////////////////////
 #include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <algorithm>
 #include "DGtal/base/Common.h"
-#include "DGtal/helpers/StdDefs.h"
-#include "DGtal/arithmetic/LightSternBrocot.h"
-#include "DGtal/arithmetic/LighterSternBrocot.h"
 
 ///////////////////////////////////////////////////////////////////////////////
 
 using namespace std;
 using namespace DGtal;
-using namespace DGtal::Z2i;
 ///////////////////////////////////////////////////////////////////////////////
-template <typename Fraction>
-struct Farey
+/**
+   The statistics of the partial quotients u_k of the continued
+   fractions [u_0; u_1, ..., u_k] of a set of fractions: the number
+   and the sum of the quotients of each depth k.
+*/
+template <typename TInteger>
+struct QuotientStatistics
 {
-  typedef typename Fraction::Integer Integer;
-  typedef std::list<Fraction> Sequence;
-  typedef typename std::list<Fraction>::const_iterator ConstIterator;
-  typedef typename std::list<Fraction>::iterator Iterator;
+  typedef TInteger Integer;
 
-  Integer myN;
-  Sequence mySequence;
   std::vector<Integer> myQuotientNbs;
   std::vector<Integer> myQuotientSums;
 
-  Farey() 
-    : myN( 1 )
+  void clear()
   {
-    addFraction( mySequence.end(), Fraction( Integer( 0 ), Integer( 1 ) ) );
-    addFraction( mySequence.end(), Fraction( Integer( 1 ), Integer( 1 ) ) );
+    myQuotientNbs.clear();
+    myQuotientSums.clear();
   }
 
-  void addFraction( Iterator it, Fraction f )
+  /// Adds the partial quotients of p/q, given by Euclid's algorithm.
+  void add( Integer p, Integer q )
   {
-    mySequence.insert( it, f );
-    for ( typename Fraction::ConstIterator itF = f.begin(), itFEnd = f.end();
-          itF != itFEnd; ++itF )
+    for ( std::size_t k = 0; q != 0; ++k )
       {
-        Integer k   = (*itF).second;
-        Integer u_k = (*itF).first;
+        Integer u_k = p / q;
+        Integer r   = p - u_k * q;
         if ( k >= myQuotientNbs.size() ) 
           {
-            myQuotientNbs.push_back( Integer( 1 ) );
-            myQuotientSums.push_back( u_k );
-          }
-        else
-          {
-            myQuotientNbs[ k ]  += Integer( 1 );
-            myQuotientSums[ k ] += u_k;
+            myQuotientNbs.push_back( Integer( 0 ) );
+            myQuotientSums.push_back( Integer( 0 ) );
           }
+        myQuotientNbs[ k ]  += Integer( 1 );
+        myQuotientSums[ k ] += u_k;
+        p = q;
+        q = r;
       }
   }
 
-  Integer       n() const     { return myN; }
-  Integer       size() const  { return mySequence.size(); };
-  ConstIterator begin() const { return mySequence.begin(); }
-  ConstIterator end() const   { return mySequence.end(); }
-  Integer       next() 
+  /// Adds the statistics \a S to these ones.
+  void merge( const QuotientStatistics & S )
   {
-    Integer nb = 0;
-    myN       += 1;
-    Iterator it = mySequence.begin(); ++it;
-    Iterator itE = mySequence.end();  --itE;
-    if ( it == itE ) 
+    if ( S.myQuotientNbs.size() > myQuotientNbs.size() )
       {
-        addFraction( it, Fraction( Integer( 1 ), Integer( 2 ) ) );
-        nb += 1;
+        myQuotientNbs.resize( S.myQuotientNbs.size(), Integer( 0 ) );
+        myQuotientSums.resize( S.myQuotientNbs.size(), Integer( 0 ) );
       }
-    while ( it != itE )
+    for ( std::size_t k = 0; k < S.myQuotientNbs.size(); ++k )
       {
-        Iterator itNext = it; ++itNext;
-        Fraction nleft = it->left();
-        // std::cout << " " << nleft.p() << "/" << nleft.q() << std::endl;
-        if ( nleft.q() == myN ) 
-          {
-            addFraction( it, nleft );
-            nb += 1;
-          }
-        Fraction nright = it->right();
-        if ( nright.q() == myN )
-          {
-            addFraction( itNext, nright );
-            nb += 1;
-          }
-        it = itNext;
+        myQuotientNbs[ k ]  += S.myQuotientNbs[ k ];
+        myQuotientSums[ k ] += S.myQuotientSums[ k ];
       }
-    return nb;
   }
-  
+
   Integer getSumOfQuotients() const
   {
     Integer s = 0;
@@ -139,39 +116,378 @@ struct Farey
   }
 };
 
+/**
+   The quotient statistics of the Farey sequences F(1), F(2), ...,
+   F(n), built order by order: the terms of F(m) that are not in
+   F(m-1) are the fractions p/m with p coprime with m (and 0/1, 1/1
+   for m=1).
+
+   Orders are processed by blocks: the terms of the orders of a block
+   are analyzed by several threads, then their statistics are added
+   in increasing order and the visitor is called for each order.
+*/
+template <typename TInteger>
+struct FareyOrders : public QuotientStatistics<TInteger>
+{
+  typedef TInteger                   Integer;
+  typedef QuotientStatistics<Integer> Statistics;
+
+  Integer myM;    ///< current order
+  Integer mySize; ///< number of terms of F(myM)
+
+  FareyOrders() : myM( 0 ), mySize( 0 ) {}
+
+  /**
+     Computes the statistics of F(1), ..., F(n) with \a nbThreads
+     threads, and calls \a f( *this ) for each order.
+
+     @param addOrder a thread-safe functor such that addOrder( m, S )
+     adds to S the partial quotients of the terms of denominator m
+     and returns their number.
+  */
+  template <typename Order, typename Visitor>
+  void run( Integer n, unsigned int nbThreads, Order addOrder, Visitor f )
+  {
+    nbThreads = std::max( 1u, nbThreads );
+    const Integer B = 64 * nbThreads;
+    std::vector<Statistics> stats( B );
+    std::vector<Integer>    sizes( B );
+    myM = mySize = 0;
+    this->clear();
+    for ( Integer b = 1; b <= n; b += B )
+      {
+        Integer e = std::min( b + B, n + 1 );
+        std::atomic<Integer> next( b );
+        auto work = [&] () {
+          for ( Integer m = next++; m < e; m = next++ )
+            {
+              stats[ m - b ].clear();
+              sizes[ m - b ] = addOrder( m, stats[ m - b ] );
+            }
+        };
+        std::vector<std::thread> threads;
+        for ( unsigned int t = 1; t < nbThreads; ++t ) threads.push_back( std::thread( work ) );
+        work();
+        for ( auto & thread : threads ) thread.join();
+        for ( Integer m = b; m < e; ++m )
+          {
+            myM     = m;
+            mySize += sizes[ m - b ];
+            this->merge( stats[ m - b ] );
+            f( *this );
+          }
+      }
+  }
+
+  Integer n() const     { return myM; }
+  Integer size() const  { return mySize; }
+};
+
+/**
+   The Farey sequence F(n) of the irreducible fractions p/q of [0,1]
+   with q <= n, stored contiguously in increasing order, together with
+   the statistics of the partial quotients of their continued
+   fractions [u_0; u_1, ..., u_k].
+
+   Terms are generated by the next-term recurrence: if a/b < c/d are
+   consecutive in F(n), the next term is e/f with e = m c - a, f = m d
+   - b and m = floor( (n+b)/d ). The interval [0,1] is cut at the
+   fractions t/T, which belong to F(n) when T <= n, and each piece is
+   generated and analyzed by its own thread, its first successor being
+   computed by the extended Euclid algorithm.
+
+   The statistics of F(1), ..., F(n-1) are obtained from F(n) by
+   grouping its terms by denominator (see runOrders).
+*/
+template <typename TInteger>
+struct Farey : public QuotientStatistics<TInteger>
+{
+  typedef TInteger                   Integer;
+  typedef QuotientStatistics<Integer> Statistics;
+  struct Fraction {
+    Integer myP, myQ;
+    Fraction( Integer p = 0, Integer q = 1 ) : myP( p ), myQ( q ) {}
+    Integer p() const { return myP; }
+    Integer q() const { return myQ; }
+  };
+  typedef std::vector<Fraction> Sequence;
+  typedef typename Sequence::const_iterator ConstIterator;
+
+  Integer myN;
+  Sequence mySequence;
+
+  /// Builds F(n), n >= 1, with \a nbThreads threads.
+  Farey( Integer n = 1, unsigned int nbThreads = 1 )
+  {
+    init( n, nbThreads );
+  }
+
+  void init( Integer n, unsigned int nbThreads )
+  {
+    ASSERT( n >= 1 );
+    myN = n;
+    Integer T = std::max( Integer( 1 ), std::min( n, Integer( nbThreads ) ) );
+    std::vector<Sequence>    sequences( T );
+    std::vector<Statistics>  stats( T );
+    std::vector<std::thread> threads;
+    for ( Integer t = 1; t < T; ++t )
+      threads.push_back( std::thread( &Farey::generate, n, t, T, 
+                                      std::ref( sequences[ t ] ), std::ref( stats[ t ] ) ) );
+    generate( n, 0, T, sequences[ 0 ], stats[ 0 ] );
+    for ( auto & thread : threads ) thread.join();
+    // Concatenates the pieces and merges their statistics.
+    std::size_t size = 1;
+    for ( auto & seq : sequences ) size += seq.size();
+    mySequence.clear();
+    mySequence.reserve( size );
+    this->clear();
+    for ( Integer t = 0; t < T; ++t )
+      {
+        mySequence.insert( mySequence.end(), sequences[ t ].begin(), sequences[ t ].end() );
+        Sequence().swap( sequences[ t ] );
+        this->merge( stats[ t ] );
+      }
+    mySequence.push_back( Fraction( 1, 1 ) );
+    this->add( 1, 1 );
+  }
+
+  /// @return the term following a/b in F(n), a/b < 1, i.e. the
+  /// fraction c/d with bc - ad = 1 and d <= n maximal.
+  static Fraction successor( Integer n, Integer a, Integer b )
+  {
+    // Extended Euclid on (b,a): b x + a y = 1, then c = x, d = -y.
+    Integer r0 = b, r1 = a, x0 = 1, x1 = 0, y0 = 0, y1 = 1;
+    while ( r1 != 0 )
+      {
+        Integer q  = r0 / r1;
+        Integer r2 = r0 - q * r1; r0 = r1; r1 = r2;
+        Integer x2 = x0 - q * x1; x0 = x1; x1 = x2;
+        Integer y2 = y0 - q * y1; y0 = y1; y1 = y2;
+      }
+    Integer c = x0, d = -y0;
+    // All solutions are (c + k a, d + k b).
+    Integer k = ( n - d ) >= 0 ? ( n - d ) / b : -( ( d - n + b - 1 ) / b );
+    return Fraction( c + k * a, d + k * b );
+  }
+
+  /// Generates the terms of F(n) in [t/T,(t+1)/T[ and their statistics.
+  static void generate( Integer n, Integer t, Integer T, Sequence & seq, Statistics & stats )
+  {
+    Integer g = gcd( t, T );
+    Integer a = t / g, b = T / g;
+    g = gcd( t + 1, T );
+    Integer e = ( t + 1 ) / g, f = T / g;
+    Fraction next = successor( n, a, b );
+    Integer c = next.p(), d = next.q();
+    while ( a * f < e * b )
+      {
+        seq.push_back( Fraction( a, b ) );
+        stats.add( a, b );
+        Integer m = ( n + b ) / d;
+        Integer nc = m * c - a, nd = m * d - b;
+        a = c; b = d; c = nc; d = nd;
+      }
+  }
+
+  static Integer gcd( Integer a, Integer b )
+  {
+    while ( b != 0 ) { Integer r = a % b; a = b; b = r; }
+    return a;
+  }
+
+  Integer       n() const     { return myN; }
+  Integer       size() const  { return mySequence.size(); };
+  ConstIterator begin() const { return mySequence.begin(); }
+  ConstIterator end() const   { return mySequence.end(); }
+
+  /// @return the number of terms of ]0,1] of denominator n, i.e. phi(n).
+  Integer phi() const
+  {
+    Integer nb = 0;
+    for ( ConstIterator it = begin(), itE = end(); it != itE; ++it )
+      if ( ( it->q() == myN ) && ( it->p() != 0 ) ) nb += 1;
+    return nb;
+  }
+
+  /**
+     Computes the statistics of F(1), ..., F(n) with \a nbThreads
+     threads, and calls \a f( orders, phi ) for each order m, where
+     orders are the statistics of F(m) and phi[ q ] is the number of
+     terms of denominator q of F(n) (phi(q) for q >= 2).
+  */
+  template <typename Visitor>
+  void runOrders( unsigned int nbThreads, Visitor f ) const
+  {
+    // Groups the numerators by denominator (counting sort).
+    std::vector<std::size_t> starts( myN + 2, 0 );
+    for ( ConstIterator it = begin(), itE = end(); it != itE; ++it ) starts[ it->q() + 1 ] += 1;
+    std::vector<Integer> phi( myN + 1, Integer( 0 ) );
+    for ( Integer q = 1; q <= myN; ++q )
+      {
+        phi[ q ]         = starts[ q + 1 ];
+        starts[ q + 1 ] += starts[ q ];
+      }
+    std::vector<Integer>     numerators( mySequence.size() );
+    std::vector<std::size_t> pos( starts.begin(), starts.end() - 1 );
+    for ( ConstIterator it = begin(), itE = end(); it != itE; ++it )
+      numerators[ pos[ it->q() ]++ ] = it->p();
+    FareyOrders<Integer> orders;
+    orders.run( myN, nbThreads,
+                [&] ( Integer m, Statistics & S ) {
+                  for ( std::size_t i = starts[ m ]; i < starts[ m + 1 ]; ++i )
+                    S.add( numerators[ i ], m );
+                  return phi[ m ];
+                },
+                [&] ( const FareyOrders<Integer> & F ) { f( F, phi ); } );
+  }
+};
+
+/**
+   Statistics of the Farey sequences F(1), F(2), ..., F(n), computed
+   without storing them: the terms of denominator m are enumerated
+   with the prime factors of m given by a sieve of smallest prime
+   factors (which also gives the totients phi(m)). Only the partial
+   quotient statistics of the current order are kept.
+*/
+template <typename TInteger>
+struct FareyStream : public FareyOrders<TInteger>
+{
+  typedef TInteger                   Integer;
+  typedef QuotientStatistics<Integer> Statistics;
+
+  Integer myN;
+  std::vector<Integer> mySmallestPrimes;
+  std::vector<Integer> myPhi;
+
+  /// Prepares the sieve up to \a n.
+  FareyStream( Integer n )
+    : myN( n ),
+      mySmallestPrimes( n + 1, Integer( 0 ) ), myPhi( n + 1, Integer( 1 ) )
+  {
+    std::vector<Integer> primes;
+    for ( Integer m = 2; m <= n; ++m )
+      {
+        if ( mySmallestPrimes[ m ] == 0 )
+          {
+            mySmallestPrimes[ m ] = m;
+            myPhi[ m ] = m - 1;
+            primes.push_back( m );
+          }
+        for ( std::size_t i = 0; i < primes.size(); ++i )
+          {
+            Integer p = primes[ i ];
+            if ( ( p > mySmallestPrimes[ m ] ) || ( p * m > n ) ) break;
+            mySmallestPrimes[ p * m ] = p;
+            myPhi[ p * m ] = myPhi[ m ] * ( p == mySmallestPrimes[ m ] ? p : p - 1 );
+          }
+      }
+  }
+
+  /// Adds to \a S the partial quotients of the terms of denominator m.
+  /// @return their number, i.e. phi(m), or 2 for m=1.
+  Integer addOrder( Integer m, Statistics & S ) const
+  {
+    if ( m == 1 )
+      {
+        S.add( 0, 1 );
+        S.add( 1, 1 );
+        return 2;
+      }
+    Integer factors[ 64 ];
+    int     nbFactors = 0;
+    for ( Integer r = m; r > 1; )
+      {
+        Integer p = mySmallestPrimes[ r ];
+        factors[ nbFactors++ ] = p;
+        while ( r % p == 0 ) r /= p;
+      }
+    Integer nb = 0;
+    for ( Integer p = 1; p < m; ++p )
+      {
+        int i = 0;
+        while ( ( i < nbFactors ) && ( p % factors[ i ] != 0 ) ) ++i;
+        if ( i < nbFactors ) continue;
+        S.add( p, m );
+        nb += 1;
+      }
+    return nb;
+  }
+
+  /// Computes the statistics of F(1), ..., F(n) with \a nbThreads
+  /// threads, and calls \a f( *this ) for each order.
+  template <typename Visitor>
+  void run( unsigned int nbThreads, Visitor f )
+  {
+    FareyOrders<Integer>::run( myN, nbThreads,
+                               [this] ( Integer m, Statistics & S ) { return addOrder( m, S ); },
+                               [this,&f] ( const FareyOrders<Integer> & ) { f( *this ); } );
+  }
+
+  /// @return phi(m), 1 <= m <= myN.
+  Integer phi( Integer m ) const { return myPhi[ m ]; }
+  Integer phi() const   { return phi( this->myM ); }
+};
+
+/// Outputs the partial quotient statistics of the Farey sequence \a F.
+template <typename FareySequence>
+void printStatistics( const FareySequence & F )
+{
+  std::cout << "- # F(" << F.n() << ") = " << F.size() 
+            << " S_u = " << F.getSumOfQuotients()
+            << " N_u = " << F.getNbOfQuotients()
+            << " Avg_u = " << (double) F.getSumOfQuotients() / (double) F.getNbOfQuotients()
+            << std::endl;
+  std::cout << "  Nb_u[] =";
+  for ( int i = 0; i <= F.depth(); ++i )
+    {
+      std::cout << " " << F.myQuotientNbs[ i ];
+    }
+  std::cout << endl;
+  std::cout << " Avg_u[] =";
+  for ( int i = 0; i <= F.depth(); ++i )
+    {
+      std::cout << " " << (double) F.myQuotientSums[ i ] / (double) F.myQuotientNbs[ i ];
+    }
+  std::cout << endl;
+}
+
 int main( int argc, char* argv[] )
 {
   typedef DGtal::int64_t Integer;
-  typedef LighterSternBrocot<Integer,Integer,DGtal::StdMapRebinder>::Fraction Fraction; // arbitrary large fractions
 
-  Integer n = argc > 1 ? atoi( argv[ 1 ] ) : 100;
-
-  Farey<Fraction> F;
-  while ( F.n() != n )
+  // farey [-s] <n> [<nb_threads>]
+  bool stream = ( argc > 1 ) && ( std::string( argv[ 1 ] ) == "-s" );
+  int  arg    = stream ? 2 : 1;
+  Integer n = argc > arg ? atoi( argv[ arg ] ) : 100;
+  unsigned int nbThreads = argc > arg + 1 ? atoi( argv[ arg + 1 ] ) 
+    : std::max( 1u, std::thread::hardware_concurrency() );
+  if ( n < 1 )
     {
-      std::cout << "- # F(" << F.n() << ") = " << F.size() 
-                << " S_u = " << F.getSumOfQuotients()
-                << " N_u = " << F.getNbOfQuotients()
-                << " Avg_u = " << (double) F.getSumOfQuotients() / (double) F.getNbOfQuotients()
-                << std::endl;
-      std::cout << "  Nb_u[] =";
-      for ( int i = 0; i <= F.depth(); ++i )
-        {
-          std::cout << " " << F.myQuotientNbs[ i ];
-        }
-      std::cout << endl;
-      std::cout << " Avg_u[] =";
-      for ( int i = 0; i <= F.depth(); ++i )
-        {
-          std::cout << " " << (double) F.myQuotientSums[ i ] / (double) F.myQuotientNbs[ i ];
-        }
-      std::cout << endl;
-      // for ( Farey<Fraction>::ConstIterator it = F.begin(), itE = F.end();
-      //       it != itE; ++it )
-      //   std::cout << " " << it->p() << "/" << it->q();
-      // std::cout << std::endl;
-      Integer phi = F.next();
-      std::cout << "  phi(" << F.n() << ") = " << phi << std::endl;
+      std::cerr << "Usage: " << argv[ 0 ] << " [-s] <n> [<nb_threads>], with n >= 1." << std::endl;
+      return 1;
+    }
+
+  // Statistics of F(1), ..., F(n-1), each one followed by phi of the
+  // next order.
+  if ( stream )
+    { // Without storing the sequences.
+      FareyStream<Integer> S( n );
+      S.run( nbThreads, [n] ( const FareyStream<Integer> & F ) {
+          if ( F.n() == n ) return;
+          printStatistics( F );
+          std::cout << "  phi(" << F.n() + 1 << ") = " << F.phi( F.n() + 1 ) << std::endl;
+        } );
+      return 0;
     }
+  Farey<Integer> F( n, nbThreads );
+  // for ( Farey<Integer>::ConstIterator it = F.begin(), itE = F.end();
+  //       it != itE; ++it )
+  //   std::cout << " " << it->p() << "/" << it->q();
+  // std::cout << std::endl;
+  F.runOrders( nbThreads, [n] ( const FareyOrders<Integer> & O, const std::vector<Integer> & phi ) {
+      if ( O.n() == n ) return;
+      printStatistics( O );
+      std::cout << "  phi(" << O.n() + 1 << ") = " << phi[ O.n() + 1 ] << std::endl;
+    } );
   return 0;
 }
@@ -1,9 +1,18 @@
 // Author: Jacques-Olivier Lachaud
-// gcc -O3 -std=c99 -Wall -pedantic hierarchy.c -lm -o hierarchy
+// gcc -O3 -std=c99 -Wall -pedantic hierarchy.c -lm -pthread -o hierarchy
+#define _POSIX_C_SOURCE 200809L
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
 #include <assert.h>
+#include <time.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 // Not in math.h
 #define PI 3.14159265358979323846
@@ -16,6 +25,9 @@ Value square_int( int x );
 Value square( Value x );
 Value distance2( int x1, int y1, int z1, int x2, int y2, int z2 );
 Value distance( int x1, int y1, int z1, int x2, int y2, int z2 );
+unsigned long long Morton_spread( unsigned int v );
+unsigned long long Morton_code( int x, int y, int z );
+unsigned int       Morton_compact( unsigned long long x );
 
 // Defines moment functors
 typedef Value (* VoxelFunctor )( Value data, int x, int y, int z );
@@ -30,8 +42,17 @@ Value moment110( Value data, int x, int y, int z );
 Value moment101( Value data, int x, int y, int z );
 Value moment011( Value data, int x, int y, int z );
 
+// All the moments of order smaller or equal to 2, in this order.
+#define NB_MOMENTS 10
+VoxelFunctor moment_functors[ NB_MOMENTS ] = 
+  { moment000, moment100, moment010, moment001, moment200, 
+    moment020, moment002, moment110, moment101, moment011 };
 
-// A 3D image of size (2^lvl)^3
+
+// A 3D image of size (2^lvl)^3. Voxels are stored along the Morton
+// (Z-order) curve, so that the 8 children of the cell of index i at
+// level lvl-1 are the voxels of indices 8i to 8i+7, in the order
+// x first, then y, then z.
 struct SImage {
   int size;
   int lvl;
@@ -43,12 +64,27 @@ void  Image_init( Image* img, int k );
 Value Image_get( Image* img, int x, int y, int z );
 void  Image_set( Image* img, int x, int y, int z, Value v );
 void  Image_finish( Image* img );
+uint64_t Image_checksum( Image* img );
+
+// Per level constants of a hierarchy of max_lvl+1 levels.
+struct SLevelTables {
+  Value weight[ LVL+1 ]; // number of voxels in a cell of level k
+  Value diag  [ LVL+1 ]; // half diagonal of a cell of level k
+};
+typedef struct SLevelTables LevelTables;
+
+void LevelTables_init( LevelTables* T, int max_lvl );
+void LevelTables_bounds( const LevelTables* T, int max_k, Value r, int min_h,
+                         Value upper2[], Value lower2[] );
 
 // A MipMap structure, i.e. a hierarchy of images with coarser and
 // coarser resolution.
 struct SMipMap {
-  int   max_lvl;
-  Image hierarchy[ LVL+1 ];
+  int         max_lvl;
+  LevelTables tables;
+  Image       hierarchy[ LVL+1 ];
+  void*  mapping;      // file mapping holding the images, or 0
+  size_t mapping_size;
 };
 typedef struct SMipMap MipMap;
 
@@ -56,15 +92,180 @@ void   MipMap_init_from_image_and_functor( MipMap* mipmap, Image* img, VoxelFunc
 Image* MipMap_get_image( MipMap* mipmap, int lvl );
 void   MipMap_finish( MipMap* mipmap );
 
-// Those three functions traverse the octree as a kind of first-son /
-// right brother tree.
-void goUp( int xyzk[] );
-void goDown( int xyzk[] );
-int  goNext( int xyzk[] );
+// Applies f( data, b, e ) to nb_threads consecutive sub-ranges [b,e)
+// of [0,n), each one in its own thread.
+typedef void (* RangeFunctor )( void* data, size_t b, size_t e );
+void parallelFor( size_t n, int nb_threads, RangeFunctor f, void* data );
+
+// A MipMap of all the moments of order smaller or equal to 2 (see
+// moment_functors). The NB_MOMENTS values of the cell of Morton index
+// i at level k are stored contiguously in data[ k ], starting at
+// NB_MOMENTS*i.
+struct SMomentMipMap {
+  int         max_lvl;
+  LevelTables tables;
+  Value*      data[ LVL+1 ];
+  void*  mapping;      // file mapping holding the data, or 0
+  size_t mapping_size;
+};
+typedef struct SMomentMipMap MomentMipMap;
+
+void   MomentMipMap_init_from_image( MomentMipMap* mipmap, Image* img, int nb_threads );
+Value* MomentMipMap_get( MomentMipMap* mipmap, int x, int y, int z, int lvl );
+void   MomentMipMap_finish( MomentMipMap* mipmap );
+
+// MipMap files. A header gives the number of levels and of channels
+// (values per cell) and the checksum of the source volume, followed
+// by the levels 0 to max_lvl, each one starting at an offset multiple
+// of MIPMAP_FILE_ALIGN. A file is mapped read-only in memory and
+// queried directly, so that no construction is needed and processes
+// share the same pages. It is rejected if it was not built from a
+// volume with the expected checksum.
+#define MIPMAP_FILE_MAGIC   "MIPMAP3D"
+#define MIPMAP_FILE_VERSION 2
+#define MIPMAP_FILE_ALIGN   4096
+struct SMipMapFileHeader {
+  char     magic[ 8 ];
+  uint32_t version;
+  uint32_t endianness;  // 0x01020304 as written
+  uint32_t value_size;  // sizeof( Value )
+  uint32_t max_lvl;
+  uint32_t nb_channels; // 1 for a MipMap, NB_MOMENTS for a MomentMipMap
+  uint32_t reserved;
+  uint64_t source;      // Image_checksum of the source volume
+  uint64_t offset[ LVL+1 ]; // position of each level in the file
+};
+typedef struct SMipMapFileHeader MipMapFileHeader;
+
+// Return 0 on failure, or when mapping a file whose source checksum
+// is not \a source. A mapped MipMap is released by its finish function.
+int MipMap_save( MipMap* mipmap, const char* path, uint64_t source );
+int MipMap_map( MipMap* mipmap, const char* path, uint64_t source );
+int MomentMipMap_save( MomentMipMap* mipmap, const char* path, uint64_t source );
+int MomentMipMap_map( MomentMipMap* mipmap, const char* path, uint64_t source );
+
+// A sparse MipMap, for shapes much smaller than their domain. Cells
+// whose voxel values are all the same are stored once, as a leaf
+// node, at the coarsest possible level. Below them, nodes of non
+// uniform cells have 8 consecutive children down to the brick level
+// max_lvl - BRICK_H, where non uniform cells store a dense brick
+// made of their levels 1 to BRICK_H, in Morton order. Memory is thus
+// proportional to the number of non uniform bricks, i.e. to the
+// boundary of the shape, and not to its volume.
+#define BRICK_H 3
+struct SSparseNode {
+  Value value;    // average value of the cell
+  int   children; // index of the first child node, or of the brick at
+                  // the brick level, or -1 when the cell is uniform.
+};
+typedef struct SSparseNode SparseNode;
+
+struct SSparseMipMap {
+  int         max_lvl;
+  int         brick_lvl;
+  LevelTables tables;
+  SparseNode* nodes;   // nodes[ 0 ] is the root
+  int         nb_nodes, cap_nodes;
+  Value*      bricks;
+  int         nb_bricks, cap_bricks;
+};
+typedef struct SSparseMipMap SparseMipMap;
+
+// A volume given voxel by voxel, e.g. an implicit shape that is never
+// stored densely.
+typedef Value (* VoxelSource )( void* data, int x, int y, int z );
+Value Image_source( void* img, int x, int y, int z );
+
+void   SparseMipMap_init_from_image_and_functor( SparseMipMap* S, Image* img, VoxelFunctor f );
+void   SparseMipMap_init_from_source_and_functor( SparseMipMap* S, int lvl, 
+                                                  VoxelSource src, void* data, VoxelFunctor f );
+size_t SparseMipMap_memory( SparseMipMap* S );
+void   SparseMipMap_finish( SparseMipMap* S );
+
+// A box of voxels.
+struct SBox {
+  int min[ 3 ];
+  int max[ 3 ]; // included
+};
+typedef struct SBox Box;
+
+int Box_clamp( Box* B, int size );
+Box Box_parent( const Box* B );
+
+// A cell of the octree traversal, with its Morton index in its level.
+struct SOctreeCell {
+  int    x, y, z, k;
+  size_t index;
+};
+typedef struct SOctreeCell OctreeCell;
+
+void OctreeCell_test_children( const OctreeCell* C, int max_k, int qx, int qy, int qz,
+                               const Value upper2[], const Value lower2[],
+                               int inside[ 8 ], int crossing[ 8 ] );
+void integrateHierarchy( Value* const levels[], int nb_channels, int max_k, const LevelTables* T,
+                         int x0, int y0, int z0, Value r, int min_h,
+                         double acc[], int* nb_iterations, int* nb_accesses );
+
+// Exact integration over the voxels of a box, row by row: the span of
+// each row within the ball is computed analytically. integrateBall
+// integrates balls such that nb_channels * r^3 <= EXACT_VOLUME this
+// way, since it is then faster than the octree, and the other ones
+// with integrateHierarchy.
+#define EXACT_VOLUME 8192.0
+void integrateExactBox( const Value* data, int nb_channels, const Box* B,
+                        int x0, int y0, int z0, Value r2,
+                        double acc[], int* nb_iterations, int* nb_accesses );
+void integrateBall( Value* const levels[], int nb_channels, int max_k, const LevelTables* T,
+                    int x0, int y0, int z0, Value r,
+                    double acc[], int* nb_iterations, int* nb_accesses );
 
 Value computeExact( MipMap* M, int x0, int y0, int z0, Value r );
 Value computeHierarchy( MipMap* M, int x0, int y0, int z0, Value r );
 Value computeApproximateHierarchy( MipMap* M, int x0, int y0, int z0, Value r, int min_h );
+Value computeSparseHierarchy( SparseMipMap* S, int x0, int y0, int z0, Value r );
+Value computeSparseApproximateHierarchy( SparseMipMap* S, int x0, int y0, int z0, Value r, int min_h );
+
+// Incremental updates. After the voxels of an image within a box of
+// voxels have changed, only the cells above this box are recomputed.
+// A direct-mapped cache of the results of computeCachedHierarchy.
+struct SQueryCacheEntry {
+  int   x, y, z, min_h;
+  Value r;
+  Value value;
+  int   valid;
+};
+typedef struct SQueryCacheEntry QueryCacheEntry;
+
+struct SQueryCache {
+  int              mask;    // number of entries minus 1
+  QueryCacheEntry* entries;
+};
+typedef struct SQueryCache QueryCache;
+
+void  QueryCache_init( QueryCache* cache, int lg_size );
+void  QueryCache_finish( QueryCache* cache );
+void  QueryCache_invalidate_box( QueryCache* cache, const Box* box );
+Value computeCachedHierarchy( MipMap* M, QueryCache* cache, int x0, int y0, int z0, Value r, int min_h );
+void  MipMap_update_box( MipMap* mipmap, Image* img, VoxelFunctor f, 
+                         const Box* box, QueryCache* cache );
+void  MomentMipMap_update_box( MomentMipMap* mipmap, Image* img, const Box* box );
+
+// The integral invariants of a shape cap ball needed for curvature
+// estimation: its volume, its centroid and its covariance tensor
+// (centered at the centroid, not divided by the volume).
+struct SCovariance {
+  double volume;
+  double centroid[ 3 ];
+  double tensor  [ 6 ]; // xx, yy, zz, xy, xz, yz
+};
+typedef struct SCovariance Covariance;
+
+// Batch computation of integral invariants for many ball centers.
+void computeHierarchyMoments( MomentMipMap* M, int x0, int y0, int z0, Value r, double moments[] );
+void computeBallMoments( MomentMipMap* M, int x0, int y0, int z0, Value r, double moments[] );
+void Covariance_from_moments( Covariance* C, const double moments[] );
+void computeCovariances( MomentMipMap* M, int nb, const int centers[], Value r, 
+                         Covariance C[], int nb_threads );
 
 
 // Global variables to determine the complexity of "compute" functions.
@@ -97,23 +298,69 @@ Value distance( int x1, int y1, int z1, int x2, int y2, int z2 )
   return sqrt( distance2( x1, y1, z1, x2, y2, z2 ) );
 }
 
+// Spreads the 21 lowest bits of v so that two zero bits separate them.
+unsigned long long Morton_spread( unsigned int v )
+{
+  unsigned long long x = v & 0x1fffff;
+  x = ( x | ( x << 32 ) ) & 0x1f00000000ffffULL;
+  x = ( x | ( x << 16 ) ) & 0x1f0000ff0000ffULL;
+  x = ( x | ( x <<  8 ) ) & 0x100f00f00f00f00fULL;
+  x = ( x | ( x <<  4 ) ) & 0x10c30c30c30c30c3ULL;
+  x = ( x | ( x <<  2 ) ) & 0x1249249249249249ULL;
+  return x;
+}
+
+/*
+  Returns the position of (x,y,z) along the Morton (Z-order) curve,
+  i.e. the interleaving of the bits of z, y and x.
+*/
+unsigned long long Morton_code( int x, int y, int z )
+{
+  return Morton_spread( x ) | ( Morton_spread( y ) << 1 ) | ( Morton_spread( z ) << 2 );
+}
+
+// Inverse of Morton_spread: gathers every third bit of x.
+unsigned int Morton_compact( unsigned long long x )
+{
+  x &= 0x1249249249249249ULL;
+  x = ( x | ( x >>  2 ) ) & 0x10c30c30c30c30c3ULL;
+  x = ( x | ( x >>  4 ) ) & 0x100f00f00f00f00fULL;
+  x = ( x | ( x >>  8 ) ) & 0x1f0000ff0000ffULL;
+  x = ( x | ( x >> 16 ) ) & 0x1f00000000ffffULL;
+  x = ( x | ( x >> 32 ) ) & 0x1fffffULL;
+  return (unsigned int) x;
+}
+
 void Image_init( Image* img, int k )
 {
   img->lvl = k;
   img->size = 1 << k;
-  img->data = (Value*) malloc( (img->size)*(img->size)*(img->size)*sizeof( Value ) );
+  img->data = (Value*) malloc( ( (size_t) 1 << ( 3*k ) ) * sizeof( Value ) );
 }
 
 Value Image_get( Image* img, int x, int y, int z )
 {
-  int k = img->lvl;
-  return img->data[ ( ( ( z << k ) + y ) << k ) + x ];
+  return img->data[ Morton_code( x, y, z ) ];
 }
 
 void Image_set( Image* img, int x, int y, int z, Value v )
 {
-  int k = img->lvl;
-  img->data[ ( ( ( z << k ) + y ) << k ) + x ] = v;
+  img->data[ Morton_code( x, y, z ) ] = v;
+}
+
+/*
+  Returns a checksum of the level and of the values of the image
+  (FNV-1a over 32-bit words), which identifies the source volume of
+  a MipMap file.
+*/
+uint64_t Image_checksum( Image* img )
+{
+  size_t          n = ( (size_t) 1 << ( 3*img->lvl ) ) * sizeof( Value ) / sizeof( uint32_t );
+  const uint32_t* w = (const uint32_t*) img->data;
+  uint64_t        h = ( 0xcbf29ce484222325ULL ^ (uint64_t) img->lvl ) * 0x100000001b3ULL;
+  for ( size_t i = 0; i < n; ++i )
+    h = ( h ^ w[ i ] ) * 0x100000001b3ULL;
+  return h;
 }
 
 void Image_finish( Image* img )
@@ -127,22 +374,19 @@ void Image_finish( Image* img )
 void Image_ball( Image* img, int x0, int y0, int z0, float r )
 {
   Value r2 = r*r;
-  Value* data = img->data;
   for ( int z = 0; z < img->size; ++z )
     for ( int y = 0; y < img->size; ++y )
       for ( int x = 0; x < img->size; ++x )
-        {
-          if ( distance2( x0, y0, z0, x, y, z ) <= r2 )
-            *data++ = (Value) 1;
-          else
-            *data++ = (Value) 0;
-        }
+        Image_set( img, x, y, z, 
+                   distance2( x0, y0, z0, x, y, z ) <= r2 ? (Value) 1 : (Value) 0 );
 }
 
 void MipMap_init_from_image_and_functor( MipMap* mipmap, Image* img, VoxelFunctor f )
 {
   assert( ( img->lvl >= 0 ) && ( img->lvl <= LVL ) );
   mipmap->max_lvl = img->lvl;
+  mipmap->mapping = 0;
+  LevelTables_init( &mipmap->tables, mipmap->max_lvl );
   for ( int k = img->lvl; k >= 0; --k )
     {
       Image_init( &mipmap->hierarchy[ k ], k );
@@ -154,25 +398,19 @@ void MipMap_init_from_image_and_functor( MipMap* mipmap, Image* img, VoxelFuncto
     for ( int y = 0; y < src->size; ++y )
       for ( int x = 0; x < src->size; ++x )
         Image_set( dst, x, y, z, f( Image_get( src, x, y, z ), x, y, z ) );
-  // Compute hierarchy
+  // Compute hierarchy. In Morton order, the 8 children of a cell are
+  // contiguous.
   for ( int k = img->lvl - 1; k >= 0; --k )
     {
-      Image* src = MipMap_get_image( mipmap, k+1 );
-      Image* dst = MipMap_get_image( mipmap, k );
-      for ( int z = 0; z < dst->size; ++z )
-        for ( int y = 0; y < dst->size; ++y )
-          for ( int x = 0; x < dst->size; ++x )
-            {
-              Value f = Image_get( src,   2*x,   2*y,   2*z );
-              f      += Image_get( src, 2*x+1,   2*y,   2*z );
-              f      += Image_get( src,   2*x, 2*y+1,   2*z );
-              f      += Image_get( src, 2*x+1, 2*y+1,   2*z );
-              f      += Image_get( src,   2*x,   2*y, 2*z+1 );
-              f      += Image_get( src, 2*x+1,   2*y, 2*z+1 );
-              f      += Image_get( src,   2*x, 2*y+1, 2*z+1 );
-              f      += Image_get( src, 2*x+1, 2*y+1, 2*z+1 );
-              Image_set( dst, x, y, z, f / (Value) 8 );
-            }
+      const Value* src = MipMap_get_image( mipmap, k+1 )->data;
+      Value*       dst = MipMap_get_image( mipmap, k )->data;
+      size_t       n   = (size_t) 1 << ( 3*k );
+      for ( size_t i = 0; i < n; ++i, src += 8 )
+        {
+          Value f = src[ 0 ];
+          for ( int c = 1; c < 8; ++c ) f += src[ c ];
+          dst[ i ] = f / (Value) 8;
+        }
     }
 }
 
@@ -184,11 +422,291 @@ Image* MipMap_get_image( MipMap* mipmap, int lvl )
 
 void   MipMap_finish( MipMap* mipmap )
 {
+  if ( mipmap->mapping != 0 )
+    {
+      munmap( mipmap->mapping, mipmap->mapping_size );
+      mipmap->mapping = 0;
+    }
+  else
+    for ( int k = 0; k <= mipmap->max_lvl; ++k )
+      Image_finish( MipMap_get_image( mipmap, k ) );
+  mipmap->max_lvl = 0;
+}
+
+// A sub-range of a parallelFor, processed by one thread.
+struct SRange {
+  RangeFunctor f;
+  void*        data;
+  size_t       b, e;
+};
+typedef struct SRange Range;
+
+void* Range_run( void* arg )
+{
+  Range* R = (Range*) arg;
+  R->f( R->data, R->b, R->e );
+  return 0;
+}
+
+void parallelFor( size_t n, int nb_threads, RangeFunctor f, void* data )
+{
+  if ( nb_threads < 1 ) nb_threads = 1;
+  if ( (size_t) nb_threads > n / 4096 ) nb_threads = (int) ( n / 4096 ) + 1;
+  Range*     ranges  = (Range*)     malloc( nb_threads * sizeof( Range ) );
+  pthread_t* threads = (pthread_t*) malloc( nb_threads * sizeof( pthread_t ) );
+  int*       started = (int*)       malloc( nb_threads * sizeof( int ) );
+  for ( int t = 0; t < nb_threads; ++t )
+    {
+      ranges[ t ].f    = f;
+      ranges[ t ].data = data;
+      ranges[ t ].b    = n * t / nb_threads;
+      ranges[ t ].e    = n * ( t+1 ) / nb_threads;
+      started[ t ]     = ( t > 0 ) 
+        && ( pthread_create( &threads[ t ], 0, Range_run, &ranges[ t ] ) == 0 );
+    }
+  for ( int t = 0; t < nb_threads; ++t ) // the calling thread does the rest.
+    if ( ! started[ t ] ) Range_run( &ranges[ t ] );
+  for ( int t = 0; t < nb_threads; ++t )
+    if ( started[ t ] ) pthread_join( threads[ t ], 0 );
+  free( started );
+  free( threads );
+  free( ranges );
+}
+
+// The levels read and written by the passes of MomentMipMap_init_from_image.
+struct SMomentPass {
+  const Value* src;
+  Value*       dst;
+};
+typedef struct SMomentPass MomentPass;
+
+// Computes the moments of the voxels of Morton indices in [b,e).
+// The expressions are those of moment_functors.
+void MomentPass_moments( void* data, size_t b, size_t e )
+{
+  MomentPass*  P   = (MomentPass*) data;
+  const Value* src = P->src + b;
+  Value*       dst = P->dst + NB_MOMENTS*b;
+  for ( size_t i = b; i < e; ++i, ++src, dst += NB_MOMENTS )
+    {
+      int   x = (int) Morton_compact( i );
+      int   y = (int) Morton_compact( i >> 1 );
+      int   z = (int) Morton_compact( i >> 2 );
+      Value v = *src;
+      Value vx = v*x, vy = v*y, vz = v*z;
+      dst[ 0 ] = v;
+      dst[ 1 ] = vx;
+      dst[ 2 ] = vy;
+      dst[ 3 ] = vz;
+      dst[ 4 ] = vx*x;
+      dst[ 5 ] = vy*y;
+      dst[ 6 ] = vz*z;
+      dst[ 7 ] = vx*y;
+      dst[ 8 ] = vx*z;
+      dst[ 9 ] = vy*z;
+    }
+}
+
+// Averages the moments of the 8 children of the cells of Morton
+// indices in [b,e). The children are the 8*NB_MOMENTS contiguous
+// values following src + 8*NB_MOMENTS*i, and the loop over moments
+// is vectorized.
+void MomentPass_reduce( void* data, size_t b, size_t e )
+{
+  MomentPass*  P   = (MomentPass*) data;
+  const Value* src = P->src + 8*NB_MOMENTS*b;
+  Value*       dst = P->dst + NB_MOMENTS*b;
+  for ( size_t i = b; i < e; ++i, src += 8*NB_MOMENTS, dst += NB_MOMENTS )
+    {
+      Value f[ NB_MOMENTS ];
+      for ( int m = 0; m < NB_MOMENTS; ++m ) f[ m ] = src[ m ];
+      for ( int c = 1; c < 8; ++c )
+        for ( int m = 0; m < NB_MOMENTS; ++m ) f[ m ] += src[ c*NB_MOMENTS + m ];
+      for ( int m = 0; m < NB_MOMENTS; ++m ) dst[ m ] = f[ m ] / (Value) 8;
+    }
+}
+
+/*
+  Builds all the moment hierarchies of \a img at once: the moments
+  are computed in one streaming pass over the image, then each level
+  is reduced from the finer one. Both passes are split among \a
+  nb_threads threads. Values are the same as the ones of
+  MipMap_init_from_image_and_functor with each moment functor.
+*/
+void MomentMipMap_init_from_image( MomentMipMap* mipmap, Image* img, int nb_threads )
+{
+  assert( ( img->lvl >= 0 ) && ( img->lvl <= LVL ) );
+  mipmap->max_lvl = img->lvl;
+  mipmap->mapping = 0;
+  LevelTables_init( &mipmap->tables, mipmap->max_lvl );
+  for ( int k = img->lvl; k >= 0; --k )
+    mipmap->data[ k ] = (Value*) malloc( ( (size_t) NB_MOMENTS << ( 3*k ) ) * sizeof( Value ) );
+  MomentPass P;
+  P.src = img->data;
+  P.dst = mipmap->data[ img->lvl ];
+  parallelFor( (size_t) 1 << ( 3*img->lvl ), nb_threads, MomentPass_moments, &P );
+  for ( int k = img->lvl - 1; k >= 0; --k )
+    {
+      P.src = mipmap->data[ k+1 ];
+      P.dst = mipmap->data[ k ];
+      parallelFor( (size_t) 1 << ( 3*k ), nb_threads, MomentPass_reduce, &P );
+    }
+}
+
+Value* MomentMipMap_get( MomentMipMap* mipmap, int x, int y, int z, int lvl )
+{
+  assert( ( lvl >= 0 ) && ( lvl <= mipmap->max_lvl ) );
+  return mipmap->data[ lvl ] + NB_MOMENTS * Morton_code( x, y, z );
+}
+
+void MomentMipMap_finish( MomentMipMap* mipmap )
+{
+  if ( mipmap->mapping != 0 )
+    munmap( mipmap->mapping, mipmap->mapping_size );
   for ( int k = 0; k <= mipmap->max_lvl; ++k )
-    Image_finish( MipMap_get_image( mipmap, k ) );
+    {
+      if ( mipmap->mapping == 0 ) free( mipmap->data[ k ] );
+      mipmap->data[ k ] = 0;
+    }
+  mipmap->mapping = 0;
   mipmap->max_lvl = 0;
 }
 
+size_t MipMapFile_align( size_t offset )
+{
+  return ( offset + MIPMAP_FILE_ALIGN - 1 ) / MIPMAP_FILE_ALIGN * MIPMAP_FILE_ALIGN;
+}
+
+size_t MipMapFile_level_bytes( int nb_channels, int k )
+{
+  return ( (size_t) nb_channels << ( 3*k ) ) * sizeof( Value );
+}
+
+// Writes zeros until the position offset of file f.
+int MipMapFile_pad( FILE* f, size_t offset )
+{
+  static const char zeros[ 256 ] = { 0 };
+  long pos = ftell( f );
+  if ( pos < 0 ) return 0;
+  for ( size_t n = offset - (size_t) pos; n > 0; )
+    {
+      size_t m = n < sizeof( zeros ) ? n : sizeof( zeros );
+      if ( fwrite( zeros, 1, m, f ) != m ) return 0;
+      n -= m;
+    }
+  return 1;
+}
+
+/*
+  Writes the levels 0 to max_lvl of a MipMap with nb_channels values
+  per cell, built from a volume of checksum \a source, into the file
+  \a path. Returns 0 on failure.
+*/
+int MipMapFile_write( const char* path, int max_lvl, int nb_channels, Value* const levels[],
+                      uint64_t source )
+{
+  MipMapFileHeader H;
+  memset( &H, 0, sizeof( H ) );
+  memcpy( H.magic, MIPMAP_FILE_MAGIC, sizeof( H.magic ) );
+  H.version     = MIPMAP_FILE_VERSION;
+  H.endianness  = 0x01020304;
+  H.value_size  = sizeof( Value );
+  H.max_lvl     = max_lvl;
+  H.nb_channels = nb_channels;
+  H.source      = source;
+  size_t offset = MipMapFile_align( sizeof( H ) );
+  for ( int k = 0; k <= max_lvl; ++k )
+    {
+      H.offset[ k ] = offset;
+      offset = MipMapFile_align( offset + MipMapFile_level_bytes( nb_channels, k ) );
+    }
+  FILE* f = fopen( path, "wb" );
+  if ( f == 0 ) return 0;
+  int ok = fwrite( &H, sizeof( H ), 1, f ) == 1;
+  for ( int k = 0; ok && ( k <= max_lvl ); ++k )
+    {
+      size_t bytes = MipMapFile_level_bytes( nb_channels, k );
+      ok = MipMapFile_pad( f, H.offset[ k ] ) 
+        && ( fwrite( levels[ k ], 1, bytes, f ) == bytes );
+    }
+  ok = ok && MipMapFile_pad( f, offset );
+  return ( fclose( f ) == 0 ) && ok;
+}
+
+/*
+  Maps the MipMap file \a path in memory, read-only, checks that its
+  cells have nb_channels values and that it was built from a volume
+  of checksum \a source, and makes levels[ k ] point to its level k.
+  Returns the mapping, of size *size, or 0 on failure.
+*/
+void* MipMapFile_map( const char* path, int nb_channels, uint64_t source, int* max_lvl, 
+                      Value* levels[], size_t* size )
+{
+  int fd = open( path, O_RDONLY );
+  if ( fd < 0 ) return 0;
+  struct stat st;
+  if ( ( fstat( fd, &st ) != 0 ) || ( (size_t) st.st_size < sizeof( MipMapFileHeader ) ) )
+    { close( fd ); return 0; }
+  *size = (size_t) st.st_size;
+  void* map = mmap( 0, *size, PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd ); // the mapping stays valid.
+  if ( map == MAP_FAILED ) return 0;
+  const MipMapFileHeader* H = (const MipMapFileHeader*) map;
+  int ok = ( memcmp( H->magic, MIPMAP_FILE_MAGIC, sizeof( H->magic ) ) == 0 )
+    && ( H->version == MIPMAP_FILE_VERSION ) && ( H->endianness == 0x01020304 )
+    && ( H->value_size == sizeof( Value ) ) && ( H->max_lvl <= LVL )
+    && ( H->nb_channels == (uint32_t) nb_channels ) && ( H->source == source );
+  for ( int k = 0; ok && ( k <= (int) H->max_lvl ); ++k )
+    {
+      ok = ( H->offset[ k ] % MIPMAP_FILE_ALIGN == 0 ) 
+        && ( H->offset[ k ] + MipMapFile_level_bytes( nb_channels, k ) <= *size );
+      levels[ k ] = (Value*) ( (char*) map + H->offset[ k ] );
+    }
+  if ( ! ok ) { munmap( map, *size ); return 0; }
+  *max_lvl = (int) H->max_lvl;
+  return map;
+}
+
+int MipMap_save( MipMap* mipmap, const char* path, uint64_t source )
+{
+  Value* levels[ LVL+1 ];
+  for ( int k = 0; k <= mipmap->max_lvl; ++k )
+    levels[ k ] = MipMap_get_image( mipmap, k )->data;
+  return MipMapFile_write( path, mipmap->max_lvl, 1, levels, source );
+}
+
+int MipMap_map( MipMap* mipmap, const char* path, uint64_t source )
+{
+  Value* levels[ LVL+1 ];
+  mipmap->mapping = MipMapFile_map( path, 1, source, &mipmap->max_lvl, levels, 
+                                    &mipmap->mapping_size );
+  if ( mipmap->mapping == 0 ) return 0;
+  LevelTables_init( &mipmap->tables, mipmap->max_lvl );
+  for ( int k = 0; k <= mipmap->max_lvl; ++k )
+    {
+      Image* img = MipMap_get_image( mipmap, k );
+      img->lvl   = k;
+      img->size  = 1 << k;
+      img->data  = levels[ k ];
+    }
+  return 1;
+}
+
+int MomentMipMap_save( MomentMipMap* mipmap, const char* path, uint64_t source )
+{
+  return MipMapFile_write( path, mipmap->max_lvl, NB_MOMENTS, mipmap->data, source );
+}
+
+int MomentMipMap_map( MomentMipMap* mipmap, const char* path, uint64_t source )
+{
+  mipmap->mapping = MipMapFile_map( path, NB_MOMENTS, source, &mipmap->max_lvl, 
+                                    mipmap->data, &mipmap->mapping_size );
+  if ( mipmap->mapping == 0 ) return 0;
+  LevelTables_init( &mipmap->tables, mipmap->max_lvl );
+  return 1;
+}
+
+
 Value moment000( Value data, int x, int y, int z )
 {
   return (Value) data;
@@ -230,77 +748,245 @@ Value moment011( Value data, int x, int y, int z )
   return (Value) data*y*z;
 }
 
+// The bits of x in a Morton code.
+#define MORTON_X 0x1249249249249249ULL
+
+/*
+  Adds to acc[ m ] the values of channel m of the finest level data
+  (nb_channels values per voxel, in Morton order) for the voxels of
+  the box B within the ball of center (x0,y0,z0) and squared radius
+  r2, with the same inclusion test as computeExact.
+
+  For each row (y,z), the span [x0-dx,x0+dx] of voxels inside the
+  ball is computed from a square root, and then adjusted so that
+  it matches the float test exactly. The voxels of the span are then
+  summed without any test, the Morton index of x+1 being obtained
+  from the one of x by a carry through the non-x bits. Counters,
+  if not null, are updated once per row.
+*/
+void integrateExactBox( const Value* data, int nb_channels, const Box* B,
+                        int x0, int y0, int z0, Value r2,
+                        double acc[], int* nb_iterations, int* nb_accesses )
+{
+  int nb_it = 0, nb_acc = 0;
+  for ( int z = B->min[ 2 ]; z <= B->max[ 2 ]; ++z )
+    {
+      Value sz = square_int( z0 - z );
+      for ( int y = B->min[ 1 ]; y <= B->max[ 1 ]; ++y )
+        {
+          Value  sy   = square_int( y0 - y );
+          double rest = (double) r2 - (double) sy - (double) sz;
+          int    dx   = rest >= 0.0 ? (int) sqrt( rest ) : -1;
+          // Same expression as distance2( x0, y0, z0, x, y, z ) <= r2.
+          while ( ( dx >= 0 ) && ! ( square_int( dx ) + sy + sz <= r2 ) ) --dx;
+          while ( square_int( dx + 1 ) + sy + sz <= r2 ) ++dx;
+          nb_it += B->max[ 0 ] - B->min[ 0 ] + 1;
+          int xa = x0 - dx < B->min[ 0 ] ? B->min[ 0 ] : x0 - dx;
+          int xb = x0 + dx > B->max[ 0 ] ? B->max[ 0 ] : x0 + dx;
+          if ( xa > xb ) continue;
+          nb_acc += xb - xa + 1;
+          unsigned long long i = Morton_code( xa, y, z );
+          if ( nb_channels == 1 )
+            {
+              double s = 0.0;
+              for ( int x = xa; x <= xb; ++x )
+                {
+                  s += data[ i ];
+                  i  = ( ( ( i | ~MORTON_X ) + 1 ) & MORTON_X ) | ( i & ~MORTON_X );
+                }
+              acc[ 0 ] += s;
+            }
+          else
+            for ( int x = xa; x <= xb; ++x )
+              {
+                const Value* v = data + nb_channels * i;
+                for ( int m = 0; m < nb_channels; ++m ) acc[ m ] += v[ m ];
+                i = ( ( ( i | ~MORTON_X ) + 1 ) & MORTON_X ) | ( i & ~MORTON_X );
+              }
+        }
+    }
+  if ( nb_iterations != 0 ) *nb_iterations += nb_it;
+  if ( nb_accesses   != 0 ) *nb_accesses   += nb_acc;
+}
+
 /*
   Compute the exact integration of the mipmap \a M within the ball of
   radius r and center (x0,y0,z0).
   
-  The method is a simple scanning at the finest scale.
+  The method is a scanning at the finest scale, row by row (see
+  integrateExactBox).
 */
 Value computeExact( MipMap* M, int x0, int y0, int z0, Value r )
 {
   Image* img = MipMap_get_image( M, M->max_lvl );
-  int minx = x0 - (int) ceil( r );
-  int miny = y0 - (int) ceil( r );
-  int minz = z0 - (int) ceil( r );
-  int maxx = x0 + (int) ceil( r );
-  int maxy = y0 + (int) ceil( r );
-  int maxz = z0 + (int) ceil( r );
-  minx = minx <= 0 ? 0 : minx;
-  miny = miny <= 0 ? 0 : miny;
-  minz = minz <= 0 ? 0 : minz;
-  maxx = maxx >= img->size ? img->size-1 : maxx;
-  maxy = maxy >= img->size ? img->size-1 : maxy;
-  maxz = maxz >= img->size ? img->size-1 : maxz;
-  Value r2  = r*r;
-  Value acc = (Value) 0;
-  for ( int z = minz; z <= maxz; ++z )
-    for ( int y = miny; y <= maxy; ++y )
-      for ( int x = minx; x <= maxx; ++x )
-        {
-          if ( distance2( x0, y0, z0, x, y, z ) <= r2 )
-            {
-              acc += Image_get( img, x, y, z );
-              nb_access_exact += 1;
-            }
-          nb_iteration_exact += 1;
-        }
-  return acc;
+  Box B = { { x0 - (int) ceil( r ), y0 - (int) ceil( r ), z0 - (int) ceil( r ) },
+            { x0 + (int) ceil( r ), y0 + (int) ceil( r ), z0 + (int) ceil( r ) } };
+  if ( ! Box_clamp( &B, img->size ) ) return (Value) 0;
+  double acc = 0.0;
+  integrateExactBox( img->data, 1, &B, x0, y0, z0, r*r, 
+                     &acc, &nb_iteration_exact, &nb_access_exact );
+  return (Value) acc;
 }
 
-void goUp( int xyzk[] )
+void LevelTables_init( LevelTables* T, int max_lvl )
+{
+  T->weight[ max_lvl ] = (Value) 1;
+  T->diag  [ max_lvl ] = (Value) (sqrt(3.0)/2.0);
+  for ( int i = max_lvl - 1; i >= 0; --i )
+    {
+      T->weight[ i ] = T->weight[ i+1 ] * (Value) 8;
+      T->diag  [ i ] = T->diag  [ i+1 ] * (Value) 2;
+    }
+}
+
+/*
+  Computes for each level k <= max_k the squared distances
+  upper2[ k ] = (r-diag/2)^2 and lower2[ k ] = (r+diag/2)^2 such
+  that a cell of level k whose center is at squared distance d2 of
+  the query is inside the ball if d2 <= upper2[ k ], and meets it
+  if d2 <= lower2[ k ]. When min_h > 0, diagonals are shrunk by the
+  one of cells of height min_h. Finest cells are either inside or
+  outside.
+*/
+void LevelTables_bounds( const LevelTables* T, int max_k, Value r, int min_h,
+                         Value upper2[], Value lower2[] )
 {
-  xyzk[ 0 ] >>= 1;
-  xyzk[ 1 ] >>= 1;
-  xyzk[ 2 ] >>= 1;
-  xyzk[ 3 ]  -= 1;
+  Value r2 = r*r;
+  for ( int k = 0; k <= max_k; ++k )
+    {
+      Value diag = T->diag[ k ];
+      if ( min_h > 0 ) diag -= (sqrt(3.0)/2.0) * (Value) ( 1 << (min_h) );
+      Value delta2 = square( diag );
+      upper2[ k ] = ( r2 >= delta2 ) ? r2 - 2.0*r*diag + delta2 : -1.0; // (r-diag/2)^2
+      lower2[ k ] = r2 + 2.0*r*diag + delta2; // (r+diag/2)^2
+    }
+  upper2[ max_k ] = lower2[ max_k ] = r2;
 }
-void goDown( int xyzk[] )
+
+/*
+  Tests together the 8 children of the cell C against the ball
+  centered at (qx,qy,qz) in Khalimsky coordinates, with the bounds
+  of LevelTables_bounds. Their squared distances are built from 2
+  values per axis, so that the loops over the children are
+  vectorized. Child i is at ( 2*C.x + (i&1), 2*C.y + ((i>>1)&1),
+  2*C.z + (i>>2) ).
+*/
+void OctreeCell_test_children( const OctreeCell* C, int max_k, int qx, int qy, int qz,
+                               const Value upper2[], const Value lower2[],
+                               int inside[ 8 ], int crossing[ 8 ] )
 {
-  xyzk[ 0 ] <<= 1;
-  xyzk[ 1 ] <<= 1;
-  xyzk[ 2 ] <<= 1;
-  xyzk[ 3 ]  += 1;
+  int   k = C->k + 1; // level of the children
+  int   h = max_k - k;
+  Value sx[ 2 ], sy[ 2 ], sz[ 2 ];
+  for ( int a = 0; a < 2; ++a )
+    { // The distance is computed in a kind of Khalimsky sense
+      // since centers of octree-cells are shifted from the origin.
+      sx[ a ] = square_int( ( ( 4*C->x + 2*a + 1 ) << h ) - qx );
+      sy[ a ] = square_int( ( ( 4*C->y + 2*a + 1 ) << h ) - qy );
+      sz[ a ] = square_int( ( ( 4*C->z + 2*a + 1 ) << h ) - qz );
+    }
+  Value cd2[ 8 ];
+  for ( int i = 0; i < 8; ++i )
+    cd2[ i ] = ( sx[ i & 1 ] + sy[ ( i >> 1 ) & 1 ] + sz[ i >> 2 ] ) / (Value) 4;
+  for ( int i = 0; i < 8; ++i )
+    {
+      inside  [ i ] = cd2[ i ] <= upper2[ k ];
+      crossing[ i ] = ( cd2[ i ] <= lower2[ k ] ) && ! inside[ i ];
+    }
 }
 
-/* The binomial tree is seen as son / 8-brother tree. */
-/* return 0 when finished. */
-int goNext( int xyzk[] )
+/*
+  The octree traversal shared by computeHierarchy,
+  computeApproximateHierarchy and computeHierarchyMoments. It adds to
+  acc[ m ] the integration of channel m of the given levels (with
+  nb_channels values per cell, in Morton order) within the ball of
+  radius r and center (x0,y0,z0). Cells of height min_h or less are
+  not subdivided.
+
+  The bounds (r -/+ diag/2)^2 are computed once per level (see
+  LevelTables_bounds). Cells that intersect the sphere are kept in an
+  explicit stack, and the 8 children of a popped cell are tested
+  together (see OctreeCell_test_children). Children are at 8*index+i
+  in the next level. Cells completely inside are accumulated, and the
+  counters, if not null, count the tested and accumulated cells.
+*/
+void integrateHierarchy( Value* const levels[], int nb_channels, int max_k, const LevelTables* T,
+                         int x0, int y0, int z0, Value r, int min_h,
+                         double acc[], int* nb_iterations, int* nb_accesses )
 {
-  while ( ( xyzk[ 0 ] & 0x1 ) && ( xyzk[ 1 ] & 0x1 ) && ( xyzk[ 2 ] & 0x1 ) )
-    goUp( xyzk );
-  if ( xyzk[ 3 ] == 0 ) { xyzk[ 3 ] = -1; return 0; }
-  if ( ( xyzk[ 0 ] & 0x1 ) == 0 )  
-    xyzk[ 0 ] += 1; 
-  else {
-    xyzk[ 0 ] &= ~0x1;
-    if ( ( xyzk[ 1 ] & 0x1 ) == 0 )
-      xyzk[ 1 ] += 1;
-    else {
-      xyzk[ 1 ] &= ~0x1;
-      xyzk[ 2 ] += 1;
+  Value upper2[ LVL+1 ];
+  Value lower2[ LVL+1 ];
+  LevelTables_bounds( T, max_k, r, min_h, upper2, lower2 );
+  int max_down = max_k - ( min_h > 0 ? min_h : 0 ); // cells above are subdivided.
+  int qx = 2*x0+1, qy = 2*y0+1, qz = 2*z0+1; // query in Khalimsky coordinates
+  int nb_it = 1, nb_acc = 0;
+
+  OctreeCell stack[ 8*(LVL+1) ];
+  int        top = 0;
+  Value      d2  = distance2( 1 << max_k, 1 << max_k, 1 << max_k, qx, qy, qz ) / (Value) 4;
+  if ( d2 <= upper2[ 0 ] )
+    {
+      for ( int m = 0; m < nb_channels; ++m )
+        acc[ m ] += T->weight[ 0 ] * levels[ 0 ][ m ];
+      nb_acc += 1;
     }
-  }
-  return 1;
+  else if ( ( d2 <= lower2[ 0 ] ) && ( 0 < max_down ) )
+    {
+      OctreeCell root = { 0, 0, 0, 0, 0 };
+      stack[ top++ ] = root;
+    }
+  while ( top > 0 )
+    {
+      OctreeCell C = stack[ --top ];
+      int        k = C.k + 1; // level of the children
+      int        inside[ 8 ], crossing[ 8 ];
+      OctreeCell_test_children( &C, max_k, qx, qy, qz, upper2, lower2, inside, crossing );
+      const Value* v = levels[ k ] + (size_t) nb_channels * 8 * C.index;
+      Value        w = T->weight[ k ];
+      for ( int i = 0; i < 8; ++i )
+        if ( inside[ i ] )
+          {
+            for ( int m = 0; m < nb_channels; ++m )
+              acc[ m ] += w * v[ nb_channels*i + m ];
+            nb_acc += 1;
+          }
+      if ( k < max_down )
+        for ( int i = 7; i >= 0; --i ) // child 0 is visited first.
+          if ( crossing[ i ] )
+            {
+              OctreeCell D = { 2*C.x + ( i & 1 ), 2*C.y + ( ( i >> 1 ) & 1 ), 2*C.z + ( i >> 2 ), k,
+                               8*C.index + i };
+              stack[ top++ ] = D;
+            }
+      nb_it += 8;
+    }
+  if ( nb_iterations != 0 ) *nb_iterations += nb_it;
+  if ( nb_accesses   != 0 ) *nb_accesses   += nb_acc;
+}
+
+/*
+  Exact integration of the ball of radius r and center (x0,y0,z0),
+  as integrateHierarchy with min_h = 0, but small balls (see
+  EXACT_VOLUME) are integrated by integrateExactBox on the finest
+  level: for them, scanning the rows of the bounding box is faster
+  than descending the octree down to the voxels. Sums may differ from
+  the ones of integrateHierarchy in their last bits.
+*/
+void integrateBall( Value* const levels[], int nb_channels, int max_k, const LevelTables* T,
+                    int x0, int y0, int z0, Value r,
+                    double acc[], int* nb_iterations, int* nb_accesses )
+{
+  if ( (double) nb_channels * r * r * r > EXACT_VOLUME )
+    {
+      integrateHierarchy( levels, nb_channels, max_k, T, x0, y0, z0, r, 0,
+                          acc, nb_iterations, nb_accesses );
+      return;
+    }
+  Box B = { { x0 - (int) ceil( r ), y0 - (int) ceil( r ), z0 - (int) ceil( r ) },
+            { x0 + (int) ceil( r ), y0 + (int) ceil( r ), z0 + (int) ceil( r ) } };
+  if ( Box_clamp( &B, 1 << max_k ) )
+    integrateExactBox( levels[ max_k ], nb_channels, &B, x0, y0, z0, r*r,
+                       acc, nb_iterations, nb_accesses );
 }
 
 /*
@@ -313,70 +999,15 @@ int goNext( int xyzk[] )
 */
 Value computeHierarchy( MipMap* M, int x0, int y0, int z0, Value r )
 {
-  Value weight[ LVL+1 ];
-  Value diag  [ LVL+1 ];
-  int max_k       = M->max_lvl; // number of levels in the hierarchy
-  weight[ max_k ] = (Value) 1;
-  diag  [ max_k ] = (Value) (sqrt(3.0)/2.0);
-  for ( int i = max_k - 1; i >= 0; --i )
-    {
-      weight[ i ] = weight[ i+1 ] * (Value) 8;
-      diag  [ i ] = diag  [ i+1 ] * (Value) 2;
-    }
-  int xyzk[ 4 ] = { 0, 0, 0, 0 };
-  Value acc = 0;
-  Value r2  = r*r;
-  do 
-    {
-      nb_iteration_hierarchy += 1;
-      int k = xyzk[ 3 ];  // current level in the hierarchy
-      int h = max_k - k;  // height in hierarchy (max_k - k )
-      // The distance must be computed in a kind of Khalimsky sense
-      // since centers of octree-cells are shifted from the origin (of
-      // (1<<h)/2.0)
-      Value dK2    = distance2( ( 2*xyzk[ 0 ] + 1) << h, ( 2*xyzk[ 1 ] + 1) << h, ( 2*xyzk[ 2 ] + 1 ) << h, 
-                                2*x0+1, 2*y0+1, 2*z0+1 );
-      Value d2     = dK2 / (Value) 4; // Divide by 4 to get back the distance.
-      Value delta2 = square( diag[ k ] );
-      Value upper2 = ( r2 >= delta2 ) ? r2 - 2.0*r*diag[ k ] + delta2 : -1.0; // (r-diag/2)^2
-      Value lower2 = r2 + 2.0*r*diag[ k ] + delta2; // (r+diag/2)^2
-      //printf( "[%d] %d %d %d | l2=%f d2=%f u2=%f\n", k, xyzk[ 0 ], xyzk[ 1 ], xyzk[ 2 ], lower2, d2, upper2 );
-      // Takes care of finest cells.
-      if ( h == 0 ) 
-        {
-          if ( d2 <= r2 ) 
-            { // cell is completely inside
-              // printf("[%d] %d %d %d\n", k, xyzk[ 0 ], xyzk[ 1 ], xyzk[ 2 ] );
-              acc += Image_get( MipMap_get_image( M, k ), 
-                                xyzk[ 0 ], xyzk[ 1 ], xyzk[ 2 ] ); 
-              nb_access_hierarchy += 1;
-              goNext( xyzk );
-            }
-          else // cell is completely outside
-            goNext( xyzk );
-        }
-      else
-        { // cell is completely inside
-          if ( d2 <= upper2 ) 
-            {
-              // printf("[%d] %d %d %d\n", k, xyzk[ 0 ], xyzk[ 1 ], xyzk[ 2 ] );
-              acc += weight[ k ] * Image_get( MipMap_get_image( M, k ), 
-                                              xyzk[ 0 ], xyzk[ 1 ], xyzk[ 2 ] );
-              nb_access_hierarchy += 1;
-              goNext( xyzk );
-            }
-          else if ( d2 > lower2 )
-            // cell is completely outside
-            goNext( xyzk );                 
-          else goDown( xyzk );
-        }
-    }
-  while ( xyzk[ 3 ] > 0 );
-  return acc;
+  Value* levels[ LVL+1 ];
+  for ( int k = 0; k <= M->max_lvl; ++k )
+    levels[ k ] = MipMap_get_image( M, k )->data;
+  double acc = 0.0;
+  integrateHierarchy( levels, 1, M->max_lvl, &M->tables, x0, y0, z0, r, 0, 
+                      &acc, &nb_iteration_hierarchy, &nb_access_hierarchy );
+  return (Value) acc;
 }
 
-
-
 /*
   Compute the approximate integration of the mipmap \a M within the ball of
   radius r and center (x0,y0,z0).
@@ -390,73 +1021,569 @@ Value computeHierarchy( MipMap* M, int x0, int y0, int z0, Value r )
 */
 Value computeApproximateHierarchy( MipMap* M, int x0, int y0, int z0, Value r, int min_h )
 {
-  Value weight[ LVL+1 ];
-  Value diag  [ LVL+1 ];
-  int max_k       = M->max_lvl; // number of levels in the hierarchy
-  weight[ max_k ] = (Value) 1;
-  diag  [ max_k ] = (Value) (sqrt(3.0)/2.0);
-  for ( int i = max_k - 1; i >= 0; --i )
-    {
-      weight[ i ] = weight[ i+1 ] * (Value) 8;
-      diag  [ i ] = diag  [ i+1 ] * (Value) 2;
-    }
-  if ( min_h  > 0 )
-    for ( int i = max_k; i >= 0; --i )
-      diag  [ i ] -= (sqrt(3.0)/2.0) * (Value) ( 1 << (min_h) );
-
-  int xyzk[ 4 ] = { 0, 0, 0, 0 };
-  Value acc     = 0;
-  Value r2      = r*r;
-  do 
-    {
-      nb_iteration_approx[ min_h ] += 1;
-      int k = xyzk[ 3 ];  // current level in the hierarchy
-      int h = max_k - k;  // height in hierarchy (max_k - k )
-      // The distance must be computed in a kind of Khalimsky sense
-      // since centers of octree-cells are shifted from the origin (of
-      // (1<<h)/2.0)
-      Value dK2    = distance2( ( 2*xyzk[ 0 ] + 1) << h, ( 2*xyzk[ 1 ] + 1) << h, ( 2*xyzk[ 2 ] + 1 ) << h, 
-                                2*x0+1, 2*y0+1, 2*z0+1 );
-      Value d2     = dK2 / (Value) 4; // Divide by 4 to get back the distance.
-      Value delta2 = square( diag[ k ] );
-      Value upper2 = ( r2 >= delta2 ) ? r2 - 2.0*r*diag[ k ] + delta2 : -1.0; // (r-diag/2)^2
-      Value lower2 = r2 + 2.0*r*diag[ k ] + delta2; // (r+diag/2)^2
-      //printf( "[%d] %d %d %d | l2=%f d2=%f u2=%f\n", k, xyzk[ 0 ], xyzk[ 1 ], xyzk[ 2 ], lower2, d2, upper2 );
-      // Takes care of finest cells.
-      if ( h == 0 ) 
-        {
-          if ( d2 <= r2 ) 
-            { // cell is completely inside
-              // printf("[%d] %d %d %d\n", k, xyzk[ 0 ], xyzk[ 1 ], xyzk[ 2 ] );
-              acc += Image_get( MipMap_get_image( M, k ), 
-                                xyzk[ 0 ], xyzk[ 1 ], xyzk[ 2 ] ); 
-              nb_access_approx[ min_h ] += 1;
-              goNext( xyzk );
+  Value* levels[ LVL+1 ];
+  for ( int k = 0; k <= M->max_lvl; ++k )
+    levels[ k ] = MipMap_get_image( M, k )->data;
+  double acc = 0.0;
+  integrateHierarchy( levels, 1, M->max_lvl, &M->tables, x0, y0, z0, r, min_h, 
+                      &acc, &nb_iteration_approx[ min_h ], &nb_access_approx[ min_h ] );
+  return (Value) acc;
+}
+
+
+// Clamps the box B to the domain [0,size-1]^3.
+// Returns 0 if it does not meet it.
+int Box_clamp( Box* B, int size )
+{
+  for ( int i = 0; i < 3; ++i )
+    {
+      B->min[ i ] = B->min[ i ] < 0 ? 0 : B->min[ i ];
+      B->max[ i ] = B->max[ i ] >= size ? size-1 : B->max[ i ];
+      if ( B->min[ i ] > B->max[ i ] ) return 0;
+    }
+  return 1;
+}
+
+// Returns the box of the parent cells of the cells of B.
+Box Box_parent( const Box* B )
+{
+  Box P;
+  for ( int i = 0; i < 3; ++i )
+    {
+      P.min[ i ] = B->min[ i ] >> 1;
+      P.max[ i ] = B->max[ i ] >> 1;
+    }
+  return P;
+}
+
+/*
+  Updates the mipmap \a mipmap of \a img and \a f after a change of the
+  voxels of \a img within the box \a box: the voxels of the box are
+  recomputed, then only the cells above them, level by level, in the
+  same way as MipMap_init_from_image_and_functor. The cost is thus the
+  volume of the box plus the number of levels. If \a cache is not 0,
+  the queries that may have read these voxels are forgotten.
+*/
+void MipMap_update_box( MipMap* mipmap, Image* img, VoxelFunctor f, 
+                        const Box* box, QueryCache* cache )
+{
+  assert( mipmap->mapping == 0 ); // mapped files are read-only.
+  Box B = *box;
+  if ( ! Box_clamp( &B, img->size ) ) return;
+  if ( cache != 0 ) QueryCache_invalidate_box( cache, &B );
+  Image* dst = MipMap_get_image( mipmap, img->lvl );
+  for ( int z = B.min[ 2 ]; z <= B.max[ 2 ]; ++z )
+    for ( int y = B.min[ 1 ]; y <= B.max[ 1 ]; ++y )
+      for ( int x = B.min[ 0 ]; x <= B.max[ 0 ]; ++x )
+        Image_set( dst, x, y, z, f( Image_get( img, x, y, z ), x, y, z ) );
+  for ( int k = img->lvl - 1; k >= 0; --k )
+    {
+      B = Box_parent( &B );
+      const Value* src = MipMap_get_image( mipmap, k+1 )->data;
+      Image*       dst = MipMap_get_image( mipmap, k );
+      for ( int z = B.min[ 2 ]; z <= B.max[ 2 ]; ++z )
+        for ( int y = B.min[ 1 ]; y <= B.max[ 1 ]; ++y )
+          for ( int x = B.min[ 0 ]; x <= B.max[ 0 ]; ++x )
+            {
+              const Value* c = src + 8 * Morton_code( x, y, z );
+              Value v = c[ 0 ];
+              for ( int i = 1; i < 8; ++i ) v += c[ i ];
+              Image_set( dst, x, y, z, v / (Value) 8 );
             }
-          else // cell is completely outside
-            goNext( xyzk );
+    }
+}
+
+/*
+  Same as MipMap_update_box for all the moments of \a mipmap.
+*/
+void MomentMipMap_update_box( MomentMipMap* mipmap, Image* img, const Box* box )
+{
+  assert( mipmap->mapping == 0 ); // mapped files are read-only.
+  Box B = *box;
+  if ( ! Box_clamp( &B, img->size ) ) return;
+  MomentPass P;
+  P.src = img->data;
+  P.dst = mipmap->data[ img->lvl ];
+  for ( int k = img->lvl; k >= 0; --k )
+    {
+      for ( int z = B.min[ 2 ]; z <= B.max[ 2 ]; ++z )
+        for ( int y = B.min[ 1 ]; y <= B.max[ 1 ]; ++y )
+          for ( int x = B.min[ 0 ]; x <= B.max[ 0 ]; ++x )
+            {
+              size_t i = Morton_code( x, y, z );
+              if ( k == img->lvl ) MomentPass_moments( &P, i, i+1 );
+              else                 MomentPass_reduce ( &P, i, i+1 );
+            }
+      if ( k > 0 )
+        {
+          B     = Box_parent( &B );
+          P.src = mipmap->data[ k ];
+          P.dst = mipmap->data[ k-1 ];
+        }
+    }
+}
+
+void QueryCache_init( QueryCache* cache, int lg_size )
+{
+  cache->mask    = ( 1 << lg_size ) - 1;
+  cache->entries = (QueryCacheEntry*) calloc( cache->mask + 1, sizeof( QueryCacheEntry ) );
+}
+
+void QueryCache_finish( QueryCache* cache )
+{
+  free( cache->entries );
+  cache->entries = 0;
+  cache->mask    = 0;
+}
+
+QueryCacheEntry* QueryCache_slot( QueryCache* cache, int x0, int y0, int z0, Value r, int min_h )
+{
+  unsigned int rb;
+  memcpy( &rb, &r, sizeof( rb ) < sizeof( r ) ? sizeof( rb ) : sizeof( r ) );
+  unsigned long long h = Morton_code( x0, y0, z0 ) * 0x9e3779b97f4a7c15ULL;
+  h ^= ( (unsigned long long) rb * 0xc2b2ae3d27d4eb4fULL ) ^ (unsigned long long) min_h;
+  return &cache->entries[ ( h >> 32 ) & cache->mask ];
+}
+
+/*
+  Returns computeHierarchy( M, x0, y0, z0, r ) if min_h is 0,
+  computeApproximateHierarchy( M, x0, y0, z0, r, min_h ) otherwise,
+  memoized in \a cache, which must be used for this mipmap only.
+*/
+Value computeCachedHierarchy( MipMap* M, QueryCache* cache, int x0, int y0, int z0, Value r, int min_h )
+{
+  QueryCacheEntry* E = QueryCache_slot( cache, x0, y0, z0, r, min_h );
+  if ( E->valid && ( E->x == x0 ) && ( E->y == y0 ) && ( E->z == z0 ) 
+       && ( E->r == r ) && ( E->min_h == min_h ) )
+    return E->value;
+  E->x     = x0;
+  E->y     = y0;
+  E->z     = z0;
+  E->r     = r;
+  E->min_h = min_h;
+  E->value = ( min_h == 0 ) ? computeHierarchy( M, x0, y0, z0, r )
+    : computeApproximateHierarchy( M, x0, y0, z0, r, min_h );
+  E->valid = 1;
+  return E->value;
+}
+
+/*
+  Forgets the queries whose result may depend on the voxels of \a
+  box, i.e. whose ball, enlarged by the diagonal of the cells of
+  height min_h for approximate ones, meets the box.
+*/
+void QueryCache_invalidate_box( QueryCache* cache, const Box* box )
+{
+  for ( int i = 0; i <= cache->mask; ++i )
+    {
+      QueryCacheEntry* E = &cache->entries[ i ];
+      if ( ! E->valid ) continue;
+      int    c[ 3 ] = { E->x, E->y, E->z };
+      double d2     = 0.0;
+      for ( int j = 0; j < 3; ++j )
+        {
+          int d = c[ j ] < box->min[ j ] ? box->min[ j ] - c[ j ]
+            : ( c[ j ] > box->max[ j ] ? c[ j ] - box->max[ j ] : 0 );
+          d2 += (double) d * (double) d;
+        }
+      double r = (double) E->r + ( E->min_h > 0 ? sqrt( 3.0 ) * (double) ( 1 << E->min_h ) : 0.0 );
+      if ( d2 <= r * r ) E->valid = 0;
+    }
+}
+
+Value Image_source( void* img, int x, int y, int z )
+{
+  return Image_get( (Image*) img, x, y, z );
+}
+
+// Number of values of a brick of height h: its levels 1 to h.
+size_t SparseMipMap_brick_size( int h )
+{
+  return ( ( (size_t) 8 << ( 3*h ) ) - 8 ) / 7;
+}
+
+// Offset of the relative level j (1 <= j <= h) within a brick.
+size_t SparseMipMap_brick_offset( int j )
+{
+  return ( ( (size_t) 1 << ( 3*j ) ) - 8 ) / 7;
+}
+
+// Returns the index of n new consecutive nodes.
+int SparseMipMap_new_nodes( SparseMipMap* S, int n )
+{
+  if ( S->nb_nodes + n > S->cap_nodes )
+    {
+      S->cap_nodes = 2 * ( S->nb_nodes + n );
+      S->nodes     = (SparseNode*) realloc( S->nodes, S->cap_nodes * sizeof( SparseNode ) );
+    }
+  S->nb_nodes += n;
+  return S->nb_nodes - n;
+}
+
+// Returns the index of a new brick.
+int SparseMipMap_new_brick( SparseMipMap* S )
+{
+  size_t bs = SparseMipMap_brick_size( S->max_lvl - S->brick_lvl );
+  if ( S->nb_bricks == S->cap_bricks )
+    {
+      S->cap_bricks = 2 * S->nb_bricks + 1;
+      S->bricks     = (Value*) realloc( S->bricks, S->cap_bricks * bs * sizeof( Value ) );
+    }
+  return S->nb_bricks++;
+}
+
+/*
+  Builds the node n of the cell (x,y,z) at level k. Averages are
+  computed in the same order as MipMap_init_from_image_and_functor.
+  Uniform children are merged into their parent.
+*/
+void SparseMipMap_build( SparseMipMap* S, VoxelSource src, void* data, VoxelFunctor f,
+                         int n, int x, int y, int z, int k )
+{
+  if ( k == S->brick_lvl )
+    {
+      int    h    = S->max_lvl - k;
+      size_t nb   = (size_t) 1 << ( 3*h );
+      Value* fine = (Value*) malloc( nb * sizeof( Value ) );
+      int    uniform = 1;
+      for ( size_t j = 0; j < nb; ++j )
+        {
+          int vx = ( x << h ) + (int) Morton_compact( j );
+          int vy = ( y << h ) + (int) Morton_compact( j >> 1 );
+          int vz = ( z << h ) + (int) Morton_compact( j >> 2 );
+          fine[ j ] = f( src( data, vx, vy, vz ), vx, vy, vz );
+          uniform   = uniform && ( fine[ j ] == fine[ 0 ] );
+        }
+      if ( uniform || ( h == 0 ) )
+        {
+          S->nodes[ n ].value    = fine[ 0 ];
+          S->nodes[ n ].children = -1;
         }
       else
-        { // cell is completely inside
-          if ( d2 <= upper2 ) 
+        {
+          int    b     = SparseMipMap_new_brick( S );
+          Value* brick = S->bricks + b * SparseMipMap_brick_size( h );
+          Value  root;
+          for ( int j = h; j >= 1; --j )
             {
-              // printf("[%d] %d %d %d\n", k, xyzk[ 0 ], xyzk[ 1 ], xyzk[ 2 ] );
-              acc += weight[ k ] * Image_get( MipMap_get_image( M, k ), 
-                                              xyzk[ 0 ], xyzk[ 1 ], xyzk[ 2 ] );
-              nb_access_approx[ min_h ] += 1;
-              goNext( xyzk );
+              const Value* fsrc = ( j == h ) ? fine : brick + SparseMipMap_brick_offset( j+1 );
+              Value*       fdst = brick + SparseMipMap_brick_offset( j );
+              if ( j == h )
+                for ( size_t i = 0; i < nb; ++i ) fdst[ i ] = fine[ i ];
+              else
+                for ( size_t i = 0; i < ( (size_t) 1 << ( 3*j ) ); ++i, fsrc += 8 )
+                  {
+                    Value v = fsrc[ 0 ];
+                    for ( int c = 1; c < 8; ++c ) v += fsrc[ c ];
+                    fdst[ i ] = v / (Value) 8;
+                  }
             }
-          else if ( d2 > lower2 )
-            // cell is completely outside
-            goNext( xyzk );                 
-          else if ( h > min_h ) 
-            goDown( xyzk );
-          else
-            goNext( xyzk );                 
+          root = brick[ 0 ];
+          for ( int c = 1; c < 8; ++c ) root += brick[ c ];
+          S->nodes[ n ].value    = root / (Value) 8;
+          S->nodes[ n ].children = b;
+        }
+      free( fine );
+      return;
+    }
+  int c = SparseMipMap_new_nodes( S, 8 );
+  for ( int i = 0; i < 8; ++i )
+    SparseMipMap_build( S, src, data, f, c+i, 
+                        2*x + ( i & 1 ), 2*y + ( ( i >> 1 ) & 1 ), 2*z + ( i >> 2 ), k+1 );
+  Value v       = S->nodes[ c ].value;
+  int   uniform = S->nodes[ c ].children < 0;
+  for ( int i = 1; i < 8; ++i )
+    {
+      v      += S->nodes[ c+i ].value;
+      uniform = uniform && ( S->nodes[ c+i ].children < 0 ) 
+        && ( S->nodes[ c+i ].value == S->nodes[ c ].value );
+    }
+  if ( uniform )
+    { // leaf children did not allocate anything after them.
+      S->nodes[ n ].value    = S->nodes[ c ].value;
+      S->nodes[ n ].children = -1;
+      S->nb_nodes            = c;
+    }
+  else
+    {
+      S->nodes[ n ].value    = v / (Value) 8;
+      S->nodes[ n ].children = c;
+    }
+}
+
+void SparseMipMap_init_from_source_and_functor( SparseMipMap* S, int lvl, 
+                                                VoxelSource src, void* data, VoxelFunctor f )
+{
+  assert( ( lvl >= 0 ) && ( lvl <= LVL ) );
+  S->max_lvl    = lvl;
+  S->brick_lvl  = lvl > BRICK_H ? lvl - BRICK_H : 0;
+  LevelTables_init( &S->tables, lvl );
+  S->nodes      = 0;
+  S->nb_nodes   = S->cap_nodes  = 0;
+  S->bricks     = 0;
+  S->nb_bricks  = S->cap_bricks = 0;
+  SparseMipMap_new_nodes( S, 1 );
+  SparseMipMap_build( S, src, data, f, 0, 0, 0, 0, 0 );
+}
+
+void SparseMipMap_init_from_image_and_functor( SparseMipMap* S, Image* img, VoxelFunctor f )
+{
+  SparseMipMap_init_from_source_and_functor( S, img->lvl, Image_source, img, f );
+}
+
+size_t SparseMipMap_memory( SparseMipMap* S )
+{
+  return S->nb_nodes * sizeof( SparseNode )
+    + S->nb_bricks * SparseMipMap_brick_size( S->max_lvl - S->brick_lvl ) * sizeof( Value );
+}
+
+void SparseMipMap_finish( SparseMipMap* S )
+{
+  free( S->nodes );
+  free( S->bricks );
+  S->nodes     = 0;
+  S->bricks    = 0;
+  S->nb_nodes  = S->cap_nodes  = 0;
+  S->nb_bricks = S->cap_bricks = 0;
+  S->max_lvl   = 0;
+}
+
+// A cell to visit in the sparse octree: either a node, or a cell of
+// a brick (cell.index being its Morton index within the brick), or a
+// cell within a uniform node.
+struct SSparseCell {
+  OctreeCell cell;
+  int        node;   // node index, or -1
+  int        brick;  // brick index, or -1
+  Value      value;  // value of a cell within a uniform node
+};
+typedef struct SSparseCell SparseCell;
+
+// Returns the child i of the sparse cell C.
+SparseCell SparseCell_child( SparseMipMap* S, const SparseCell* C, int i )
+{
+  int        k = C->cell.k;
+  SparseCell D = { { 2*C->cell.x + ( i & 1 ), 2*C->cell.y + ( ( i >> 1 ) & 1 ),
+                     2*C->cell.z + ( i >> 2 ), k+1, 0 },
+                   -1, -1, C->value };
+  if ( C->node >= 0 )
+    {
+      int c = S->nodes[ C->node ].children;
+      if ( c < 0 )                   D.value = S->nodes[ C->node ].value;
+      else if ( k < S->brick_lvl )   D.node  = c + i;
+      else                         { D.brick = c; D.cell.index = i; }
+    }
+  else if ( C->brick >= 0 )
+    {
+      D.brick      = C->brick;
+      D.cell.index = 8*C->cell.index + i;
+    }
+  return D;
+}
+
+// Returns the average value of the sparse cell C.
+Value SparseCell_value( SparseMipMap* S, const SparseCell* C )
+{
+  if ( C->node  >= 0 ) return S->nodes[ C->node ].value;
+  if ( C->brick <  0 ) return C->value;
+  return S->bricks[ C->brick * SparseMipMap_brick_size( S->max_lvl - S->brick_lvl )
+                    + SparseMipMap_brick_offset( C->cell.k - S->brick_lvl ) + C->cell.index ];
+}
+
+/*
+  Same traversal as integrateHierarchy, with the same bounds and
+  children tests, but the values of the cells are read in the sparse
+  octree. Products are accumulated in double as in the dense
+  traversal, so that results are the same as
+  computeApproximateHierarchy (computeHierarchy when min_h is 0).
+*/
+Value computeSparseApproximateHierarchy( SparseMipMap* S, int x0, int y0, int z0, Value r, int min_h )
+{
+  Value upper2[ LVL+1 ];
+  Value lower2[ LVL+1 ];
+  int   max_k = S->max_lvl;
+  LevelTables_bounds( &S->tables, max_k, r, min_h, upper2, lower2 );
+  int    max_down = max_k - ( min_h > 0 ? min_h : 0 ); // cells above are subdivided.
+  int    qx = 2*x0+1, qy = 2*y0+1, qz = 2*z0+1; // query in Khalimsky coordinates
+  double acc = 0.0;
+
+  SparseCell stack[ 8*(LVL+1) ];
+  int        top = 0;
+  Value      d2  = distance2( 1 << max_k, 1 << max_k, 1 << max_k, qx, qy, qz ) / (Value) 4;
+  if ( d2 <= upper2[ 0 ] )
+    acc += S->tables.weight[ 0 ] * S->nodes[ 0 ].value;
+  else if ( ( d2 <= lower2[ 0 ] ) && ( 0 < max_down ) )
+    {
+      SparseCell root = { { 0, 0, 0, 0, 0 }, 0, -1, (Value) 0 };
+      stack[ top++ ] = root;
+    }
+  while ( top > 0 )
+    {
+      SparseCell C = stack[ --top ];
+      int        k = C.cell.k + 1; // level of the children
+      int        inside[ 8 ], crossing[ 8 ];
+      OctreeCell_test_children( &C.cell, max_k, qx, qy, qz, upper2, lower2, inside, crossing );
+      Value      w = S->tables.weight[ k ];
+      for ( int i = 0; i < 8; ++i )
+        if ( inside[ i ] )
+          {
+            SparseCell D = SparseCell_child( S, &C, i );
+            acc += w * SparseCell_value( S, &D );
+          }
+      if ( k < max_down )
+        for ( int i = 7; i >= 0; --i ) // child 0 is visited first.
+          if ( crossing[ i ] )
+            stack[ top++ ] = SparseCell_child( S, &C, i );
+    }
+  return (Value) acc;
+}
+
+Value computeSparseHierarchy( SparseMipMap* S, int x0, int y0, int z0, Value r )
+{
+  return computeSparseApproximateHierarchy( S, x0, y0, z0, r, 0 );
+}
+
+/*
+  Compute the exact integration of the moments of \a M within
+  the ball of radius r and center (x0,y0,z0), and stores them in \a
+  moments.
+
+  The octree traversal is integrateHierarchy, as for computeHierarchy:
+  it depends only on the geometry, hence all moments are accumulated
+  along the same walk. Global counters are not updated so that it may
+  be called concurrently.
+*/
+void computeHierarchyMoments( MomentMipMap* M, int x0, int y0, int z0, Value r, double moments[] )
+{
+  for ( int m = 0; m < NB_MOMENTS; ++m ) moments[ m ] = 0.0;
+  integrateHierarchy( M->data, NB_MOMENTS, M->max_lvl, &M->tables, x0, y0, z0, r, 0, 
+                      moments, 0, 0 );
+}
+
+/*
+  Same as computeHierarchyMoments, but small balls are integrated by
+  scanning the finest level (see integrateBall). Used by the batch
+  computeCovariances.
+*/
+void computeBallMoments( MomentMipMap* M, int x0, int y0, int z0, Value r, double moments[] )
+{
+  for ( int m = 0; m < NB_MOMENTS; ++m ) moments[ m ] = 0.0;
+  integrateBall( M->data, NB_MOMENTS, M->max_lvl, &M->tables, x0, y0, z0, r, 
+                 moments, 0, 0 );
+}
+
+/*
+  Computes the volume, centroid and centered covariance tensor from
+  the moments given in the order of moment_functors.
+*/
+void Covariance_from_moments( Covariance* C, const double moments[] )
+{
+  double v = moments[ 0 ];
+  C->volume = v;
+  for ( int i = 0; i < 3; ++i ) 
+    C->centroid[ i ] = ( v != 0.0 ) ? moments[ 1 + i ] / v : 0.0;
+  // J = M2 - M1.M1^t / M0
+  C->tensor[ 0 ] = moments[ 4 ] - v * C->centroid[ 0 ] * C->centroid[ 0 ];
+  C->tensor[ 1 ] = moments[ 5 ] - v * C->centroid[ 1 ] * C->centroid[ 1 ];
+  C->tensor[ 2 ] = moments[ 6 ] - v * C->centroid[ 2 ] * C->centroid[ 2 ];
+  C->tensor[ 3 ] = moments[ 7 ] - v * C->centroid[ 0 ] * C->centroid[ 1 ];
+  C->tensor[ 4 ] = moments[ 8 ] - v * C->centroid[ 0 ] * C->centroid[ 2 ];
+  C->tensor[ 5 ] = moments[ 9 ] - v * C->centroid[ 1 ] * C->centroid[ 2 ];
+}
+
+// A query and its position along the Morton curve.
+struct SMortonQuery {
+  unsigned long long code;
+  int                index;
+};
+typedef struct SMortonQuery MortonQuery;
+
+int MortonQuery_compare( const void* p1, const void* p2 )
+{
+  const MortonQuery* q1 = (const MortonQuery*) p1;
+  const MortonQuery* q2 = (const MortonQuery*) p2;
+  return ( q1->code < q2->code ) ? -1 : ( ( q1->code > q2->code ) ? 1 : 0 );
+}
+
+// Number of consecutive queries handed to a thread at once.
+#define BATCH_CHUNK 64
+
+// The work shared by the threads of computeCovariances.
+struct SBatch {
+  MomentMipMap*   M;
+  int             nb;
+  const int*      centers;
+  Value           r;
+  Covariance*     C;
+  MortonQuery*    queries; // sorted along the Morton curve
+  int             next;    // first query not yet handed to a thread
+  pthread_mutex_t mutex;
+};
+typedef struct SBatch Batch;
+
+void* Batch_run( void* arg )
+{
+  Batch* B = (Batch*) arg;
+  double moments[ NB_MOMENTS ];
+  for ( ;; )
+    {
+      pthread_mutex_lock( &B->mutex );
+      int b = B->next;
+      B->next += BATCH_CHUNK;
+      pthread_mutex_unlock( &B->mutex );
+      if ( b >= B->nb ) break;
+      int e = ( b + BATCH_CHUNK < B->nb ) ? b + BATCH_CHUNK : B->nb;
+      for ( int i = b; i < e; ++i )
+        {
+          int q = B->queries[ i ].index;
+          const int* c = B->centers + 3*q;
+          computeBallMoments( B->M, c[ 0 ], c[ 1 ], c[ 2 ], B->r, moments );
+          Covariance_from_moments( &B->C[ q ], moments );
         }
     }
-  while ( xyzk[ 3 ] > 0 );
-  return acc;
+  return 0;
+}
+
+/*
+  Computes the covariance tensors C[i] of the shape cap the ball of
+  radius r centered at (centers[3i],centers[3i+1],centers[3i+2]), for
+  0 <= i < nb, with the moments of \a M.
+
+  Queries are processed along the Morton curve, so that consecutive
+  queries descend the same octree cells while they are still in
+  cache. Chunks of consecutive queries are distributed among \a
+  nb_threads threads.
+*/
+void computeCovariances( MomentMipMap* M, int nb, const int centers[], Value r, 
+                         Covariance C[], int nb_threads )
+{
+  Batch B;
+  B.M       = M;
+  B.nb      = nb;
+  B.centers = centers;
+  B.r       = r;
+  B.C       = C;
+  B.next    = 0;
+  B.queries = (MortonQuery*) malloc( ( nb > 0 ? nb : 1 ) * sizeof( MortonQuery ) );
+  for ( int i = 0; i < nb; ++i )
+    {
+      B.queries[ i ].code  = Morton_code( centers[ 3*i ], centers[ 3*i+1 ], centers[ 3*i+2 ] );
+      B.queries[ i ].index = i;
+    }
+  qsort( B.queries, nb, sizeof( MortonQuery ), MortonQuery_compare );
+  pthread_mutex_init( &B.mutex, 0 );
+  if ( nb_threads < 1 ) nb_threads = 1;
+  pthread_t* threads = (pthread_t*) malloc( nb_threads * sizeof( pthread_t ) );
+  int nb_started = 0;
+  for ( int t = 1; t < nb_threads; ++t )
+    if ( pthread_create( &threads[ nb_started ], 0, Batch_run, &B ) == 0 )
+      nb_started += 1;
+  Batch_run( &B ); // the calling thread works too.
+  for ( int t = 0; t < nb_started; ++t )
+    pthread_join( threads[ t ], 0 );
+  pthread_mutex_destroy( &B.mutex );
+  free( threads );
+  free( B.queries );
 }
 
 
@@ -464,13 +1591,19 @@ int main( int argc, char* argv[] )
 {
   if ( argc == 1 ) 
     {
-      printf("Usage: %s <lvl> <R> <r>\n", argv[ 0 ] );
+      printf("Usage: %s <lvl> <R> <r> [<nb_threads> [<file>]]\n", argv[ 0 ] );
       printf("       - computes the exact, hierarchical and approximate\n" );
       printf("         volumes/moments of a big ball of radius <R> which\n" );
       printf("         touches the center of the space, intersected by a\n" );
       printf("         ball of radius <r> centered on the center of the\n" );
       printf("         space. The discrete space has size 2^<lvl> in each\n" );
       printf("         direction.\n");
+      printf("       - computes then the covariance tensors of the\n" );
+      printf("         big ball cap ball(<r>) at every boundary voxel\n" );
+      printf("         of the big ball with <nb_threads> threads.\n" );
+      printf("       - the moment MipMap is mapped from <file> if it\n" );
+      printf("         was saved from the same volume, otherwise it is\n" );
+      printf("         built and saved in it.\n" );
       printf("Example:\n");
       printf("%s 6 15 5.5\n", argv[ 0 ] );
       return 0;
@@ -478,6 +1611,8 @@ int main( int argc, char* argv[] )
   int lvl = argc > 1 ? atoi( argv[ 1 ] ) : 6;
   Value R = argc > 2 ? atof( argv[ 2 ] ) : 15.0;
   Value r = argc > 3 ? atof( argv[ 3 ] ) : 5.0;
+  int nb_threads = argc > 4 ? atoi( argv[ 4 ] ) : 4;
+  const char* file = argc > 5 ? argv[ 5 ] : 0;
   
   Image I;
   Image_init( &I, lvl );
@@ -503,7 +1638,90 @@ int main( int argc, char* argv[] )
       Value hier_approx = computeApproximateHierarchy( &vol, x0, y0, z0, r, i );
       printf("     - hier. approx value [%d] = %f, iter/access %d/%d\n", i, hier_approx, nb_iteration_approx[ i ], nb_access_approx[ i ] );
     }
+
+  printf("---- Removing a box of side 4 at the center and updating ----\n" );
+  QueryCache cache;
+  QueryCache_init( &cache, 10 );
+  computeCachedHierarchy( &vol, &cache, x0, y0, z0, r, 0 );
+  Box edit = { { x0-2, y0-2, z0-2 }, { x0+1, y0+1, z0+1 } };
+  for ( int z = edit.min[ 2 ]; z <= edit.max[ 2 ]; ++z )
+    for ( int y = edit.min[ 1 ]; y <= edit.max[ 1 ]; ++y )
+      for ( int x = edit.min[ 0 ]; x <= edit.max[ 0 ]; ++x )
+        Image_set( &I, x, y, z, (Value) 0 );
+  struct timespec t0, t1;
+  clock_gettime( CLOCK_MONOTONIC, &t0 );
+  MipMap_update_box( &vol, &I, moment000, &edit, &cache );
+  clock_gettime( CLOCK_MONOTONIC, &t1 );
+  printf("     - update in %f s\n", 
+         (double) ( t1.tv_sec - t0.tv_sec ) + 1e-9 * (double) ( t1.tv_nsec - t0.tv_nsec ) );
+  printf("     - exact discrete value = %f, cached hier. value = %f\n", 
+         computeExact( &vol, x0, y0, z0, r ), computeCachedHierarchy( &vol, &cache, x0, y0, z0, r, 0 ) );
+  QueryCache_finish( &cache );
+
+  printf("---- Creating sparse MipMap for volume ----\n" );
+  SparseMipMap svol;
+  SparseMipMap_init_from_image_and_functor( &svol, &I, moment000 );
+  printf("     - memory dense = %zu bytes, sparse = %zu bytes\n", 
+         ( ( (size_t) 8 << ( 3*lvl ) ) - 1 ) / 7 * sizeof( Value ), SparseMipMap_memory( &svol ) );
+  printf("     - sparse hier. discrete value = %f\n", computeSparseHierarchy( &svol, x0, y0, z0, r ) );
+  for ( int i = 0; i < lvl; ++i )
+    printf("     - sparse hier. approx value [%d] = %f\n", i, 
+           computeSparseApproximateHierarchy( &svol, x0, y0, z0, r, i ) );
+  SparseMipMap_finish( &svol );
+
+  printf("---- Computing covariance tensors at boundary voxels ----\n" );
+  int  nb      = 0;
+  int* centers = (int*) malloc( 3 * I.size * I.size * I.size * sizeof( int ) );
+  for ( int z = 1; z < I.size-1; ++z )
+    for ( int y = 1; y < I.size-1; ++y )
+      for ( int x = 1; x < I.size-1; ++x )
+        if ( ( Image_get( &I, x, y, z ) != 0 )
+             && ( ( Image_get( &I, x-1, y, z ) == 0 ) || ( Image_get( &I, x+1, y, z ) == 0 )
+                  || ( Image_get( &I, x, y-1, z ) == 0 ) || ( Image_get( &I, x, y+1, z ) == 0 )
+                  || ( Image_get( &I, x, y, z-1 ) == 0 ) || ( Image_get( &I, x, y, z+1 ) == 0 ) ) )
+          {
+            centers[ 3*nb   ] = x;
+            centers[ 3*nb+1 ] = y;
+            centers[ 3*nb+2 ] = z;
+            nb += 1;
+          }
+  clock_gettime( CLOCK_MONOTONIC, &t0 );
+  MomentMipMap moments;
+  uint64_t source = Image_checksum( &I );
+  int      mapped = ( file != 0 ) && MomentMipMap_map( &moments, file, source );
+  if ( ( file != 0 ) && ! mapped && ( access( file, F_OK ) == 0 ) )
+    printf("     - %s does not hold the moment MipMap of this volume\n", file );
+  if ( ! mapped )
+    MomentMipMap_init_from_image( &moments, &I, nb_threads );
+  clock_gettime( CLOCK_MONOTONIC, &t1 );
+  printf("     - moment MipMap %s in %f s with %d threads\n", mapped ? "mapped" : "built",
+         (double) ( t1.tv_sec - t0.tv_sec ) + 1e-9 * (double) ( t1.tv_nsec - t0.tv_nsec ), nb_threads );
+  if ( ( file != 0 ) && ! mapped )
+    printf("     - saving moment MipMap in %s: %s\n", file, 
+           MomentMipMap_save( &moments, file, source ) ? "ok" : "failed" );
+  Covariance* C = (Covariance*) malloc( ( nb > 0 ? nb : 1 ) * sizeof( Covariance ) );
+  clock_gettime( CLOCK_MONOTONIC, &t0 );
+  computeCovariances( &moments, nb, centers, r, C, nb_threads );
+  clock_gettime( CLOCK_MONOTONIC, &t1 );
+  double max_err = 0.0;
+  for ( int i = 0; i < nb; i += ( nb / 100 ) + 1 )
+    {
+      double v = computeHierarchy( &vol, centers[ 3*i ], centers[ 3*i+1 ], centers[ 3*i+2 ], r );
+      max_err  = fabs( v - C[ i ].volume ) > max_err ? fabs( v - C[ i ].volume ) : max_err;
+    }
+  printf("     - %d queries in %f s with %d threads\n", nb, 
+         (double) ( t1.tv_sec - t0.tv_sec ) + 1e-9 * (double) ( t1.tv_nsec - t0.tv_nsec ), nb_threads );
+  printf("     - max volume error w.r.t. computeHierarchy = %f\n", max_err );
+  if ( nb > 0 )
+    printf("     - query 0 at (%d,%d,%d): V=%f J=[%f %f %f | %f %f %f]\n", 
+           centers[ 0 ], centers[ 1 ], centers[ 2 ], C[ 0 ].volume, 
+           C[ 0 ].tensor[ 0 ], C[ 0 ].tensor[ 1 ], C[ 0 ].tensor[ 2 ],
+           C[ 0 ].tensor[ 3 ], C[ 0 ].tensor[ 4 ], C[ 0 ].tensor[ 5 ] );
+
   printf("---- Freeing memory ----\n" );
+  free( C );
+  free( centers );
+  MomentMipMap_finish( &moments );
   MipMap_finish( &vol );
   Image_finish( &I );
   return 0;